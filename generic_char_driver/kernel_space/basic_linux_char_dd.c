@@ -13,10 +13,26 @@
  *
  ^ File Operations (fops):
  *	open: Handles opening the device
- *	read: Copies data from the kernel to the user-space
- *	write: Takes input from the user-space and stores it
- *	in the kernel
+ *	read_iter: Copies data from the kernel to the user-space
+ *	write_iter: Takes input from the user-space and stores it
+ *	in the kernel; as iov_iter based callbacks they serve
+ *	read/write, readv/writev and io_uring alike
+ *	splice_read/splice_write: Move data between a pipe and the
+ *	device without a bounce through user buffers
+ *	poll: Readable while a message is stored, always writable
  *	release: Closes the device
+ *	unlocked_ioctl: Accesses the simulated register bank
+ *	mmap: Maps the simulated register bank to user-space
+ *
+ * Observability:
+ *	The file operations do not printk(); they update per-CPU
+ *	counters, shown in /sys/class/generic_class/generic_driver/
+ *	stats/, and fire the generic_driver tracepoints
+ *
+ * Simulated hardware (hw_access.c):
+ *	A bank of reg_bank_regs 32-bit registers with read-only,
+ *	write-1-to-clear and read-to-clear registers, accessed
+ *	with readl()/writel() style barriered or relaxed accessors
  *
  * Module Macros:
  *	module_init and module_exit macros tell the kernel
@@ -29,49 +45,187 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/cdev.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sysfs.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/sched/signal.h>	// fatal_signal_pending
 #include <asm-generic/ioctl.h>
 
+#include "hw_access.h"
+#include "generic_driver_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "generic_driver_trace.h"
+
 #define DEVICE_NAME "generic_driver"
 #define CLASS_NAME  "generic_class"
 
-#define IOCTL_SET_REGISTER _IOW('s', 1, int32_t*)
-#define IOCTL_GET_REGISTER _IOR('s', 2, int32_t*)
+// Size of the simulated register bank, in 32-bit registers
+static unsigned int reg_bank_regs = 1024;
+module_param(reg_bank_regs, uint, 0444);
+MODULE_PARM_DESC(reg_bank_regs, "number of simulated 32-bit registers (min 32)");
 
 static int major_number;
 static struct class* char_class = NULL;
 static struct device* char_device = NULL;
 
-// Example of simulated hardware register
-static int simulated_register;
+// Simulated hardware registers, GD_REG_CTRL is the legacy register
+static struct hw_reg_bank reg_bank;
+
+// read()/write() data lives in the GD_REG_DATA window of the bank
+static u8 *data_window;
+static size_t data_size;
+static size_t data_len;
+static u8 *bounce;
+static DEFINE_MUTEX(data_lock);
+static DECLARE_WAIT_QUEUE_HEAD(data_wq);
+
+// Per-CPU event counters, no shared cache line on the hot path
+struct gd_stats {
+	u64 opens;
+	u64 releases;
+	u64 bytes_in;		// written by user-space
+	u64 bytes_out;		// read by user-space
+	u64 ioctls;
+	u64 errors;		// failed read, write and ioctl calls
+};
+
+static DEFINE_PER_CPU(struct gd_stats, gd_stats);
+
+static u64 gd_stats_sum(size_t field)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((u8 *)per_cpu_ptr(&gd_stats, cpu) + field);
+
+	return sum;
+}
+
+#define GD_STATS_ATTR(name)						\
+static ssize_t name##_show(struct device *dev,				\
+			   struct device_attribute *attr, char *buf)	\
+{									\
+	return sysfs_emit(buf, "%llu\n",					\
+			  gd_stats_sum(offsetof(struct gd_stats, name)));\
+}									\
+static DEVICE_ATTR_RO(name)
+
+GD_STATS_ATTR(opens);
+GD_STATS_ATTR(releases);
+GD_STATS_ATTR(bytes_in);
+GD_STATS_ATTR(bytes_out);
+GD_STATS_ATTR(ioctls);
+GD_STATS_ATTR(errors);
+
+static struct attribute *gd_stats_attrs[] = {
+	&dev_attr_opens.attr,
+	&dev_attr_releases.attr,
+	&dev_attr_bytes_in.attr,
+	&dev_attr_bytes_out.attr,
+	&dev_attr_ioctls.attr,
+	&dev_attr_errors.attr,
+	NULL,
+};
+
+static const struct attribute_group gd_stats_group = {
+	.name = "stats",
+	.attrs = gd_stats_attrs,
+};
 
-static char message[256] = {0};
-static short message_size;
+static const struct attribute_group *gd_groups[] = {
+	&gd_stats_group,
+	NULL,
+};
 // static struct cdev char_cdev;
 
 // Function prototypes
 static int device_open(struct inode*, struct file*);
 static int device_release(struct inode*, struct file*);
-static ssize_t device_read(struct file*, char*, size_t, loff_t*);
-static ssize_t device_write(struct file*, const char*, size_t, loff_t*);
-static ssize_t device_ioctl(struct file*, unsigned int cmd, unsigned long arg);
+static ssize_t device_read_iter(struct kiocb*, struct iov_iter*);
+static ssize_t device_write_iter(struct kiocb*, struct iov_iter*);
+static long device_ioctl(struct file*, unsigned int cmd, unsigned long arg);
+static int device_mmap(struct file*, struct vm_area_struct*);
+static __poll_t device_poll(struct file*, poll_table*);
 
 static struct file_operations fops = {
 	.open = device_open,
-	.read = device_read,
-	.write = device_write,
+	.read_iter = device_read_iter,
+	.write_iter = device_write_iter,
+	.splice_read = copy_splice_read,
+	.splice_write = iter_file_splice_write,
 	.unlocked_ioctl = device_ioctl,
+	.mmap = device_mmap,
+	.poll = device_poll,
 	.release = device_release,
 };
 
+// Power-on state of the simulated device
+static int reg_bank_init(void)
+{
+	int ret;
+
+	if (reg_bank_regs < GD_REG_MIN_REGS)
+		return -EINVAL;
+
+	ret = hw_reg_bank_alloc(&reg_bank, reg_bank_regs);
+	if (ret)
+		return ret;
+
+	// Staging buffer between user-space and the bank, any copy fits
+	bounce = kvmalloc(reg_bank.size, GFP_KERNEL);
+	if (!bounce) {
+		hw_reg_bank_free(&reg_bank);
+		return -ENOMEM;
+	}
+
+	data_window = (u8 *)reg_bank.regs + GD_REG_DATA;
+	data_size = (reg_bank.nr_regs << 2) - GD_REG_DATA;
+
+	hw_reg_set_type(&reg_bank, GD_REG_CTRL, HW_REG_RW);
+	hw_reg_set_type(&reg_bank, GD_REG_STATUS, HW_REG_RO);
+	hw_reg_set_type(&reg_bank, GD_REG_ISR, HW_REG_W1C);
+	hw_reg_set_type(&reg_bank, GD_REG_ICR, HW_REG_RC);
+
+	hw_reg_raw_write32(&reg_bank, GD_REG_STATUS, GD_STATUS_READY |
+		(min(reg_bank_regs, 0xffffU) << GD_STATUS_NR_REGS_SHIFT));
+
+	return 0;
+}
+
+static void reg_bank_exit(void)
+{
+	kvfree(bounce);
+	hw_reg_bank_free(&reg_bank);
+}
+
 // Initialize the module
 static int __init char_driver_init(void)
 {
+	int ret;
+
 	printk(KERN_INFO "%s: Initializing the driver\n", DEVICE_NAME);
 
+	ret = reg_bank_init();
+	if (ret) {
+		printk(KERN_ALERT "%s: Failed to allocate %u simulated registers\n",
+			DEVICE_NAME, reg_bank_regs);
+		return ret;
+	}
+
 	// Dynamically allocate a major number for the device
 	major_number = register_chrdev(0, DEVICE_NAME, &fops);
 	if (major_number < 0) {
 		printk(KERN_ALERT "%s failed to register a major number\n", DEVICE_NAME);
+		reg_bank_exit();
 		return major_number;
 	}
 	printk(KERN_INFO "%s: Registered device [%s] with major number %d\n",
@@ -82,6 +236,7 @@ static int __init char_driver_init(void)
 	char_class = class_create(CLASS_NAME);
 	if (IS_ERR(char_class)) {
 		unregister_chrdev(major_number, DEVICE_NAME);
+		reg_bank_exit();
 		printk(KERN_ALERT "%s: Failed to register device class [%s]\n",
 			DEVICE_NAME, CLASS_NAME);
 		return PTR_ERR(char_class);
@@ -89,11 +244,12 @@ static int __init char_driver_init(void)
 	printk(KERN_INFO "%s: Device class registered [%s]\n", DEVICE_NAME, CLASS_NAME);
 
 	// Register the device driver
-	char_device = device_create(char_class, NULL, MKDEV(major_number, 0), NULL,
-			DEVICE_NAME);
+	char_device = device_create_with_groups(char_class, NULL,
+			MKDEV(major_number, 0), NULL, gd_groups, DEVICE_NAME);
 	if (IS_ERR(char_device)) {
 		class_destroy(char_class);
 		unregister_chrdev(major_number, DEVICE_NAME);
+		reg_bank_exit();
 		printk(KERN_ALERT "%s: Failed to create the device [%s]\n",
 			DEVICE_NAME, DEVICE_NAME);
 		return PTR_ERR(char_device);
@@ -110,6 +266,7 @@ static void __exit char_driver_exit(void)
 	class_unregister(char_class);
 	class_destroy(char_class);
 	unregister_chrdev(major_number, DEVICE_NAME);
+	reg_bank_exit();
 	printk(KERN_INFO "%s: Exit from the device driver [%s]\n",
 		DEVICE_NAME, DEVICE_NAME);
 }
@@ -117,53 +274,437 @@ static void __exit char_driver_exit(void)
 // Open the device
 static int device_open(struct inode* inodep, struct file* filep)
 {
-	printk(KERN_INFO "%s: Device [%s] opened\n", DEVICE_NAME, DEVICE_NAME);
-	return 0;
+	this_cpu_inc(gd_stats.opens);
+	trace_gd_open(filep);
+
+	// No file position: read()/write() never take f_pos_lock
+	return stream_open(inodep, filep);
+}
+
+// IOCB_NOWAIT callers (io_uring) must not sleep on the data lock
+static bool data_lock_iocb(struct kiocb *iocb)
+{
+	if (iocb->ki_flags & IOCB_NOWAIT)
+		return mutex_trylock(&data_lock);
+
+	mutex_lock(&data_lock);
+	return true;
 }
 
-// Read from the device
-static ssize_t device_read(struct file* filep, char* buffer, size_t len, loff_t* offset)
+// Read from the device, consumes the data of the last write
+static ssize_t device_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	int error_count = 0;
+	size_t len = iov_iter_count(to);
+	size_t count, copied;
+	ssize_t ret;
+
+	if (!data_lock_iocb(iocb)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	// Non-blocking readers wait for EPOLLIN instead of spinning
+	if (!data_len && len && (iocb->ki_filp->f_flags & O_NONBLOCK)) {
+		mutex_unlock(&data_lock);
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	count = min(len, data_len);
+	hw_copy_fromio(bounce, data_window, count);
+	copied = copy_to_iter(bounce, count, to);
+	if (copied || !count)
+		data_len = 0;
+	mutex_unlock(&data_lock);
+
+	ret = (copied || !count) ? copied : -EFAULT;
+out:
+	if (ret >= 0)
+		this_cpu_add(gd_stats.bytes_out, ret);
+	else if (ret != -EAGAIN)
+		this_cpu_inc(gd_stats.errors);
+
+	trace_gd_read(iocb->ki_filp, len, ret);
+	return ret;
+}
+
+// Write to the device, all segments of the iterator form one message
+static ssize_t device_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	size_t len = iov_iter_count(from);
+	size_t count = min(len, data_size);
+	size_t copied;
+	ssize_t ret;
+
+	if (!data_lock_iocb(iocb)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	copied = copy_from_iter(bounce, count, from);
+	if (copied || !count) {
+		hw_copy_toio(data_window, bounce, copied);
+		data_len = copied;
+	}
+	mutex_unlock(&data_lock);
+
+	if (copied && wq_has_sleeper(&data_wq))
+		wake_up_interruptible_poll(&data_wq, EPOLLIN | EPOLLRDNORM);
+
+	ret = (copied || !count) ? copied : -EFAULT;
+out:
+	if (ret >= 0)
+		this_cpu_add(gd_stats.bytes_in, ret);
+	else if (ret != -EAGAIN)
+		this_cpu_inc(gd_stats.errors);
+
+	trace_gd_write(iocb->ki_filp, len, ret);
+	return ret;
+}
 
-	error_count = copy_to_user(buffer, message, message_size);
+// Single register access, barriered unless GD_REG_F_RELAXED is given
+static int reg_access(struct gd_reg_access *ra, bool write)
+{
+	if (!hw_reg_valid(&reg_bank, ra->offset))
+		return -EINVAL;
 
-	if (error_count == 0) {
-		printk(KERN_INFO "%s: Sent %d characters to the user\n",
-			DEVICE_NAME, message_size);
-		return (message_size = 0);
+	if (ra->flags & GD_REG_F_RAW) {
+		if (write)
+			hw_reg_raw_write32(&reg_bank, ra->offset, ra->value);
+		else
+			ra->value = hw_reg_raw_read32(&reg_bank, ra->offset);
+	} else if (ra->flags & GD_REG_F_RELAXED) {
+		if (write)
+			hw_reg_write32_relaxed(&reg_bank, ra->offset, ra->value);
+		else
+			ra->value = hw_reg_read32_relaxed(&reg_bank, ra->offset);
 	} else {
-		printk(KERN_INFO "%s: Failed to send %d characters to the user\n",
-			DEVICE_NAME, error_count);
-		return -EFAULT;
+		if (write)
+			hw_reg_write32(&reg_bank, ra->offset, ra->value);
+		else
+			ra->value = hw_reg_read32(&reg_bank, ra->offset);
 	}
+
+	return 0;
 }
 
-// Write to the device
-static ssize_t device_write(struct file* filep, const char* buffer, size_t len, loff_t* offset)
+// Batched access: relaxed accesses, one full barrier for the whole batch
+static int reg_batch(struct gd_reg_batch *rb)
 {
-	sprintf(message, "%s(%zu letters)", buffer, len);
-	message_size = strlen(message);
-	printk(KERN_INFO "%s: Received %zu characters from the user\n", DEVICE_NAME, len);
-	return len;
+	struct gd_reg_op __user *uops = u64_to_user_ptr(rb->ops);
+	struct gd_reg_op *ops;
+	u32 i;
+	int ret = 0;
+
+	if (!rb->count || rb->count > GD_REG_BATCH_MAX || rb->flags)
+		return -EINVAL;
+
+	ops = kvmalloc_array(rb->count, sizeof(*ops), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+
+	if (copy_from_user(ops, uops, rb->count * sizeof(*ops))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	// Unknown ops and flags are refused, room for later ones
+	for (i = 0; i < rb->count; i++) {
+		if (!hw_reg_valid(&reg_bank, ops[i].offset) ||
+		    (ops[i].op != GD_REG_OP_READ &&
+		     ops[i].op != GD_REG_OP_WRITE)) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < rb->count; i++) {
+		if (ops[i].op == GD_REG_OP_WRITE)
+			hw_reg_write32_relaxed(&reg_bank, ops[i].offset, ops[i].value);
+		else
+			ops[i].value = hw_reg_read32_relaxed(&reg_bank, ops[i].offset);
+	}
+	hw_reg_barrier();
+
+	if (copy_to_user(uops, ops, rb->count * sizeof(*ops)))
+		ret = -EFAULT;
+out:
+	kvfree(ops);
+	return ret;
 }
 
-static long device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+// Accesses between two chances for the scheduler and signals
+#define GD_BENCH_RESCHED	4096
+
+/*
+ * Time a register access loop in the kernel, without syscall overhead.
+ * The loop goes round the scratch registers only: CTRL and the ISR/ICR
+ * state belong to reg_access() users, and reads would clear them.
+ */
+static int reg_bench(struct gd_reg_bench *rb)
+{
+	unsigned int offset = GD_REG_SCRATCH, end = GD_REG_DATA;
+	u32 i, sink = 0;
+	u64 start;
+
+	if (rb->mode >= GD_BENCH_MAX || !rb->iterations ||
+	    rb->iterations > GD_BENCH_MAX_ITERATIONS)
+		return -EINVAL;
+	if (rb->mode == GD_BENCH_WRITE_BATCHED && !rb->batch)
+		return -EINVAL;
+
+#define FOR_EACH_BENCH_REG(body)				\
+	for (i = 0; i < rb->iterations; i++) {			\
+		body;						\
+		offset += 4;					\
+		if (offset == end)				\
+			offset = GD_REG_SCRATCH;		\
+		if ((i + 1) % GD_BENCH_RESCHED == 0) {		\
+			if (fatal_signal_pending(current))	\
+				return -EINTR;			\
+			cond_resched();				\
+		}						\
+	}
+
+	start = ktime_get_ns();
+	switch (rb->mode) {
+	case GD_BENCH_READ:
+		FOR_EACH_BENCH_REG(sink += hw_reg_read32(&reg_bank, offset));
+		break;
+	case GD_BENCH_READ_RELAXED:
+		FOR_EACH_BENCH_REG(sink += hw_reg_read32_relaxed(&reg_bank, offset));
+		break;
+	case GD_BENCH_WRITE:
+		FOR_EACH_BENCH_REG(hw_reg_write32(&reg_bank, offset, i));
+		break;
+	case GD_BENCH_WRITE_RELAXED:
+		FOR_EACH_BENCH_REG(hw_reg_write32_relaxed(&reg_bank, offset, i));
+		break;
+	case GD_BENCH_WRITE_BATCHED:
+		FOR_EACH_BENCH_REG(
+			hw_reg_write32_relaxed(&reg_bank, offset, i);
+			if ((i + 1) % rb->batch == 0)
+				hw_reg_barrier());
+		hw_reg_barrier();
+		break;
+	}
+	rb->elapsed_ns = ktime_get_ns() - start;
+
+#undef FOR_EACH_BENCH_REG
+
+	// Keep the read loops from being optimised away
+	OPTIMIZER_HIDE_VAR(sink);
+
+	return 0;
+}
+
+// Raw block transfer with fixed width accesses, through the bounce buffer
+static int reg_block(struct gd_reg_block *rb, bool write)
+{
+	void __user *ubuf = u64_to_user_ptr(rb->buf);
+	void *regs = (u8 *)reg_bank.regs + rb->offset;
+	size_t bytes;
+	int ret = 0;
+
+	if (rb->width != 1 && rb->width != 2 && rb->width != 4 && rb->width != 8)
+		return -EINVAL;
+	if (!IS_ALIGNED(rb->offset, rb->width))
+		return -EINVAL;
+
+	bytes = (size_t)rb->count * rb->width;
+	if (rb->offset > reg_bank.nr_regs << 2 ||
+	    bytes > (reg_bank.nr_regs << 2) - rb->offset)
+		return -EINVAL;
+
+	mutex_lock(&data_lock);
+	if (write && copy_from_user(bounce, ubuf, bytes)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	switch (rb->width) {
+	case 1:
+		if (write)
+			hw_copy_toio(regs, bounce, bytes);
+		else
+			hw_copy_fromio(bounce, regs, bytes);
+		break;
+	case 2:
+		if (write)
+			hw_copy16(regs, (u16 *)bounce, rb->count);
+		else
+			hw_copy16((u16 *)bounce, regs, rb->count);
+		break;
+	case 4:
+		if (write)
+			hw_copy32(regs, (u32 *)bounce, rb->count);
+		else
+			hw_copy32((u32 *)bounce, regs, rb->count);
+		break;
+	case 8:
+		if (write)
+			hw_copy64(regs, (u64 *)bounce, rb->count);
+		else
+			hw_copy64((u64 *)bounce, regs, rb->count);
+		break;
+	}
+	hw_reg_barrier();
+
+	if (!write && copy_to_user(ubuf, bounce, bytes))
+		ret = -EFAULT;
+out:
+	mutex_unlock(&data_lock);
+	return ret;
+}
+
+// Bytes copied between two chances for the scheduler and signals
+#define GD_COPY_RESCHED_BYTES	(1 << 20)
+
+/*
+ * Time bulk copies between memory and the data window, per element
+ * width. Any user of the node can ask for 2^24 rounds of the whole
+ * window: give the CPU up every GD_COPY_RESCHED_BYTES, and stop on a
+ * fatal signal.
+ */
+static int copy_bench(struct gd_copy_bench *cb)
+{
+	bool to_dev = cb->dir == GD_COPY_TO_DEV;
+	void *dst = to_dev ? (void *)data_window : bounce;
+	void *src = to_dev ? bounce : (void *)data_window;
+	u32 i, n = cb->bytes;
+	u64 start, since_resched = 0;
+	int ret = 0;
+
+	if (cb->mode >= GD_COPY_MAX || cb->dir > GD_COPY_FROM_DEV)
+		return -EINVAL;
+	if (!n || !IS_ALIGNED(n, 8) || n > data_size || !cb->iterations ||
+	    cb->iterations > GD_BENCH_MAX_ITERATIONS)
+		return -EINVAL;
+
+	mutex_lock(&data_lock);
+	start = ktime_get_ns();
+	for (i = 0; i < cb->iterations; i++) {
+		switch (cb->mode) {
+		case GD_COPY_8:
+			hw_copy8(dst, src, n);
+			break;
+		case GD_COPY_16:
+			hw_copy16(dst, src, n / 2);
+			break;
+		case GD_COPY_32:
+			hw_copy32(dst, src, n / 4);
+			break;
+		case GD_COPY_64:
+			hw_copy64(dst, src, n / 8);
+			break;
+		case GD_COPY_IO:
+			if (to_dev)
+				hw_copy_toio(dst, src, n);
+			else
+				hw_copy_fromio(dst, src, n);
+			break;
+		case GD_COPY_MEMCPY:
+			memcpy(dst, src, n);
+			break;
+		}
+
+		since_resched += n;
+		if (since_resched >= GD_COPY_RESCHED_BYTES) {
+			since_resched = 0;
+			if (fatal_signal_pending(current)) {
+				ret = -EINTR;
+				break;
+			}
+			cond_resched();
+		}
+	}
+	cb->elapsed_ns = ktime_get_ns() - start;
+	mutex_unlock(&data_lock);
+
+	return ret;
+}
+
+static long __device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
 {
+	void __user *uarg = (void __user *)arg;
+	struct gd_reg_access ra;
+	struct gd_reg_batch rbatch;
+	struct gd_reg_bench rbench;
+	struct gd_reg_info info;
+	struct gd_reg_block rblock;
+	struct gd_copy_bench cbench;
+	u32 value;
+	int ret;
+
 	switch (cmd) {
 		case IOCTL_SET_REGISTER:
-			if (copy_from_user(&simulated_register, (int32_t*)arg, sizeof(simulated_register))) {
+			if (copy_from_user(&value, uarg, sizeof(value))) {
 				return -EFAULT;
 			}
-			printk(KERN_INFO "Simulated register set to %x\n", simulated_register);
+			hw_reg_write32(&reg_bank, GD_REG_CTRL, value);
 			break;
 
 		case IOCTL_GET_REGISTER:
-			if (copy_to_user((int32_t*)arg, &simulated_register, sizeof(simulated_register))) {
+			value = hw_reg_read32(&reg_bank, GD_REG_CTRL);
+			if (copy_to_user(uarg, &value, sizeof(value))) {
 				return -EFAULT;
 			}
-			printk(KERN_INFO "%s: Simulated register read as %x\n",
-				DEVICE_NAME, simulated_register);
+			break;
+
+		case IOCTL_REG_INFO:
+			info.nr_regs = reg_bank.nr_regs;
+			info.map_size = reg_bank.size;
+			info.data_offset = GD_REG_DATA;
+			info.data_size = data_size;
+			if (copy_to_user(uarg, &info, sizeof(info)))
+				return -EFAULT;
+			break;
+
+		case IOCTL_REG_READ:
+		case IOCTL_REG_WRITE:
+			if (copy_from_user(&ra, uarg, sizeof(ra)))
+				return -EFAULT;
+			ret = reg_access(&ra, cmd == IOCTL_REG_WRITE);
+			if (ret)
+				return ret;
+			if (cmd == IOCTL_REG_READ && copy_to_user(uarg, &ra, sizeof(ra)))
+				return -EFAULT;
+			break;
+
+		case IOCTL_REG_SET_TYPE:
+			if (copy_from_user(&ra, uarg, sizeof(ra)))
+				return -EFAULT;
+			return hw_reg_set_type(&reg_bank, ra.offset, ra.value);
+
+		case IOCTL_REG_BATCH:
+			if (copy_from_user(&rbatch, uarg, sizeof(rbatch)))
+				return -EFAULT;
+			return reg_batch(&rbatch);
+
+		case IOCTL_REG_BENCH:
+			if (copy_from_user(&rbench, uarg, sizeof(rbench)))
+				return -EFAULT;
+			ret = reg_bench(&rbench);
+			if (ret)
+				return ret;
+			if (copy_to_user(uarg, &rbench, sizeof(rbench)))
+				return -EFAULT;
+			break;
+
+		case IOCTL_REG_BLOCK_READ:
+		case IOCTL_REG_BLOCK_WRITE:
+			if (copy_from_user(&rblock, uarg, sizeof(rblock)))
+				return -EFAULT;
+			return reg_block(&rblock, cmd == IOCTL_REG_BLOCK_WRITE);
+
+		case IOCTL_COPY_BENCH:
+			if (copy_from_user(&cbench, uarg, sizeof(cbench)))
+				return -EFAULT;
+			ret = copy_bench(&cbench);
+			if (ret)
+				return ret;
+			if (copy_to_user(uarg, &cbench, sizeof(cbench)))
+				return -EFAULT;
 			break;
 
 		default:
@@ -173,10 +714,40 @@ static long device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg
 	return 0;
 }
 
+static long device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+	long ret = __device_ioctl(filep, cmd, arg);
+
+	this_cpu_inc(gd_stats.ioctls);
+	if (ret < 0)
+		this_cpu_inc(gd_stats.errors);
+
+	trace_gd_ioctl(filep, cmd, ret);
+	return ret;
+}
+
+// Map the simulated register bank, like mapping a device BAR
+static int device_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+	return hw_reg_bank_mmap(&reg_bank, vma);
+}
+
+static __poll_t device_poll(struct file *filep, poll_table *wait)
+{
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filep, &data_wq, wait);
+	if (READ_ONCE(data_len))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	return mask;
+}
+
 // Release the device
 static int device_release(struct inode* inodep, struct file* filep)
 {
-	printk(KERN_INFO "%s: Device [%s] closed\n", DEVICE_NAME, DEVICE_NAME);
+	this_cpu_inc(gd_stats.releases);
+	trace_gd_release(filep);
 	return 0;
 }
 
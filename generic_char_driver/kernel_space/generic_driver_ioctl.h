@@ -0,0 +1,139 @@
+/*
+ * generic_driver_ioctl.h -- ioctl interface of the generic char driver
+ *
+ * Shared between the kernel module and the user-space programs, so
+ * only <linux/...> uapi types are used here.
+ */
+
+#ifndef _GENERIC_DRIVER_IOCTL_H_
+#define _GENERIC_DRIVER_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define DEVICE_PATH "/dev/generic_driver"
+
+// Legacy single register interface, maps onto GD_REG_CTRL
+#define IOCTL_SET_REGISTER _IOW('s', 1, int32_t*)
+#define IOCTL_GET_REGISTER _IOR('s', 2, int32_t*)
+
+/*
+ * Simulated register bank layout (byte offsets, 32-bit registers).
+ * The first registers have fixed semantics, the rest of the bank
+ * defaults to plain read/write registers.
+ */
+#define GD_REG_CTRL	0x00	// RW:  control register
+#define GD_REG_STATUS	0x04	// RO:  ready bit, number of registers
+#define GD_REG_ISR	0x08	// W1C: interrupt status, write 1 to clear
+#define GD_REG_ICR	0x0C	// RC:  interrupt cause, cleared on read
+#define GD_REG_SCRATCH	0x10	// RW:  scratch registers up to GD_REG_DATA
+#define GD_REG_DATA	0x40	// data window up to the end of the bank,
+				// backs read()/write() of the device
+
+#define GD_REG_MIN_REGS	(GD_REG_DATA / 4 + 16)
+
+#define GD_STATUS_READY		0x00000001
+#define GD_STATUS_NR_REGS_SHIFT	16
+
+// Register types, see enum hw_reg_type in hw_access.h
+#define GD_REG_TYPE_RW	0
+#define GD_REG_TYPE_RO	1
+#define GD_REG_TYPE_W1C	2
+#define GD_REG_TYPE_RC	3
+
+struct gd_reg_info {
+	__u32 nr_regs;		// number of 32-bit registers
+	__u32 map_size;		// bytes to mmap() the whole bank
+	__u32 data_offset;	// GD_REG_DATA
+	__u32 data_size;	// bytes in the data window
+};
+
+// Access flags
+#define GD_REG_F_RELAXED 0x1	// no readl()/writel() style barrier
+#define GD_REG_F_RAW	 0x2	// device side access, bypasses RO/W1C/RC
+
+struct gd_reg_access {
+	__u32 offset;		// byte offset, 4-byte aligned
+	__u32 value;		// value to write / value read / register type
+	__u32 flags;		// GD_REG_F_*
+	__u32 pad;
+};
+
+#define GD_REG_OP_READ	0
+#define GD_REG_OP_WRITE	1
+
+struct gd_reg_op {
+	__u32 offset;
+	__u32 value;
+	__u32 op;		// GD_REG_OP_*
+	__u32 pad;
+};
+
+// Up to GD_REG_BATCH_MAX relaxed accesses, one barrier at the end
+#define GD_REG_BATCH_MAX 4096
+
+struct gd_reg_batch {
+	__u64 ops;		// user pointer to struct gd_reg_op[count]
+	__u32 count;
+	__u32 flags;		// none yet, must be 0
+};
+
+// In-kernel register access loop over the scratch registers, to
+// measure without syscall overhead
+#define GD_BENCH_READ		0	// hw_reg_read32() per access
+#define GD_BENCH_READ_RELAXED	1	// hw_reg_read32_relaxed() per access
+#define GD_BENCH_WRITE		2	// hw_reg_write32() per access
+#define GD_BENCH_WRITE_RELAXED	3	// hw_reg_write32_relaxed() per access
+#define GD_BENCH_WRITE_BATCHED	4	// relaxed writes, barrier per batch
+#define GD_BENCH_MAX		5
+
+#define GD_BENCH_MAX_ITERATIONS	(1U << 24)
+
+struct gd_reg_bench {
+	__u32 mode;		// GD_BENCH_*
+	__u32 iterations;
+	__u32 batch;		// accesses per barrier for GD_BENCH_WRITE_BATCHED
+	__u32 pad;
+	__u64 elapsed_ns;	// out
+};
+
+// Raw block copy between a user buffer and the bank
+struct gd_reg_block {
+	__u64 buf;		// user pointer
+	__u32 offset;		// byte offset, aligned to width
+	__u32 count;		// elements
+	__u32 width;		// element size: 1, 2, 4 or 8 bytes
+	__u32 pad;
+};
+
+// In-kernel copy loop between memory and the data window
+#define GD_COPY_8	0	// hw_copy8()
+#define GD_COPY_16	1	// hw_copy16()
+#define GD_COPY_32	2	// hw_copy32()
+#define GD_COPY_64	3	// hw_copy64()
+#define GD_COPY_IO	4	// hw_copy_fromio()/hw_copy_toio()
+#define GD_COPY_MEMCPY	5	// plain memcpy(), reference
+#define GD_COPY_MAX	6
+
+#define GD_COPY_TO_DEV	0
+#define GD_COPY_FROM_DEV 1
+
+struct gd_copy_bench {
+	__u32 mode;		// GD_COPY_*
+	__u32 dir;		// GD_COPY_TO_DEV / GD_COPY_FROM_DEV
+	__u32 bytes;		// per copy, multiple of 8, <= data_size
+	__u32 iterations;
+	__u64 elapsed_ns;	// out
+};
+
+#define IOCTL_REG_INFO		_IOR('s', 3, struct gd_reg_info)
+#define IOCTL_REG_READ		_IOWR('s', 4, struct gd_reg_access)
+#define IOCTL_REG_WRITE		_IOW('s', 5, struct gd_reg_access)
+#define IOCTL_REG_SET_TYPE	_IOW('s', 6, struct gd_reg_access)
+#define IOCTL_REG_BATCH		_IOW('s', 7, struct gd_reg_batch)
+#define IOCTL_REG_BENCH		_IOWR('s', 8, struct gd_reg_bench)
+#define IOCTL_REG_BLOCK_READ	_IOW('s', 9, struct gd_reg_block)
+#define IOCTL_REG_BLOCK_WRITE	_IOW('s', 10, struct gd_reg_block)
+#define IOCTL_COPY_BENCH	_IOWR('s', 11, struct gd_copy_bench)
+
+#endif // _GENERIC_DRIVER_IOCTL_H_
@@ -0,0 +1,110 @@
+/*
+ * generic_driver_trace.h -- static tracepoints of the generic char driver
+ *
+ * The file operations used to printk() on every call. These events
+ * cost a patched-out branch while disabled, enable them with:
+ *
+ *	echo 1 > /sys/kernel/tracing/events/generic_driver/enable
+ *	cat /sys/kernel/tracing/trace_pipe
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM generic_driver
+
+#if !defined(_GENERIC_DRIVER_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _GENERIC_DRIVER_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+
+DECLARE_EVENT_CLASS(gd_file,
+
+	TP_PROTO(const struct file *filep),
+
+	TP_ARGS(filep),
+
+	TP_STRUCT__entry(
+		__field(const void *,	filep)
+		__field(unsigned int,	f_flags)
+	),
+
+	TP_fast_assign(
+		__entry->filep = filep;
+		__entry->f_flags = filep->f_flags;
+	),
+
+	TP_printk("file=%p flags=0x%x", __entry->filep, __entry->f_flags)
+);
+
+DEFINE_EVENT(gd_file, gd_open,
+	TP_PROTO(const struct file *filep),
+	TP_ARGS(filep)
+);
+
+DEFINE_EVENT(gd_file, gd_release,
+	TP_PROTO(const struct file *filep),
+	TP_ARGS(filep)
+);
+
+DECLARE_EVENT_CLASS(gd_rw,
+
+	TP_PROTO(const struct file *filep, size_t len, ssize_t ret),
+
+	TP_ARGS(filep, len, ret),
+
+	TP_STRUCT__entry(
+		__field(const void *,	filep)
+		__field(size_t,		len)
+		__field(ssize_t,	ret)
+	),
+
+	TP_fast_assign(
+		__entry->filep = filep;
+		__entry->len = len;
+		__entry->ret = ret;
+	),
+
+	TP_printk("file=%p len=%zu ret=%zd",
+		__entry->filep, __entry->len, __entry->ret)
+);
+
+DEFINE_EVENT(gd_rw, gd_read,
+	TP_PROTO(const struct file *filep, size_t len, ssize_t ret),
+	TP_ARGS(filep, len, ret)
+);
+
+DEFINE_EVENT(gd_rw, gd_write,
+	TP_PROTO(const struct file *filep, size_t len, ssize_t ret),
+	TP_ARGS(filep, len, ret)
+);
+
+TRACE_EVENT(gd_ioctl,
+
+	TP_PROTO(const struct file *filep, unsigned int cmd, long ret),
+
+	TP_ARGS(filep, cmd, ret),
+
+	TP_STRUCT__entry(
+		__field(const void *,	filep)
+		__field(unsigned int,	cmd)
+		__field(long,		ret)
+	),
+
+	TP_fast_assign(
+		__entry->filep = filep;
+		__entry->cmd = cmd;
+		__entry->ret = ret;
+	),
+
+	TP_printk("file=%p cmd=0x%x nr=%u ret=%ld", __entry->filep,
+		__entry->cmd, _IOC_NR(__entry->cmd), __entry->ret)
+);
+
+#endif // _GENERIC_DRIVER_TRACE_H_
+
+// Must be outside the include guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE generic_driver_trace
+#include <trace/define_trace.h>
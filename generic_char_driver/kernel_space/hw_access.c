@@ -14,6 +14,14 @@
 #include <linux/fcntl.h>
 #include <linux/poll.h>
 #include <linux/cdev.h>
+#include <linux/vmalloc.h>	/* vmalloc_user(), remap_vmalloc_range() */
+#include <linux/mm.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>	/* get_unaligned(), put_unaligned() */
+#else
+#include <asm/unaligned.h>
+#endif
 #include <asm/uaccess.h>
 
 #include "hw_access.h"		/* local definitions */
@@ -51,16 +59,137 @@ void write32 ( void *address, unsigned data )
 	// printk( "Kernel mode write32: Address [%p], Data %8x\n", address, data );
 }
 
-// For now the decision is made to make this copying straight in the main code
-#if 0
-unsigned copy16bit_block ( short *da, const short *sa, unsigned n )
+/*
+ * Fixed width element copies, see hw_access.h. The volatile accesses
+ * keep the compiler from merging or widening them.
+ */
+#define DEFINE_HW_COPY(bits)						\
+unsigned hw_copy##bits(u##bits *dst, const u##bits *src, unsigned n)	\
+{									\
+	unsigned i;							\
+									\
+	for (i = 0; i < n; i++)						\
+		WRITE_ONCE(dst[i], READ_ONCE(src[i]));			\
+									\
+	return i;							\
+}									\
+EXPORT_SYMBOL_GPL(hw_copy##bits)
+
+DEFINE_HW_COPY(8);
+DEFINE_HW_COPY(16);
+DEFINE_HW_COPY(32);
+DEFINE_HW_COPY(64);
+
+void hw_copy_fromio(void *to, const void *from, size_t n)
 {
-	unsigned	i;
+	// Byte reads until the device side is word aligned
+	while (n && !IS_ALIGNED((unsigned long)from, sizeof(long))) {
+		*(u8 *)to++ = READ_ONCE(*(const u8 *)from);
+		from++;
+		n--;
+	}
 
-	for ( i=0; i<n; i++ ) da[i] = sa[i];
+	while (n >= sizeof(long)) {
+		put_unaligned(READ_ONCE(*(const unsigned long *)from),
+			      (unsigned long *)to);
+		to += sizeof(long);
+		from += sizeof(long);
+		n -= sizeof(long);
+	}
 
-	return i;
+	while (n) {
+		*(u8 *)to++ = READ_ONCE(*(const u8 *)from);
+		from++;
+		n--;
+	}
+
+	rmb();
 }
-#endif
+EXPORT_SYMBOL_GPL(hw_copy_fromio);
+
+void hw_copy_toio(void *to, const void *from, size_t n)
+{
+	wmb();
+
+	// Byte writes until the device side is word aligned
+	while (n && !IS_ALIGNED((unsigned long)to, sizeof(long))) {
+		WRITE_ONCE(*(u8 *)to, *(const u8 *)from++);
+		to++;
+		n--;
+	}
+
+	while (n >= sizeof(long)) {
+		WRITE_ONCE(*(unsigned long *)to,
+			   get_unaligned((const unsigned long *)from));
+		to += sizeof(long);
+		from += sizeof(long);
+		n -= sizeof(long);
+	}
+
+	while (n) {
+		WRITE_ONCE(*(u8 *)to, *(const u8 *)from++);
+		to++;
+		n--;
+	}
+}
+EXPORT_SYMBOL_GPL(hw_copy_toio);
+
+/*
+ * Simulated register bank, see hw_access.h for the register semantics.
+ * The fast path accessors are inline in hw_access.h, only the setup
+ * lives here.
+ */
+int hw_reg_bank_alloc(struct hw_reg_bank *bank, unsigned int nr_regs)
+{
+	if (!nr_regs || nr_regs > (INT_MAX >> 2))
+		return -EINVAL;
+
+	bank->size = PAGE_ALIGN((size_t)nr_regs << 2);
+	bank->regs = vmalloc_user(bank->size);
+	if (!bank->regs)
+		return -ENOMEM;
+
+	// Registers the mmap() exposes beyond nr_regs are never decoded
+	bank->type = kcalloc(nr_regs, sizeof(*bank->type), GFP_KERNEL);
+	if (!bank->type) {
+		vfree(bank->regs);
+		bank->regs = NULL;
+		return -ENOMEM;
+	}
+
+	bank->nr_regs = nr_regs;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(hw_reg_bank_alloc);
+
+void hw_reg_bank_free(struct hw_reg_bank *bank)
+{
+	kfree(bank->type);
+	vfree(bank->regs);
+	bank->type = NULL;
+	bank->regs = NULL;
+	bank->nr_regs = 0;
+}
+EXPORT_SYMBOL_GPL(hw_reg_bank_free);
+
+int hw_reg_set_type(struct hw_reg_bank *bank, unsigned int offset,
+		    enum hw_reg_type type)
+{
+	if (!hw_reg_valid(bank, offset) || type >= HW_REG_TYPE_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(bank->type[offset >> 2], type);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(hw_reg_set_type);
+
+int hw_reg_bank_mmap(struct hw_reg_bank *bank, struct vm_area_struct *vma)
+{
+	return remap_vmalloc_range(vma, bank->regs, vma->vm_pgoff);
+}
+EXPORT_SYMBOL_GPL(hw_reg_bank_mmap);
 
 MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Hardware register access helpers and simulated register bank");
@@ -5,12 +5,159 @@
 #ifndef _HW_ACCESS_H_
 #define _HW_ACCESS_H_
 
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <linux/atomic.h>
+#include <asm/barrier.h>
+
+struct vm_area_struct;
+
 unsigned char read8 ( void *address );
 unsigned short read16 ( void *address );
 unsigned read32 ( void *address );
 void write8 ( void *address, unsigned char data );
 void write16 ( void *address, unsigned short data );
 void write32 ( void *address, unsigned data );
-// unsigned copy16bit_block ( short *da, const short *sa, unsigned n );
+
+/*
+ * Bulk transfers. hw_copyN() copy n elements with accesses of exactly
+ * N bits each, for registers and FIFOs which must not be accessed
+ * with a different width; both pointers are naturally aligned. They
+ * return the number of elements copied.
+ *
+ * hw_copy_fromio()/hw_copy_toio() are the memcpy_fromio()/memcpy_toio()
+ * counterparts for byte streams: the device side is aligned with byte
+ * accesses first, then moved a machine word at a time, the memory side
+ * may be unaligned. Like readl()/writel() they are ordered against
+ * normal memory accesses (barrier after the read, before the write).
+ */
+unsigned hw_copy8(u8 *dst, const u8 *src, unsigned n);
+unsigned hw_copy16(u16 *dst, const u16 *src, unsigned n);
+unsigned hw_copy32(u32 *dst, const u32 *src, unsigned n);
+unsigned hw_copy64(u64 *dst, const u64 *src, unsigned n);
+void hw_copy_fromio(void *to, const void *from, size_t n);
+void hw_copy_toio(void *to, const void *from, size_t n);
+
+/*
+ * Simulated register bank -- an array of 32-bit registers which
+ * behaves like the MMIO window of a device:
+ *
+ *	HW_REG_RW:	plain read/write register
+ *	HW_REG_RO:	writes are ignored
+ *	HW_REG_W1C:	writing 1 to a bit clears it (status registers)
+ *	HW_REG_RC:	a read returns the value and clears it (cause
+ *			registers, read side effect)
+ *
+ * hw_reg_read32()/hw_reg_write32() follow the readl()/writel()
+ * ordering rules: the write is ordered after all prior memory
+ * writes, the read is ordered before all following memory reads.
+ * The _relaxed variants drop the barrier, like readl_relaxed() and
+ * writel_relaxed(), so bulk accesses pay for one hw_reg_barrier().
+ *
+ * The registers live in vmalloc_user() memory, so the bank can be
+ * mmap()ed to user space. Such a mapping is a raw view: user space
+ * stores bypass the RO/W1C/RC semantics.
+ */
+enum hw_reg_type {
+	HW_REG_RW = 0,
+	HW_REG_RO,
+	HW_REG_W1C,
+	HW_REG_RC,
+	HW_REG_TYPE_MAX,
+};
+
+struct hw_reg_bank {
+	u32		*regs;		// page aligned, mmap-able
+	u8		*type;		// enum hw_reg_type per register
+	unsigned int	nr_regs;
+	size_t		size;		// bytes, rounded up to PAGE_SIZE
+};
+
+int hw_reg_bank_alloc(struct hw_reg_bank *bank, unsigned int nr_regs);
+void hw_reg_bank_free(struct hw_reg_bank *bank);
+int hw_reg_set_type(struct hw_reg_bank *bank, unsigned int offset,
+		    enum hw_reg_type type);
+int hw_reg_bank_mmap(struct hw_reg_bank *bank, struct vm_area_struct *vma);
+
+static inline bool hw_reg_valid(struct hw_reg_bank *bank, unsigned int offset)
+{
+	return !(offset & 3) && (offset >> 2) < bank->nr_regs;
+}
+
+// Register semantics, no ordering
+static inline u32 __hw_reg_load(struct hw_reg_bank *bank, unsigned int offset)
+{
+	unsigned int idx = offset >> 2;
+
+	if (bank->type[idx] == HW_REG_RC)
+		return xchg_relaxed(&bank->regs[idx], 0);
+
+	return READ_ONCE(bank->regs[idx]);
+}
+
+static inline void __hw_reg_store(struct hw_reg_bank *bank, unsigned int offset,
+				  u32 val)
+{
+	unsigned int idx = offset >> 2;
+	u32 old;
+
+	switch (bank->type[idx]) {
+	case HW_REG_RO:
+		break;
+	case HW_REG_W1C:
+		old = READ_ONCE(bank->regs[idx]);
+		while (!try_cmpxchg_relaxed(&bank->regs[idx], &old, old & ~val))
+			;
+		break;
+	default:
+		WRITE_ONCE(bank->regs[idx], val);
+		break;
+	}
+}
+
+static inline u32 hw_reg_read32_relaxed(struct hw_reg_bank *bank,
+					unsigned int offset)
+{
+	return __hw_reg_load(bank, offset);
+}
+
+static inline u32 hw_reg_read32(struct hw_reg_bank *bank, unsigned int offset)
+{
+	u32 val = __hw_reg_load(bank, offset);
+
+	rmb();
+	return val;
+}
+
+static inline void hw_reg_write32_relaxed(struct hw_reg_bank *bank,
+					  unsigned int offset, u32 val)
+{
+	__hw_reg_store(bank, offset, val);
+}
+
+static inline void hw_reg_write32(struct hw_reg_bank *bank, unsigned int offset,
+				  u32 val)
+{
+	wmb();
+	__hw_reg_store(bank, offset, val);
+}
+
+// Orders a run of relaxed accesses against everything else
+static inline void hw_reg_barrier(void)
+{
+	mb();
+}
+
+// Device side view: the "hardware" updating its own registers
+static inline u32 hw_reg_raw_read32(struct hw_reg_bank *bank, unsigned int offset)
+{
+	return READ_ONCE(bank->regs[offset >> 2]);
+}
+
+static inline void hw_reg_raw_write32(struct hw_reg_bank *bank,
+				      unsigned int offset, u32 val)
+{
+	WRITE_ONCE(bank->regs[offset >> 2], val);
+}
 
 #endif // _HW_ACCESS_H_
@@ -0,0 +1,130 @@
+/* copy_bench.c
+ *
+ * Compares the bulk transfer helpers of hw_access.c, copying between
+ * kernel memory and the data window of the simulated register bank
+ * (IOCTL_COPY_BENCH), for every element width and transfer size:
+ *
+ *	8/16/32/64:	fixed width element copies (hw_copyN)
+ *	io:		word-at-a-time hw_copy_fromio/hw_copy_toio
+ *	memcpy:		plain memcpy() as the upper bound
+ *
+ * Also times the same sizes through write()/read() of the device.
+ *
+ * Usage: copy_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>	// open
+#include <unistd.h>	// read, write, close
+#include <errno.h>	// error handling
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "../kernel_space/generic_driver_ioctl.h"
+
+static const char *mode_name[GD_COPY_MAX] = {
+	[GD_COPY_8]	 = "8",
+	[GD_COPY_16]	 = "16",
+	[GD_COPY_32]	 = "32",
+	[GD_COPY_64]	 = "64",
+	[GD_COPY_IO]	 = "io",
+	[GD_COPY_MEMCPY] = "memcpy",
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double mb_per_s(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1e3 / (double)ns : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+	struct gd_reg_info info;
+	struct gd_copy_bench cb;
+	uint64_t start;
+	uint32_t bytes, mode, dir, i;
+	char *buf;
+	int fd;
+
+	if (!iterations || iterations > GD_BENCH_MAX_ITERATIONS) {
+		fprintf(stderr, "iterations 1..%u\n", GD_BENCH_MAX_ITERATIONS);
+		return EXIT_FAILURE;
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("Failed to open the device");
+		return errno;
+	}
+
+	if (ioctl(fd, IOCTL_REG_INFO, &info) < 0) {
+		perror("IOCTL_REG_INFO");
+		close(fd);
+		return errno;
+	}
+
+	buf = malloc(info.data_size);
+	if (!buf) {
+		perror("malloc");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	memset(buf, 0x5a, info.data_size);
+
+	printf("%-8s %-8s %8s %12s\n", "dir", "width", "bytes", "MB/s");
+	for (dir = GD_COPY_TO_DEV; dir <= GD_COPY_FROM_DEV; dir++) {
+		for (bytes = 64; bytes <= info.data_size; bytes *= 4) {
+			for (mode = 0; mode < GD_COPY_MAX; mode++) {
+				memset(&cb, 0, sizeof(cb));
+				cb.mode = mode;
+				cb.dir = dir;
+				cb.bytes = bytes;
+				cb.iterations = iterations;
+				if (ioctl(fd, IOCTL_COPY_BENCH, &cb) < 0) {
+					perror("IOCTL_COPY_BENCH");
+					continue;
+				}
+				printf("%-8s %-8s %8u %12.1f\n",
+					dir == GD_COPY_TO_DEV ? "to" : "from",
+					mode_name[mode], bytes,
+					mb_per_s((uint64_t)bytes * iterations,
+						 cb.elapsed_ns));
+			}
+		}
+	}
+
+	// End to end through the file operations, syscall included
+	printf("\n%-8s %8s %12s\n", "syscall", "bytes", "MB/s");
+	for (bytes = 64; bytes <= info.data_size; bytes *= 4) {
+		start = now_ns();
+		for (i = 0; i < iterations; i++)
+			if (write(fd, buf, bytes) < 0)
+				break;
+		printf("%-8s %8u %12.1f\n", "write", bytes,
+			mb_per_s((uint64_t)bytes * i, now_ns() - start));
+
+		start = now_ns();
+		for (i = 0; i < iterations; i++) {
+			if (write(fd, buf, bytes) < 0 || read(fd, buf, bytes) < 0)
+				break;
+		}
+		printf("%-8s %8u %12.1f\n", "wr+rd", bytes,
+			mb_per_s((uint64_t)bytes * i, now_ns() - start));
+	}
+
+	free(buf);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/* regbank_bench.c
+ *
+ * Measures the cost of accessing the simulated register bank of the
+ * generic driver, without any real hardware:
+ *
+ * In-kernel loops (IOCTL_REG_BENCH):
+ *	barriered vs relaxed reads and writes, and relaxed writes
+ *	with one barrier per batch
+ *
+ * From user-space:
+ *	one ioctl per register access vs one IOCTL_REG_BATCH per
+ *	batch of accesses vs plain loads/stores through mmap()
+ *
+ * Usage: regbank_bench [iterations] [batch]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>	// open
+#include <unistd.h>	// close
+#include <errno.h>	// error handling
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "../kernel_space/generic_driver_ioctl.h"
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t ns, uint32_t ops)
+{
+	printf("%-28s %10u ops %12.2f ns/op %10.2f Mops/s\n", name, ops,
+		(double)ns / ops, ops * 1e3 / (double)ns);
+}
+
+static int kernel_bench(int fd, uint32_t mode, const char *name,
+			uint32_t iterations, uint32_t batch)
+{
+	struct gd_reg_bench rb = {
+		.mode = mode,
+		.iterations = iterations,
+		.batch = batch,
+	};
+
+	if (ioctl(fd, IOCTL_REG_BENCH, &rb) < 0) {
+		perror(name);
+		return -1;
+	}
+	report(name, rb.elapsed_ns, iterations);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	uint32_t batch = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+	struct gd_reg_info info;
+	struct gd_reg_access ra;
+	struct gd_reg_batch rbatch;
+	struct gd_reg_op *ops;
+	volatile uint32_t *regs;
+	uint64_t start;
+	uint32_t i, n, sink = 0;
+	int fd;
+
+	if (!iterations || iterations > GD_BENCH_MAX_ITERATIONS ||
+	    !batch || batch > GD_REG_BATCH_MAX) {
+		fprintf(stderr, "iterations 1..%u, batch 1..%u\n",
+			GD_BENCH_MAX_ITERATIONS, GD_REG_BATCH_MAX);
+		return EXIT_FAILURE;
+	}
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("Failed to open the device");
+		return errno;
+	}
+
+	if (ioctl(fd, IOCTL_REG_INFO, &info) < 0) {
+		perror("IOCTL_REG_INFO");
+		close(fd);
+		return errno;
+	}
+	printf("%u registers, %u bytes mappable\n\n", info.nr_regs, info.map_size);
+
+	// Scratch registers only, like the in-kernel loop
+	n = (GD_REG_DATA - GD_REG_SCRATCH) / 4;
+
+	printf("In-kernel:\n");
+	kernel_bench(fd, GD_BENCH_READ, "read32", iterations, 0);
+	kernel_bench(fd, GD_BENCH_READ_RELAXED, "read32_relaxed", iterations, 0);
+	kernel_bench(fd, GD_BENCH_WRITE, "write32", iterations, 0);
+	kernel_bench(fd, GD_BENCH_WRITE_RELAXED, "write32_relaxed", iterations, 0);
+	kernel_bench(fd, GD_BENCH_WRITE_BATCHED, "write32_batched", iterations, batch);
+
+	printf("\nUser-space:\n");
+	memset(&ra, 0, sizeof(ra));
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		ra.offset = GD_REG_SCRATCH + (i % n) * 4;
+		ra.value = i;
+		ioctl(fd, IOCTL_REG_WRITE, &ra);
+	}
+	report("ioctl per write", now_ns() - start, iterations);
+
+	ops = calloc(batch, sizeof(*ops));
+	if (!ops) {
+		perror("calloc");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	rbatch.ops = (uintptr_t)ops;
+	rbatch.count = batch;
+	rbatch.flags = 0;
+	start = now_ns();
+	for (i = 0; i < iterations; i += batch) {
+		for (uint32_t j = 0; j < batch; j++) {
+			ops[j].offset = GD_REG_SCRATCH + ((i + j) % n) * 4;
+			ops[j].value = i + j;
+			ops[j].op = GD_REG_OP_WRITE;
+		}
+		ioctl(fd, IOCTL_REG_BATCH, &rbatch);
+	}
+	report("ioctl per batch", now_ns() - start, iterations);
+	free(ops);
+
+	regs = mmap(NULL, info.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (regs == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return errno;
+	}
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		regs[4 + i % n] = i;
+	report("mmap store", now_ns() - start, iterations);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		sink += regs[4 + i % n];
+	report("mmap load", now_ns() - start, iterations);
+
+	munmap((void *)regs, info.map_size);
+	close(fd);
+
+	return sink == 0xdeadbeef;
+}
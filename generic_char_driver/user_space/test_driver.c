@@ -1,86 +1,579 @@
-/* How the User-Space Program Works:
+/* test_driver.c
  *
- * Opening the device:
- *	The program attempts to open the device file
- *	(/dev/generic_device) with read/write access (O_RDWR). If
- *	the device cannot be opened, it prints an error and exits
+ * Non-interactive stress and latency benchmark of the generic driver.
  *
- * Writing to the device:
- *	The program prompts the user to enter a message, which is
- *	written to the device using the write() system call
+ * Throughput phase:
+ *	N writer and M reader threads, each with its own file
+ *	descriptor and pinned to a CPU, move messages of a given
+ *	size for a given time. The I/O mode is one of:
  *
- * Reading from the device:
- *	The program attempts to read the data from the device
- *	using the read() system call. If successful, it prints
- *	the message received from the driver
+ *	block:	blocking read()/write()
+ *	epoll:	O_NONBLOCK descriptors, epoll_wait() on EAGAIN
+ *	uring:	io_uring IORING_OP_READ/IORING_OP_WRITE
  *
- * Closing the device:
- *	The program closes the device file after the operations
- *	are completed
+ * Round-trip phase:
+ *	one thread writes a message and reads it back
+ *
+ * ioctl phase:
+ *	the writer threads issue IOCTL_REG_READ on scratch
+ *	registers
+ *
+ * Every phase reports msgs/sec, MB/s and latency percentiles as CSV
+ * (default) or JSON on stdout, so runs can be compared by scripts.
+ *
+ * Usage: test_driver [-w writers] [-r readers] [-s msg_size]
+ *		[-d seconds] [-m block|epoll|uring] [-c first_cpu]
+ *		[-n rtt_samples] [-f csv|json]
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <fcntl.h>	// open
 #include <unistd.h>	// read, write, close
 #include <errno.h>	// error handling
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
-#define DEVICE_PATH "/dev/generic_driver"
+#include "../kernel_space/generic_driver_ioctl.h"
 
-#define IOCTL_SET_REGISTER _IOW('s', 1, int32_t*)
-#define IOCTL_GET_REGISTER _IOR('s', 2, int32_t*)
+// Latency samples kept per thread, later ones are not recorded
+#define MAX_SAMPLES	(1 << 20)
+#define URING_ENTRIES	8
 
-int main()
-{
+enum io_mode { MODE_BLOCK, MODE_EPOLL, MODE_URING };
+enum role { ROLE_WRITER, ROLE_READER, ROLE_IOCTL };
+
+static const char *mode_name[] = { "block", "epoll", "uring" };
+static const char *role_name[] = { "write", "read", "ioctl" };
+
+// Minimal io_uring, one request in flight per thread
+struct uring {
 	int fd;
-	char write_buffer[256];
-	char read_buffer[256];
-	int ret;
-	int read_ioctl_value =0;
-	int write_ioctl_value = 0x2442;
-
-	// Open the device
-	fd = open(DEVICE_PATH, O_RDWR); // Open the device for read/write
-	if (fd < 0) {
-		perror("Failed to open the device");
-		return errno;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+struct thread_ctx {
+	pthread_t tid;
+	enum role role;
+	int id;
+	int cpu;
+	int fd;
+	int epfd;
+	struct uring ring;
+	char *buf;
+	uint64_t ops;		// messages or ioctls
+	uint64_t bytes;
+	uint64_t empty;		// reads that found no message
+	uint64_t errors;
+	uint64_t *lat;
+	size_t nr_lat;
+};
+
+struct result {
+	const char *phase;
+	int threads;
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t errors;
+	double seconds;
+	uint64_t p50, p90, p99, p999, max;
+};
+
+static struct {
+	int writers;
+	int readers;
+	size_t msg_size;
+	int seconds;
+	enum io_mode mode;
+	int first_cpu;
+	int rtt_samples;
+	int json;
+} cfg = {
+	.writers = 1,
+	.readers = 1,
+	.msg_size = 64,
+	.seconds = 5,
+	.mode = MODE_BLOCK,
+	.first_cpu = 0,
+	.rtt_samples = 100000,
+};
+
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+static int nr_results;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int uring_init(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = 0;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto err;
+
+	if (r->cq_len) {
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			goto err_sq;
+	} else {
+		r->cq_ptr = r->sq_ptr;
 	}
 
-	ioctl(fd, IOCTL_SET_REGISTER, &write_ioctl_value);
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto err_cq;
 
-	ioctl(fd, IOCTL_GET_REGISTER, &read_ioctl_value);
-	printf("Read IOCTL value: %x\n", read_ioctl_value);
+	r->sq_tail = r->sq_ptr + p.sq_off.tail;
+	r->sq_mask = r->sq_ptr + p.sq_off.ring_mask;
+	r->sq_array = r->sq_ptr + p.sq_off.array;
+	r->cq_head = r->cq_ptr + p.cq_off.head;
+	r->cq_tail = r->cq_ptr + p.cq_off.tail;
+	r->cq_mask = r->cq_ptr + p.cq_off.ring_mask;
+	r->cqes = r->cq_ptr + p.cq_off.cqes;
 
-	// Prepare data to write to the device
-	printf("Enter a message to send to the device: ");
-	fgets(write_buffer, sizeof(write_buffer), stdin);
-	write_buffer[strcspn(write_buffer, "\n")] = 0; // Remove trailing newline
+	return 0;
 
-	// Write to the device
-	printf("Writing message to the device [%s]\n", write_buffer);
-	ret = write(fd, write_buffer, strlen(write_buffer));
-	if (ret < 0) {
-		perror("Failed to write the message to the device");
-		return errno;
+err_cq:
+	if (r->cq_len)
+		munmap(r->cq_ptr, r->cq_len);
+err_sq:
+	munmap(r->sq_ptr, r->sq_len);
+err:
+	close(r->fd);
+	r->sq_ptr = NULL;
+	return -1;
+}
+
+static void uring_exit(struct uring *r)
+{
+	munmap(r->sqes, r->sqes_len);
+	if (r->cq_len)
+		munmap(r->cq_ptr, r->cq_len);
+	munmap(r->sq_ptr, r->sq_len);
+	close(r->fd);
+}
+
+// Submit one read/write and wait for its completion
+static ssize_t uring_rw(struct uring *r, int opcode, int fd, void *buf, size_t len)
+{
+	unsigned tail = *r->sq_tail;
+	unsigned idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	unsigned head;
+	int res;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = -1;		// stream, no file position
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (syscall(__NR_io_uring_enter, r->fd, 1, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+		return -1;
+
+	head = *r->cq_head;
+	while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		;
+	res = r->cqes[head & *r->cq_mask].res;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	if (res < 0) {
+		errno = -res;
+		return -1;
 	}
+	return res;
+}
 
-	// Read from the device
-	printf("Reading from the device...\n");
-	ret = read(fd, read_buffer, sizeof(read_buffer));
-	if (ret < 0) {
-		perror("Failed to read the message from the device");
-		return errno;
+static ssize_t do_io(struct thread_ctx *t, int write_op)
+{
+	struct epoll_event ev;
+	ssize_t ret;
+
+	switch (cfg.mode) {
+	case MODE_URING:
+		return uring_rw(&t->ring, write_op ? IORING_OP_WRITE : IORING_OP_READ,
+				t->fd, t->buf, cfg.msg_size);
+	case MODE_EPOLL:
+		for (;;) {
+			ret = write_op ? write(t->fd, t->buf, cfg.msg_size) :
+					 read(t->fd, t->buf, cfg.msg_size);
+			if (ret >= 0 || errno != EAGAIN || stop)
+				return ret;
+			epoll_wait(t->epfd, &ev, 1, 100);
+		}
+	default:
+		return write_op ? write(t->fd, t->buf, cfg.msg_size) :
+				  read(t->fd, t->buf, cfg.msg_size);
+	}
+}
+
+static int thread_setup(struct thread_ctx *t)
+{
+	struct epoll_event ev;
+	cpu_set_t set;
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu % nr_cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	t->fd = open(DEVICE_PATH, O_RDWR | (cfg.mode == MODE_EPOLL ? O_NONBLOCK : 0));
+	if (t->fd < 0)
+		return -1;
+
+	if (cfg.mode == MODE_EPOLL) {
+		t->epfd = epoll_create1(0);
+		ev.events = t->role == ROLE_READER ? EPOLLIN : EPOLLOUT;
+		ev.data.fd = t->fd;
+		if (t->epfd < 0 || epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->fd, &ev) < 0)
+			return -1;
+	}
+
+	if (cfg.mode == MODE_URING && uring_init(&t->ring, URING_ENTRIES) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void thread_cleanup(struct thread_ctx *t)
+{
+	if (cfg.mode == MODE_URING && t->ring.sq_ptr)
+		uring_exit(&t->ring);
+	if (cfg.mode == MODE_EPOLL && t->epfd >= 0)
+		close(t->epfd);
+	if (t->fd >= 0)
+		close(t->fd);
+}
+
+static void *worker(void *arg)
+{
+	struct thread_ctx *t = arg;
+	struct gd_reg_access ra;
+	uint64_t start;
+	ssize_t ret;
+	int setup;
+
+	setup = thread_setup(t);
+	if (setup < 0)
+		perror("thread setup");
+	pthread_barrier_wait(&start_barrier);
+	if (setup < 0)
+		goto out;
+
+	memset(&ra, 0, sizeof(ra));
+	ra.offset = GD_REG_DATA - 4 * (1 + t->id % ((GD_REG_DATA - 0x10) / 4));
+
+	while (!stop) {
+		start = now_ns();
+		switch (t->role) {
+		case ROLE_IOCTL:
+			ret = ioctl(t->fd, IOCTL_REG_READ, &ra);
+			break;
+		case ROLE_WRITER:
+			ret = do_io(t, 1);
+			break;
+		default:
+			ret = do_io(t, 0);
+			break;
+		}
+
+		if (ret < 0) {
+			if (errno != EAGAIN)
+				t->errors++;
+			continue;
+		}
+		if (t->role == ROLE_READER && ret == 0) {
+			t->empty++;
+			continue;
+		}
+		if (t->nr_lat < MAX_SAMPLES)
+			t->lat[t->nr_lat++] = now_ns() - start;
+		t->ops++;
+		t->bytes += t->role == ROLE_IOCTL ? 0 : ret;
 	}
+out:
+	thread_cleanup(t);
+	return NULL;
+}
 
-	// printf("read_buffer is of a %d length\n", sizeof(read_buffer));
-	read_buffer[sizeof(read_buffer)] = '\0'; // Null-terminate the read buffer
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
 
-	printf("The received message is: [%s]\n", read_buffer);
+	return x < y ? -1 : x > y;
+}
+
+static void percentiles(struct result *r, uint64_t *lat, size_t n)
+{
+	if (!n)
+		return;
+
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+	r->p50 = lat[n * 50 / 100];
+	r->p90 = lat[n * 90 / 100];
+	r->p99 = lat[n * 99 / 100];
+	r->p999 = lat[n * 999 / 1000];
+	r->max = lat[n - 1];
+}
+
+static void print_result(const struct result *r)
+{
+	double msgs = r->seconds ? r->ops / r->seconds : 0;
+	double mb = r->seconds ? r->bytes / r->seconds / 1e6 : 0;
+
+	if (cfg.json) {
+		printf("%s\n  {\"phase\": \"%s\", \"mode\": \"%s\", \"threads\": %d, "
+			"\"msg_size\": %zu, \"ops\": %llu, \"errors\": %llu, "
+			"\"msgs_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+			"\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+			"\"p999_ns\": %llu, \"max_ns\": %llu}",
+			nr_results ? "," : "[", r->phase, mode_name[cfg.mode],
+			r->threads, cfg.msg_size, (unsigned long long)r->ops,
+			(unsigned long long)r->errors, msgs, mb,
+			(unsigned long long)r->p50, (unsigned long long)r->p90,
+			(unsigned long long)r->p99, (unsigned long long)r->p999,
+			(unsigned long long)r->max);
+	} else {
+		if (!nr_results)
+			printf("phase,mode,threads,msg_size,ops,errors,msgs_per_sec,"
+				"mb_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+		printf("%s,%s,%d,%zu,%llu,%llu,%.1f,%.2f,%llu,%llu,%llu,%llu,%llu\n",
+			r->phase, mode_name[cfg.mode], r->threads, cfg.msg_size,
+			(unsigned long long)r->ops, (unsigned long long)r->errors,
+			msgs, mb, (unsigned long long)r->p50,
+			(unsigned long long)r->p90, (unsigned long long)r->p99,
+			(unsigned long long)r->p999, (unsigned long long)r->max);
+	}
+	nr_results++;
+}
+
+// Run the threads of the given roles for cfg.seconds, report per role
+static int run_phase(int writers, int readers, int ioctls)
+{
+	int nr = writers + readers + ioctls, i, role;
+	struct thread_ctx *threads = calloc(nr, sizeof(*threads));
+	uint64_t start, elapsed;
+
+	if (!threads)
+		return -1;
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL, nr + 1);
+	for (i = 0; i < nr; i++) {
+		struct thread_ctx *t = &threads[i];
+
+		t->id = i;
+		t->cpu = cfg.first_cpu + i;
+		t->fd = t->epfd = -1;
+		t->role = i < writers ? ROLE_WRITER :
+			  i < writers + readers ? ROLE_READER : ROLE_IOCTL;
+		t->buf = malloc(cfg.msg_size);
+		t->lat = malloc(MAX_SAMPLES * sizeof(*t->lat));
+		if (!t->buf || !t->lat) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		memset(t->buf, 'A' + i % 26, cfg.msg_size);
+		pthread_create(&t->tid, NULL, worker, t);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	sleep(cfg.seconds);
+	stop = 1;
+	for (i = 0; i < nr; i++)
+		pthread_join(threads[i].tid, NULL);
+	elapsed = now_ns() - start;
+	pthread_barrier_destroy(&start_barrier);
+
+	for (role = ROLE_WRITER; role <= ROLE_IOCTL; role++) {
+		struct result r = { .phase = role_name[role], .seconds = elapsed / 1e9 };
+		uint64_t *lat;
+		size_t n = 0;
+
+		for (i = 0; i < nr; i++)
+			if (threads[i].role == (enum role)role)
+				n += threads[i].nr_lat;
+		lat = malloc((n ? n : 1) * sizeof(*lat));
+		if (!lat)
+			break;
+
+		n = 0;
+		for (i = 0; i < nr; i++) {
+			struct thread_ctx *t = &threads[i];
+
+			if (t->role != (enum role)role)
+				continue;
+			r.threads++;
+			r.ops += t->ops;
+			r.bytes += t->bytes;
+			r.errors += t->errors;
+			memcpy(lat + n, t->lat, t->nr_lat * sizeof(*lat));
+			n += t->nr_lat;
+		}
+		percentiles(&r, lat, n);
+		if (r.threads)
+			print_result(&r);
+		free(lat);
+	}
+
+	for (i = 0; i < nr; i++) {
+		free(threads[i].buf);
+		free(threads[i].lat);
+	}
+	free(threads);
+
+	return 0;
+}
+
+// Write a message and read it back on an otherwise idle device
+static int run_rtt(void)
+{
+	struct result r = { .phase = "rtt", .threads = 1 };
+	uint64_t *lat = malloc(cfg.rtt_samples * sizeof(*lat));
+	char *buf = malloc(cfg.msg_size);
+	uint64_t start, begin;
+	int fd, i;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0 || !lat || !buf) {
+		perror("rtt setup");
+		return -1;
+	}
+	memset(buf, 'R', cfg.msg_size);
+
+	begin = now_ns();
+	for (i = 0; i < cfg.rtt_samples; i++) {
+		start = now_ns();
+		if (write(fd, buf, cfg.msg_size) < 0 || read(fd, buf, cfg.msg_size) < 0) {
+			r.errors++;
+			continue;
+		}
+		lat[r.ops++] = now_ns() - start;
+		r.bytes += cfg.msg_size;
+	}
+	r.seconds = (now_ns() - begin) / 1e9;
+
+	percentiles(&r, lat, r.ops);
+	print_result(&r);
 
-	// Close the device
 	close(fd);
+	free(buf);
+	free(lat);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-s msg_size] "
+		"[-d seconds] [-m block|epoll|uring] [-c first_cpu] "
+		"[-n rtt_samples] [-f csv|json]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:r:s:d:m:c:n:f:")) != -1) {
+		switch (opt) {
+		case 'w':
+			cfg.writers = atoi(optarg);
+			break;
+		case 'r':
+			cfg.readers = atoi(optarg);
+			break;
+		case 's':
+			cfg.msg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "block"))
+				cfg.mode = MODE_BLOCK;
+			else if (!strcmp(optarg, "epoll"))
+				cfg.mode = MODE_EPOLL;
+			else if (!strcmp(optarg, "uring"))
+				cfg.mode = MODE_URING;
+			else
+				usage(argv[0]);
+			break;
+		case 'c':
+			cfg.first_cpu = atoi(optarg);
+			break;
+		case 'n':
+			cfg.rtt_samples = atoi(optarg);
+			break;
+		case 'f':
+			cfg.json = !strcmp(optarg, "json");
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (cfg.writers < 0 || cfg.readers < 0 || cfg.writers + cfg.readers == 0 ||
+	    !cfg.msg_size || cfg.seconds <= 0 || cfg.rtt_samples <= 0)
+		usage(argv[0]);
+
+	// Fail early instead of reporting empty phases
+	opt = open(DEVICE_PATH, O_RDWR);
+	if (opt < 0) {
+		perror("Failed to open the device");
+		return errno;
+	}
+	close(opt);
+
+	if (run_phase(cfg.writers, cfg.readers, 0) < 0 || run_rtt() < 0 ||
+	    run_phase(0, 0, cfg.writers ? cfg.writers : 1) < 0)
+		return EXIT_FAILURE;
+
+	if (cfg.json)
+		printf("\n]\n");
 
 	return 0;
 }
@@ -0,0 +1,171 @@
+/* writev_bench.c
+ *
+ * Compares the ways to hand 64 buffers to the generic driver:
+ *
+ *	write:	64 write() calls, one per buffer
+ *	writev:	one writev() call with 64 iovecs, gathered by
+ *		write_iter into a single message
+ *	splice:	vmsplice() of the 64 buffers into a pipe, then
+ *		splice() from the pipe into the device, the pages go
+ *		through splice_write without a user-space bounce
+ *
+ * Usage: writev_bench [iterations] [iovec_size]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>	// open, splice, vmsplice
+#include <unistd.h>	// write, close
+#include <errno.h>	// error handling
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>	// writev
+
+#include "../kernel_space/generic_driver_ioctl.h"
+
+#define NR_IOVECS 64
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// bytes: what actually reached the device over all iterations
+static void report(const char *name, uint64_t ns, uint32_t iterations,
+		   uint64_t bytes)
+{
+	printf("%-8s %12.1f ns/batch %10.1f ns/iovec %10.1f MB/s\n", name,
+		(double)ns / iterations, (double)ns / iterations / NR_IOVECS,
+		(double)bytes * 1e3 / ns);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+	size_t iov_size = argc > 2 ? strtoul(argv[2], NULL, 0) : 16;
+	size_t batch_bytes = NR_IOVECS * iov_size;
+	struct iovec iov[NR_IOVECS], rest[NR_IOVECS];
+	struct gd_reg_info info;
+	uint64_t start, moved = 0;
+	uint32_t i;
+	int fd, j, first, pipefd[2];
+	char *buf;
+
+	fd = open(DEVICE_PATH, O_RDWR);
+	if (fd < 0) {
+		perror("Failed to open the device");
+		return errno;
+	}
+
+	if (ioctl(fd, IOCTL_REG_INFO, &info) < 0) {
+		perror("IOCTL_REG_INFO");
+		close(fd);
+		return errno;
+	}
+	if (!iterations || !iov_size || batch_bytes > info.data_size) {
+		fprintf(stderr, "%d iovecs of %zu bytes exceed the %u byte data window\n",
+			NR_IOVECS, iov_size, info.data_size);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	buf = malloc(batch_bytes);
+	if (!buf) {
+		perror("malloc");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	memset(buf, 'A', batch_bytes);
+	for (j = 0; j < NR_IOVECS; j++) {
+		iov[j].iov_base = buf + j * iov_size;
+		iov[j].iov_len = iov_size;
+	}
+
+	printf("%d iovecs of %zu bytes, %u iterations\n", NR_IOVECS, iov_size,
+		iterations);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < NR_IOVECS; j++) {
+			if (write(fd, iov[j].iov_base, iov[j].iov_len) < 0) {
+				perror("write");
+				goto out;
+			}
+		}
+	}
+	report("write", now_ns() - start, iterations,
+	       (uint64_t)iterations * batch_bytes);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (writev(fd, iov, NR_IOVECS) != (ssize_t)batch_bytes) {
+			perror("writev");
+			goto out;
+		}
+	}
+	report("writev", now_ns() - start, iterations,
+	       (uint64_t)iterations * batch_bytes);
+
+	if (pipe(pipefd) < 0) {
+		perror("pipe");
+		goto out;
+	}
+	/*
+	 * vmsplice takes one pipe slot per iovec and stops when the pipe
+	 * is full, 16 slots by default: make room for all of them, and
+	 * still go round until every iovec is in, where that fails
+	 */
+	if (fcntl(pipefd[1], F_SETPIPE_SZ, NR_IOVECS * getpagesize()) < 0)
+		perror("F_SETPIPE_SZ");
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memcpy(rest, iov, sizeof(rest));
+		first = 0;
+		while (first < NR_IOVECS) {
+			ssize_t left = vmsplice(pipefd[1], rest + first,
+						NR_IOVECS - first, 0);
+			size_t done = left;
+
+			if (left < 0) {
+				perror("vmsplice");
+				goto close_pipe;
+			}
+			// Skip what went in, part of an iovec included
+			while (done && done >= rest[first].iov_len)
+				done -= rest[first++].iov_len;
+			if (done) {
+				rest[first].iov_base = (char *)rest[first].iov_base + done;
+				rest[first].iov_len -= done;
+			}
+
+			while (left > 0) {
+				ssize_t n = splice(pipefd[0], NULL, fd, NULL,
+						   left, 0);
+
+				if (n <= 0) {
+					perror("splice");
+					goto close_pipe;
+				}
+				left -= n;
+				moved += n;
+			}
+		}
+	}
+	report("splice", now_ns() - start, iterations, moved);
+
+close_pipe:
+	close(pipefd[0]);
+	close(pipefd[1]);
+out:
+	free(buf);
+	close(fd);
+
+	return 0;
+}
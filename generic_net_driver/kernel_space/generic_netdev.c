@@ -1,89 +1,2301 @@
+/*
+ * generic_netdev.c -- loopback pair of virtual NICs
+ *
+ * Two Ethernet devices are created as a pair, like veth: a packet
+ * transmitted on one of them is received on the peer. Pairs are made
+ * with "ip link add NAME type generic_netdev" (generic_newlink), any
+ * number of them; every device has one TX and one RX queue per CPU
+ * unless numtxqueues/numrxqueues say otherwise:
+ *
+ * TX (generic_start_xmit):
+ *	Posts the skb on the TX ring of the queue and accounts it to
+ *	BQL. The doorbell (generic_tx_doorbell) is rung once per batch,
+ *	when netdev_xmit_more() says the stack has nothing more queued
+ *	or BQL stopped the queue: the "DMA engine" then hands the batch
+ *	to the peer RX queues selected by the flow hash (RSS) and raises
+ *	one interrupt per RX queue instead of one per packet
+ *
+ * RX interrupt (generic_raise_irq):
+ *	Emulated per queue with an hrtimer. Interrupt moderation is
+ *	set with ethtool -C rx-usecs N rx-frames M: the interrupt fires
+ *	rx-usecs after the first frame or once rx-frames frames are
+ *	pending, whichever is first; rx-usecs 0 interrupts per frame
+ *
+ * RX (generic_poll):
+ *	Per-queue NAPI context, drains the ring up to the budget, copies
+ *	every frame into an RX buffer and hands it to GRO. With
+ *	SO_BUSY_POLL / busy_read the socket polls the NAPI context
+ *	directly instead
+ *
+ * Offloads (generic_rx_offloads):
+ *	SG, checksum and TSO/GSO are advertised, so TCP hands over 64 KiB
+ *	super-packets with partial checksums. The peer copies one into a
+ *	head buffer plus page fragments and delivers it whole, gso_size
+ *	set and CHECKSUM_UNNECESSARY, the way hardware GRO would; the
+ *	checksum of a single frame is filled in during the copy
+ *
+ * RX buffers (generic_rx_buf_alloc):
+ *	Fragments of pages from a per-queue page_pool, the skb is built
+ *	around the buffer (napi_build_skb) and marked for recycling, so
+ *	in steady state a freed skb returns its page to the pool instead
+ *	of the page allocator; ethtool -S shows the recycling counters
+ *
+ * TX completion (generic_tx_clean):
+ *	The peer frees the transmitted skbs in its poll loop with
+ *	napi_consume_skb(), so they go back in bulk, and schedules our
+ *	NAPI, which reports the completed bytes to BQL once per poll
+ *
+ * XDP (generic_rx_xdp):
+ *	With a program attached the RX buffer gets XDP headroom and the
+ *	program runs on it before any skb exists.
+ *	XDP_TX and ndo_xdp_xmit put XDP frames on the peer's RX rings
+ *	next to the skbs, tagged like veth does
+ *
+ * AF_XDP (generic_xsk_xmit):
+ *	A zero-copy XSK pool bound to a queue pair supplies the RX
+ *	buffers straight from the fill ring, and its TX ring is drained
+ *	by the same NAPI into XDP frames for the peer: no skb is
+ *	allocated on either side
+ *
+ * Shaper (generic_shaper_doorbell):
+ *	Token bucket rate, delay with jitter, loss and reordering on the
+ *	way to the peer, set in /sys/class/net/<dev>/shaper/. Frames wait
+ *	in a calendar queue per peer RX queue, slots of 65.5 us; a single
+ *	hrtimer per queue wakes NAPI for the earliest busy slot, and the
+ *	poll takes every slot that is due in one go
+ *
+ * Statistics (generic_get_stats64):
+ *	64-bit counters per RX and TX queue, each with a single writer
+ *	(the queue's NAPI, the holder of the TX queue lock) and its own
+ *	u64_stats_sync, so no cache line is shared between CPUs on the
+ *	fast path; ethtool -S shows them per queue
+ *
+ * Traffic can be pushed through with iperf3 or pktgen once the two
+ * ends are placed in different network namespaces.
+ */
+
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/ethtool.h>
+#include <linux/ptr_ring.h>
+#include <linux/hrtimer.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/filter.h>
+#include <net/rtnetlink.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#include <net/xdp.h>
+#include <net/xdp_sock_drv.h>
+#include <net/page_pool/helpers.h>
+
+#define DRIVER_NAME "generic_netdev"
+
+// Depth of the per-queue ring between the peer's TX and our RX
+#define GENERIC_RING_SIZE 256
+
+// TX descriptors posted before the doorbell is rung regardless
+#define GENERIC_TX_RING_SIZE 64
+
+// Upper bound of ethtool -C rx-usecs
+#define GENERIC_MAX_COALESCE_USECS 10000
+
+// Headroom of an RX buffer without an XDP program
+#define GENERIC_RX_HEADROOM (NET_SKB_PAD + NET_IP_ALIGN)
+
+// Bytes copied into the head buffer, the rest goes into page fragments
+#define GENERIC_RX_HEAD_MAX (PAGE_SIZE - GENERIC_RX_HEADROOM - \
+			     SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+// Largest XDP buffer: headroom, frame, skb_shared_info in one page
+#define GENERIC_XDP_BUF_SIZE PAGE_SIZE
+#define GENERIC_XDP_MAX_FRAME (GENERIC_XDP_BUF_SIZE - XDP_PACKET_HEADROOM - \
+			       SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+#define GENERIC_XDP_MAX_MTU (GENERIC_XDP_MAX_FRAME - ETH_HLEN - VLAN_HLEN)
+
+// XDP_TX frames collected before they are handed to the peer
+#define GENERIC_XDP_TX_BULK 16
+
+// Bit 0 of an RX ring entry: an XDP frame rather than an skb
+#define GENERIC_XDP_FLAG 0x1UL
+
+// Shaper calendar: slots of 2^16 ns (65.5 us), 2048 of them (134 ms)
+#define GENERIC_SHAPER_SLOT_SHIFT 16
+#define GENERIC_SHAPER_SLOTS 2048
+#define GENERIC_SHAPER_MAX_DELAY_US 100000
+#define GENERIC_SHAPER_LIMIT 10000
+
+// 0: one TX/RX queue pair per online CPU
+static unsigned int num_queues;
+module_param(num_queues, uint, 0444);
+MODULE_PARM_DESC(num_queues, "TX/RX queues per device (0 = one per CPU)");
+
+struct generic_queue_stats {
+	struct u64_stats_sync syncp;
+	u64_stats_t packets;
+	u64_stats_t bytes;
+	u64_stats_t drops;
+	u64_stats_t errors;
+};
+
+#define GENERIC_QUEUE_STATS_NUM 4
+
+static const char generic_queue_stats_names[][ETH_GSTRING_LEN] = {
+	"packets", "bytes", "drops", "errors",
+};
+
+#define GENERIC_XDP_STATS_NUM 4
+
+static const char generic_xdp_stats_names[][ETH_GSTRING_LEN] = {
+	"xdp_drop", "xdp_tx", "xdp_redirect", "xsk_tx",
+};
+
+// Counted on any CPU: by the peer's transmit path and by ndo_xdp_xmit
+struct generic_pcpu_stats {
+	struct u64_stats_sync syncp;
+	u64_stats_t rx_ring_full;
+	u64_stats_t xdp_xmit;
+	u64_stats_t xdp_xmit_err;
+	u64_stats_t shaper_loss;
+	u64_stats_t shaper_overlimit;
+};
+
+#define GENERIC_PCPU_STATS_NUM 5
+
+static const char generic_pcpu_stats_names[][ETH_GSTRING_LEN] = {
+	"rx_ring_full", "xdp_xmit", "xdp_xmit_err",
+	"shaper_loss", "shaper_overlimit",
+};
+
+struct generic_shaper_slot {
+	struct list_head skbs;
+	unsigned int len;
+};
+
+/*
+ * Calendar queue of the shaper in front of an RX queue: an skb due at
+ * time t waits in slot (t >> GENERIC_SHAPER_SLOT_SHIFT) modulo the
+ * number of slots. One hrtimer per queue, armed for the earliest busy
+ * slot, schedules NAPI, which takes every slot that is due at once.
+ */
+struct generic_shaper_queue {
+	spinlock_t lock;		// the peer's doorbells against our NAPI
+	struct generic_shaper_slot *slots;
+	unsigned long *busy;		// bitmap of non-empty slots
+	u64 cursor;			// slots before it are delivered
+	u64 armed;			// slot the timer is set for, U64_MAX if none
+	unsigned int qlen;
+	struct hrtimer timer;
+	struct list_head ready;		// due skbs, NAPI only
+};
+
+// Shaping of the TX path into the peer, set through sysfs
+struct generic_shaper_cfg {
+	u32 rate_mbit;			// token bucket rate, 0 = no limit
+	u32 burst;			// bucket depth, bytes
+	u32 delay_us;
+	u32 jitter_us;
+	u32 loss_ppm;			// parts per million
+	u32 reorder_ppm;		// sent without the delay
+	u32 limit;			// skbs waiting per peer RX queue
+	bool active;
+	u64 ns_per_byte;		// 1/rate, 20-bit fixed point
+	u64 burst_ns;
+	atomic64_t tb_clock;		// token bucket virtual clock
+};
+
+struct generic_rx_queue {
+	struct napi_struct napi;
+	struct ptr_ring ring;		// skbs and XDP frames from the peer
+	struct net_device *dev;
+	struct hrtimer irq_timer;	// moderated RX "interrupt"
+	atomic_t pending;		// frames since the last interrupt
+	u16 qid;
+	struct page_pool *page_pool;	// RX buffers
+	struct xdp_rxq_info xdp_rxq;
+	struct xsk_buff_pool *xsk_pool;	// AF_XDP zero-copy, changed with NAPI off
+	struct generic_queue_stats stats;	// written by the NAPI poll
+	u64_stats_t xdp_drop;		// under stats.syncp
+	u64_stats_t xdp_tx;
+	u64_stats_t xdp_redirect;
+	u64_stats_t xsk_tx;
+	struct generic_shaper_queue shaper;
+} ____cacheline_aligned_in_smp;
+
+struct generic_tx_queue {
+	struct sk_buff *ring[GENERIC_TX_RING_SIZE];	// posted, doorbell not rung
+	unsigned int count;
+	u32 gen;			// bumped when BQL is reset
+	u16 qid;
+	struct napi_struct *napi;	// TX completion "interrupt"
+	struct generic_queue_stats stats;	// under the TX queue lock
+	u64_stats_t doorbells;		// under stats.syncp
+
+	// Completed by the peer's RX queues, reported to BQL by napi
+	atomic_t done_pkts ____cacheline_aligned_in_smp;
+	atomic_t done_bytes;
+} ____cacheline_aligned_in_smp;
+
+// Owner of a transmitted skb while it sits on the peer's RX ring
+struct generic_skb_cb {
+	struct generic_tx_queue *txq;
+	u32 gen;
+};
+
+#define GENERIC_SKB_CB(skb) ((struct generic_skb_cb *)(skb)->cb)
+
+struct generic_netdev_priv {
+	struct net_device __rcu *peer;
+	struct generic_rx_queue *rxq;	// one per RX queue
+	struct generic_tx_queue *txq;	// one per TX queue
+	struct generic_pcpu_stats __percpu *pcpu_stats;
+	struct bpf_prog __rcu *xdp_prog;
+	u32 rx_coalesce_usecs;		// ethtool -C rx-usecs
+	u32 rx_max_coalesced_frames;	// ethtool -C rx-frames
+	struct generic_shaper_cfg shaper;
+};
+
+static void generic_stats_add(struct generic_queue_stats *stats,
+			      unsigned int packets, unsigned int bytes)
+{
+	u64_stats_update_begin(&stats->syncp);
+	u64_stats_add(&stats->packets, packets);
+	u64_stats_add(&stats->bytes, bytes);
+	u64_stats_update_end(&stats->syncp);
+}
+
+static void generic_stats_inc(struct generic_queue_stats *stats, u64_stats_t *counter)
+{
+	u64_stats_update_begin(&stats->syncp);
+	u64_stats_inc(counter);
+	u64_stats_update_end(&stats->syncp);
+}
+
+static void generic_stats_read(struct generic_queue_stats *stats,
+			       u64 val[GENERIC_QUEUE_STATS_NUM])
+{
+	unsigned int start;
+
+	do {
+		start = u64_stats_fetch_begin(&stats->syncp);
+		val[0] = u64_stats_read(&stats->packets);
+		val[1] = u64_stats_read(&stats->bytes);
+		val[2] = u64_stats_read(&stats->drops);
+		val[3] = u64_stats_read(&stats->errors);
+	} while (u64_stats_fetch_retry(&stats->syncp, start));
+}
+
+static void generic_xdp_stats_read(struct generic_rx_queue *rxq,
+				   u64 val[GENERIC_XDP_STATS_NUM])
+{
+	unsigned int start;
+
+	do {
+		start = u64_stats_fetch_begin(&rxq->stats.syncp);
+		val[0] = u64_stats_read(&rxq->xdp_drop);
+		val[1] = u64_stats_read(&rxq->xdp_tx);
+		val[2] = u64_stats_read(&rxq->xdp_redirect);
+		val[3] = u64_stats_read(&rxq->xsk_tx);
+	} while (u64_stats_fetch_retry(&rxq->stats.syncp, start));
+}
+
+// Sums the per-CPU counters
+static void generic_pcpu_stats_read(struct generic_netdev_priv *priv,
+				    u64 total[GENERIC_PCPU_STATS_NUM])
+{
+	u64 val[GENERIC_PCPU_STATS_NUM];
+	unsigned int start, i;
+	int cpu;
+
+	memset(total, 0, GENERIC_PCPU_STATS_NUM * sizeof(*total));
+
+	for_each_possible_cpu(cpu) {
+		struct generic_pcpu_stats *ps = per_cpu_ptr(priv->pcpu_stats, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&ps->syncp);
+			val[0] = u64_stats_read(&ps->rx_ring_full);
+			val[1] = u64_stats_read(&ps->xdp_xmit);
+			val[2] = u64_stats_read(&ps->xdp_xmit_err);
+			val[3] = u64_stats_read(&ps->shaper_loss);
+			val[4] = u64_stats_read(&ps->shaper_overlimit);
+		} while (u64_stats_fetch_retry(&ps->syncp, start));
+
+		for (i = 0; i < GENERIC_PCPU_STATS_NUM; i++)
+			total[i] += val[i];
+	}
+}
+
+static void generic_rx_ring_full(struct generic_netdev_priv *priv,
+				 unsigned int frames)
+{
+	struct generic_pcpu_stats *ps = this_cpu_ptr(priv->pcpu_stats);
+
+	u64_stats_update_begin(&ps->syncp);
+	u64_stats_add(&ps->rx_ring_full, frames);
+	u64_stats_update_end(&ps->syncp);
+}
+
+static bool generic_is_xdp_frame(void *ptr)
+{
+	return (unsigned long)ptr & GENERIC_XDP_FLAG;
+}
+
+static void *generic_xdp_to_ptr(struct xdp_frame *xdpf)
+{
+	return (void *)((unsigned long)xdpf | GENERIC_XDP_FLAG);
+}
+
+static struct xdp_frame *generic_ptr_to_xdp(void *ptr)
+{
+	return (void *)((unsigned long)ptr & ~GENERIC_XDP_FLAG);
+}
+
+// Called by the peer once it fetched the frame from our TX ring
+static void generic_tx_done(struct sk_buff *skb)
+{
+	struct generic_skb_cb *cb = GENERIC_SKB_CB(skb);
+
+	// Posted before the ring was last reset, BQL no longer counts it
+	if (unlikely(cb->gen != READ_ONCE(cb->txq->gen)))
+		return;
+
+	atomic_add(skb->len, &cb->txq->done_bytes);
+	atomic_inc(&cb->txq->done_pkts);
+}
+
+// TX completion: one BQL update for everything the peer fetched since
+static void generic_tx_clean(struct net_device *dev, struct generic_tx_queue *txq)
+{
+	unsigned int pkts, bytes;
+
+	if (!atomic_read(&txq->done_pkts))
+		return;
+
+	pkts = atomic_xchg(&txq->done_pkts, 0);
+	bytes = atomic_xchg(&txq->done_bytes, 0);
+
+	// Wakes the queue if BQL stopped it
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, txq->qid), pkts, bytes);
+}
+
+static enum hrtimer_restart generic_irq_timer(struct hrtimer *timer)
+{
+	struct generic_rx_queue *rxq =
+		container_of(timer, struct generic_rx_queue, irq_timer);
+
+	napi_schedule(&rxq->napi);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Called by the peer's doorbell after queueing frames: raise the RX
+ * interrupt now, or leave it to the coalescing timer. While NAPI is
+ * scheduled the interrupt is masked, the poll loop picks them up.
+ */
+static void generic_raise_irq(struct generic_rx_queue *rxq,
+			      struct generic_netdev_priv *priv,
+			      unsigned int nr_frames)
+{
+	u32 usecs = READ_ONCE(priv->rx_coalesce_usecs);
+	u32 frames = READ_ONCE(priv->rx_max_coalesced_frames);
+	int pending;
+
+	if (!usecs) {
+		napi_schedule(&rxq->napi);
+		return;
+	}
+
+	/*
+	 * Pairs with the smp_mb() after napi_complete_done() in
+	 * generic_poll(): the frame just queued is seen by that poll's
+	 * ring check, or SCHED is seen clear here
+	 */
+	smp_mb();
+	if (test_bit(NAPI_STATE_SCHED, &rxq->napi.state))
+		return;
+
+	pending = atomic_add_return(nr_frames, &rxq->pending);
+	if (frames && pending >= frames)
+		napi_schedule(&rxq->napi);
+	else if (pending == nr_frames)
+		hrtimer_start(&rxq->irq_timer, us_to_ktime(usecs),
+			      HRTIMER_MODE_REL_SOFT);
+}
+
+// State of one poll loop
+struct generic_rx_ctx {
+	struct bpf_prog *prog;
+	struct xsk_buff_pool *pool;
+	struct xdp_frame_bulk bq;		// the peer's XDP frames, completed
+	struct generic_tx_queue *last_txq;	// the peer's TX queue to complete
+	struct xdp_frame *xdp_tx[GENERIC_XDP_TX_BULK];
+	unsigned int xdp_tx_n;
+	unsigned int pkts, bytes;
+	unsigned int xdp_drop, xdp_tx_sent, xdp_redirect, xsk_tx;
+	int budget;
+};
+
+static unsigned int generic_entry_len(void *ptr)
+{
+	if (generic_is_xdp_frame(ptr))
+		return generic_ptr_to_xdp(ptr)->len;
+
+	return ((struct sk_buff *)ptr)->len;
+}
+
+// The "DMA" of a frame out of the peer's TX buffer
+static void generic_entry_copy(void *ptr, unsigned int offset, void *to,
+			       unsigned int len)
+{
+	if (generic_is_xdp_frame(ptr))
+		memcpy(to, generic_ptr_to_xdp(ptr)->data + offset, len);
+	else
+		skb_copy_bits(ptr, offset, to, len);
+}
+
+static bool generic_entry_fits(struct net_device *dev, void *ptr,
+			       unsigned int len)
+{
+	if (generic_is_xdp_frame(ptr))
+		return len <= dev->mtu + dev->hard_header_len + VLAN_HLEN;
+
+	return is_skb_forwardable(dev, ptr);
+}
+
+// Hand the peer's TX buffer back once the frame has been copied
+static void generic_entry_complete(void *ptr, struct generic_rx_ctx *ctx)
+{
+	struct generic_tx_queue *txq;
+	struct sk_buff *skb;
+
+	if (generic_is_xdp_frame(ptr)) {
+		xdp_return_frame_bulk(generic_ptr_to_xdp(ptr), &ctx->bq);
+		return;
+	}
+
+	skb = ptr;
+	txq = GENERIC_SKB_CB(skb)->txq;
+
+	// Shaped frames were completed when they left the TX ring
+	if (!txq) {
+		napi_consume_skb(skb, ctx->budget);
+		return;
+	}
+
+	generic_tx_done(skb);
+	napi_consume_skb(skb, ctx->budget);
+
+	// The peer's completion interrupt is raised once per run of
+	// frames from the same TX queue
+	if (txq != ctx->last_txq) {
+		if (ctx->last_txq)
+			napi_schedule(ctx->last_txq->napi);
+		ctx->last_txq = txq;
+	}
+}
+
+// Puts XDP frames on one RX queue of the peer, returns how many fit
+static int generic_xdp_xmit_frames(struct net_device *dev, u32 qid,
+				   struct xdp_frame **frames, int n, bool flush)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_netdev_priv *peer_priv;
+	struct generic_rx_queue *rxq;
+	struct net_device *peer;
+	int sent = 0;
+
+	rcu_read_lock();
+	peer = rcu_dereference(priv->peer);
+	if (unlikely(!peer || !netif_running(peer)))
+		goto out;
+
+	peer_priv = netdev_priv(peer);
+	rxq = &peer_priv->rxq[qid % peer->real_num_rx_queues];
+
+	spin_lock(&rxq->ring.producer_lock);
+	while (sent < n &&
+	       !__ptr_ring_produce(&rxq->ring, generic_xdp_to_ptr(frames[sent])))
+		sent++;
+	spin_unlock(&rxq->ring.producer_lock);
+
+	if (unlikely(sent < n))
+		generic_rx_ring_full(peer_priv, n - sent);
+	if (sent && flush)
+		generic_raise_irq(rxq, peer_priv, sent);
+out:
+	rcu_read_unlock();
+
+	return sent;
+}
+
+static void generic_xdp_tx_flush(struct generic_rx_queue *rxq,
+				 struct generic_rx_ctx *ctx)
+{
+	int i, sent;
+
+	sent = generic_xdp_xmit_frames(rxq->dev, rxq->qid, ctx->xdp_tx,
+				       ctx->xdp_tx_n, true);
+	for (i = sent; i < ctx->xdp_tx_n; i++)
+		xdp_return_frame_rx_napi(ctx->xdp_tx[i]);
+
+	ctx->xdp_tx_sent += sent;
+	ctx->xdp_drop += ctx->xdp_tx_n - sent;
+	ctx->xdp_tx_n = 0;
+}
+
+static void generic_xdp_tx_queue(struct generic_rx_queue *rxq,
+				 struct xdp_frame *xdpf,
+				 struct generic_rx_ctx *ctx)
+{
+	if (ctx->xdp_tx_n == GENERIC_XDP_TX_BULK)
+		generic_xdp_tx_flush(rxq, ctx);
+
+	ctx->xdp_tx[ctx->xdp_tx_n++] = xdpf;
+}
+
+// Buffer size for a frame: headroom and skb_shared_info included
+static unsigned int generic_rx_truesize(unsigned int headroom, unsigned int len)
+{
+	return SKB_DATA_ALIGN(headroom + len) +
+	       SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+}
+
+// A page_pool fragment, recycled through the pool's per-NAPI cache
+static void *generic_rx_buf_alloc(struct generic_rx_queue *rxq,
+				  unsigned int truesize)
+{
+	unsigned int offset;
+	struct page *page;
+
+	page = page_pool_dev_alloc_frag(rxq->page_pool, &offset, truesize);
+	if (unlikely(!page))
+		return NULL;
+
+	return page_address(page) + offset;
+}
+
+// Called from our NAPI only, the page may go to the direct cache
+static void generic_rx_buf_free(struct generic_rx_queue *rxq, void *buf)
+{
+	page_pool_put_full_page(rxq->page_pool, virt_to_head_page(buf), true);
+}
+
+static void generic_rx_deliver(struct generic_rx_queue *rxq,
+			       struct sk_buff *skb, struct generic_rx_ctx *ctx)
+{
+	skb_record_rx_queue(skb, rxq->qid);
+	skb->protocol = eth_type_trans(skb, rxq->dev);
+	ctx->bytes += skb->len;
+	ctx->pkts++;
+	napi_gro_receive(&rxq->napi, skb);
+}
+
+// XDP_PASS of a page_pool buffer: the skb is built around it
+static struct sk_buff *generic_xdp_build_skb(struct xdp_buff *xdp)
+{
+	unsigned int metasize = xdp->data - xdp->data_meta;
+	struct sk_buff *skb;
+
+	skb = napi_build_skb(xdp->data_hard_start, xdp->frame_sz);
+	if (unlikely(!skb))
+		return NULL;
+
+	skb_mark_for_recycle(skb);
+	skb_reserve(skb, xdp->data - xdp->data_hard_start);
+	__skb_put(skb, xdp->data_end - xdp->data);
+	if (metasize)
+		skb_metadata_set(skb, metasize);
+
+	return skb;
+}
+
+// XDP_PASS of an AF_XDP buffer: it goes back to the fill ring, copy it
+static struct sk_buff *generic_xsk_build_skb(struct generic_rx_queue *rxq,
+					     struct xdp_buff *xdp)
+{
+	unsigned int metasize = xdp->data - xdp->data_meta;
+	unsigned int len = xdp->data_end - xdp->data_meta;
+	struct sk_buff *skb;
+
+	skb = napi_alloc_skb(&rxq->napi, len);
+	if (likely(skb)) {
+		memcpy(__skb_put(skb, len), xdp->data_meta, len);
+		if (metasize) {
+			__skb_pull(skb, metasize);
+			skb_metadata_set(skb, metasize);
+		}
+	}
+	xsk_buff_free(xdp);
+
+	return skb;
+}
+
+// Receive through the XDP program, into a page_pool or an XSK buffer
+static void generic_rx_xdp(struct generic_rx_queue *rxq, void *ptr,
+			   unsigned int len, struct generic_rx_ctx *ctx)
+{
+	struct xsk_buff_pool *pool = ctx->pool;
+	struct xdp_buff xdp_frag, *xdp;
+	struct xdp_frame *xdpf;
+	struct sk_buff *skb;
+	u32 act;
+
+	if (pool) {
+		if (unlikely(len > xsk_pool_get_rx_frame_size(pool))) {
+			generic_stats_inc(&rxq->stats, &rxq->stats.errors);
+			return;
+		}
+		xdp = xsk_buff_alloc(pool);
+		if (unlikely(!xdp)) {
+			// Fill ring empty: user space refills and wakes us up
+			if (xsk_uses_need_wakeup(pool))
+				xsk_set_rx_need_wakeup(pool);
+			generic_stats_inc(&rxq->stats, &rxq->stats.drops);
+			return;
+		}
+		xsk_buff_set_size(xdp, len);
+	} else {
+		unsigned int truesize;
+		void *buf;
+
+		if (unlikely(len > GENERIC_XDP_MAX_FRAME)) {
+			generic_stats_inc(&rxq->stats, &rxq->stats.errors);
+			return;
+		}
+		truesize = generic_rx_truesize(XDP_PACKET_HEADROOM, len);
+		buf = generic_rx_buf_alloc(rxq, truesize);
+		if (unlikely(!buf)) {
+			generic_stats_inc(&rxq->stats, &rxq->stats.drops);
+			return;
+		}
+		xdp = &xdp_frag;
+		xdp_init_buff(xdp, truesize, &rxq->xdp_rxq);
+		xdp_prepare_buff(xdp, buf, XDP_PACKET_HEADROOM, len, true);
+	}
+	generic_entry_copy(ptr, 0, xdp->data, len);
+
+	act = ctx->prog ? bpf_prog_run_xdp(ctx->prog, xdp) : XDP_PASS;
+	switch (act) {
+	case XDP_PASS:
+		skb = pool ? generic_xsk_build_skb(rxq, xdp) :
+			     generic_xdp_build_skb(xdp);
+		if (unlikely(!skb)) {
+			if (!pool)
+				generic_rx_buf_free(rxq, xdp->data_hard_start);
+			generic_stats_inc(&rxq->stats, &rxq->stats.drops);
+			return;
+		}
+		generic_rx_deliver(rxq, skb, ctx);
+		return;
+	case XDP_TX:
+		xdpf = pool ? xdp_convert_zc_to_xdp_frame(xdp) :
+			      xdp_convert_buff_to_frame(xdp);
+		if (unlikely(!xdpf))
+			goto drop;
+		if (pool)
+			xsk_buff_free(xdp);
+		generic_xdp_tx_queue(rxq, xdpf, ctx);
+		return;
+	case XDP_REDIRECT:
+		if (unlikely(xdp_do_redirect(rxq->dev, xdp, ctx->prog)))
+			goto drop;
+		ctx->xdp_redirect++;
+		return;
+	default:
+		bpf_warn_invalid_xdp_action(rxq->dev, ctx->prog, act);
+		fallthrough;
+	case XDP_ABORTED:
+		trace_xdp_exception(rxq->dev, ctx->prog, act);
+		fallthrough;
+	case XDP_DROP:
+		break;
+	}
+drop:
+	ctx->xdp_drop++;
+	if (pool)
+		xsk_buff_free(xdp);
+	else
+		generic_rx_buf_free(rxq, xdp->data_hard_start);
+}
+
+// TX checksum offload: the "DMA engine" fills in the checksum the stack
+// left for it, the way skb_checksum_help() would
+static void generic_rx_csum_insert(struct sk_buff *skb, struct sk_buff *tx_skb)
+{
+	int start = skb_checksum_start_offset(tx_skb);
+	__wsum csum = skb_checksum(skb, start, skb->len - start, 0);
+
+	*(__sum16 *)(skb->data + start + tx_skb->csum_offset) =
+		csum_fold(csum) ?: CSUM_MANGLED_0;
+}
+
+// The offload results the RX descriptor carries for a frame of the peer
+static void generic_rx_offloads(struct net_device *dev, struct sk_buff *skb,
+				struct sk_buff *tx_skb)
+{
+	bool rxcsum = dev->features & NETIF_F_RXCSUM;
+
+	// The RSS hash is part of the RX descriptor
+	skb_copy_hash(skb, tx_skb);
+
+	if (skb_is_gso(tx_skb)) {
+		// Delivered as one GRO-sized packet, like hardware GRO: the
+		// stack segments it again only if it is forwarded
+		skb_shinfo(skb)->gso_size = skb_shinfo(tx_skb)->gso_size;
+		skb_shinfo(skb)->gso_type = skb_shinfo(tx_skb)->gso_type &
+					    ~SKB_GSO_PARTIAL;
+		// qdisc_pkt_len_init() counts the segments; unknown ones are
+		// recomputed from the headers if marked untrusted
+		skb_shinfo(skb)->gso_segs = skb_shinfo(tx_skb)->gso_segs;
+		if (!skb_shinfo(skb)->gso_segs)
+			skb_shinfo(skb)->gso_type |= SKB_GSO_DODGY;
+	}
+
+	if (tx_skb->ip_summed != CHECKSUM_PARTIAL)
+		return;
+
+	if (!tx_skb->encapsulation && !skb_is_gso(tx_skb)) {
+		generic_rx_csum_insert(skb, tx_skb);
+		if (rxcsum)
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+	} else if (!tx_skb->encapsulation && rxcsum) {
+		// The GSO checksums are recomputed at segmentation time
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+	} else {
+		/*
+		 * Tunnels, or RX checksum offload off: leave the checksums
+		 * partial, which the receive path treats as verified and
+		 * segmentation completes, like veth does
+		 */
+		skb->ip_summed = CHECKSUM_PARTIAL;
+		skb->csum_start = skb_headroom(skb) +
+				  skb_checksum_start_offset(tx_skb);
+		skb->csum_offset = tx_skb->csum_offset;
+		if (tx_skb->encapsulation) {
+			skb->encapsulation = 1;
+			skb->inner_protocol_type = tx_skb->inner_protocol_type;
+			skb->inner_protocol = tx_skb->inner_protocol;
+			skb_set_inner_mac_header(skb, skb_inner_mac_offset(tx_skb));
+			skb_set_inner_network_header(skb,
+					skb_inner_network_offset(tx_skb));
+			skb_set_inner_transport_header(skb,
+					skb_inner_transport_offset(tx_skb));
+		}
+	}
+}
+
+/*
+ * Copies a frame into page_pool buffers: up to GENERIC_RX_HEAD_MAX bytes,
+ * headers included, into the buffer the skb is built around, the rest of
+ * a super-packet into page fragments (scatter-gather RX)
+ */
+static struct sk_buff *generic_rx_build_skb(struct generic_rx_queue *rxq,
+					    void *ptr, unsigned int len)
+{
+	unsigned int head_len = min_t(unsigned int, len, GENERIC_RX_HEAD_MAX);
+	unsigned int truesize = generic_rx_truesize(GENERIC_RX_HEADROOM,
+						    head_len);
+	unsigned int off, chunk, offset;
+	struct sk_buff *skb;
+	struct page *page;
+	void *buf;
+
+	buf = generic_rx_buf_alloc(rxq, truesize);
+	if (unlikely(!buf))
+		return NULL;
+
+	generic_entry_copy(ptr, 0, buf + GENERIC_RX_HEADROOM, head_len);
+
+	skb = napi_build_skb(buf, truesize);
+	if (unlikely(!skb)) {
+		generic_rx_buf_free(rxq, buf);
+		return NULL;
+	}
+	skb_mark_for_recycle(skb);
+	skb_reserve(skb, GENERIC_RX_HEADROOM);
+	__skb_put(skb, head_len);
+
+	for (off = head_len; off < len; off += chunk) {
+		chunk = min_t(unsigned int, len - off, PAGE_SIZE);
+		page = page_pool_dev_alloc_frag(rxq->page_pool, &offset, chunk);
+		if (unlikely(!page)) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		generic_entry_copy(ptr, off, page_address(page) + offset, chunk);
+		skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags, page, offset,
+				chunk, chunk);
+	}
+
+	return skb;
+}
+
+static void generic_rx_one(struct generic_rx_queue *rxq, void *ptr,
+			   struct generic_rx_ctx *ctx)
+{
+	unsigned int len = generic_entry_len(ptr);
+	struct sk_buff *skb;
+
+	if (unlikely(!generic_entry_fits(rxq->dev, ptr, len))) {
+		generic_stats_inc(&rxq->stats, &rxq->stats.errors);
+		return;
+	}
+
+	if (ctx->prog || ctx->pool) {
+		generic_rx_xdp(rxq, ptr, len, ctx);
+		return;
+	}
+
+	skb = generic_rx_build_skb(rxq, ptr, len);
+	if (unlikely(!skb)) {
+		generic_stats_inc(&rxq->stats, &rxq->stats.drops);
+		return;
+	}
+
+	if (!generic_is_xdp_frame(ptr))
+		generic_rx_offloads(rxq->dev, skb, ptr);
+
+	generic_rx_deliver(rxq, skb, ctx);
+}
+
+/*
+ * An AF_XDP TX descriptor becomes an XDP frame in a page fragment,
+ * the XSK buffer is completed right away. Filled in by hand like
+ * xdp_convert_buff_to_frame() would: the fragment does not belong
+ * to the memory model of an RX queue.
+ */
+static struct xdp_frame *generic_xsk_frame(struct xsk_buff_pool *pool,
+					   struct xdp_desc *desc)
+{
+	struct xdp_frame *xdpf;
+	void *buf;
+
+	if (unlikely(desc->len > GENERIC_XDP_MAX_FRAME))
+		return NULL;
+
+	buf = napi_alloc_frag(GENERIC_XDP_BUF_SIZE);
+	if (unlikely(!buf))
+		return NULL;
+
+	xdpf = buf;
+	xdpf->data = buf + XDP_PACKET_HEADROOM;
+	xdpf->len = desc->len;
+	xdpf->headroom = XDP_PACKET_HEADROOM - sizeof(*xdpf);
+	xdpf->metasize = 0;
+	xdpf->frame_sz = GENERIC_XDP_BUF_SIZE;
+	xdpf->flags = 0;
+	xdpf->mem.type = MEM_TYPE_PAGE_SHARED;
+	xdpf->mem.id = 0;
+	memcpy(xdpf->data, xsk_buff_raw_get_data(pool, desc->addr), desc->len);
+
+	return xdpf;
+}
+
+// AF_XDP TX of the queue pair, returns the descriptors consumed
+static u32 generic_xsk_xmit(struct generic_rx_queue *rxq,
+			    struct generic_rx_ctx *ctx)
+{
+	struct xsk_buff_pool *pool = ctx->pool;
+	struct xdp_desc *descs = pool->tx_descs;
+	struct xdp_frame *xdpf;
+	u32 i, n;
+
+	n = xsk_tx_peek_release_desc_batch(pool, ctx->budget);
+	for (i = 0; i < n; i++) {
+		xdpf = generic_xsk_frame(pool, &descs[i]);
+		if (unlikely(!xdpf)) {
+			ctx->xdp_drop++;
+			continue;
+		}
+		generic_xdp_tx_queue(rxq, xdpf, ctx);
+	}
+
+	// Copied out, the buffers go back to user space
+	if (n)
+		xsk_tx_completed(pool, n);
+	if (xsk_uses_need_wakeup(pool))
+		xsk_set_tx_need_wakeup(pool);
+
+	ctx->xsk_tx += n;
+
+	return n;
+}
+
+static void generic_rx_stats_update(struct generic_rx_queue *rxq,
+				    struct generic_rx_ctx *ctx)
+{
+	u64_stats_update_begin(&rxq->stats.syncp);
+	u64_stats_add(&rxq->stats.packets, ctx->pkts);
+	u64_stats_add(&rxq->stats.bytes, ctx->bytes);
+	u64_stats_add(&rxq->xdp_drop, ctx->xdp_drop);
+	u64_stats_add(&rxq->xdp_tx, ctx->xdp_tx_sent);
+	u64_stats_add(&rxq->xdp_redirect, ctx->xdp_redirect);
+	u64_stats_add(&rxq->xsk_tx, ctx->xsk_tx);
+	u64_stats_update_end(&rxq->stats.syncp);
+}
+
+static void generic_shaper_count(struct generic_pcpu_stats *ps,
+				 u64_stats_t *counter)
+{
+	u64_stats_update_begin(&ps->syncp);
+	u64_stats_inc(counter);
+	u64_stats_update_end(&ps->syncp);
+}
+
+static bool generic_shaper_chance(u32 ppm)
+{
+	return ppm && get_random_u32_below(1000000) < ppm;
+}
+
+/*
+ * Delivery time of a frame leaving at now: the token bucket is a
+ * virtual clock shared by all TX queues, it runs at most burst_ns
+ * behind now and advances by the wire time of every frame. The frame
+ * departs once the clock has caught up, then spends the link delay.
+ * False if that is past horizon: the frame is dropped and the clock
+ * is left alone, it only counts frames that make it onto the wire.
+ */
+static bool generic_shaper_time(struct generic_shaper_cfg *cfg,
+				unsigned int len, u64 now, u64 horizon,
+				u64 *t)
+{
+	u64 ns_per_byte = READ_ONCE(cfg->ns_per_byte);
+	u64 burst_ns = READ_ONCE(cfg->burst_ns);
+	u64 delay = 0, clock, start, depart;
+	u32 jitter;
+
+	// Reordered frames skip the delay and overtake the others
+	if (!generic_shaper_chance(READ_ONCE(cfg->reorder_ppm))) {
+		delay = (u64)READ_ONCE(cfg->delay_us) * NSEC_PER_USEC;
+		jitter = READ_ONCE(cfg->jitter_us) * NSEC_PER_USEC;
+		if (jitter)
+			delay += get_random_u32_below(2 * jitter + 1) -
+				 (u64)jitter;
+	}
+
+	if (!ns_per_byte) {
+		*t = now + delay;
+		return *t <= horizon;
+	}
+
+	clock = atomic64_read(&cfg->tb_clock);
+	do {
+		start = max(clock, now - burst_ns);
+		depart = start + ((len * ns_per_byte) >> 20);
+		*t = max(depart, now) + delay;
+		if (*t > horizon)
+			return false;
+	} while (!atomic64_try_cmpxchg(&cfg->tb_clock, &clock, depart));
+
+	return true;
+}
+
+/*
+ * Runs under the doorbell's RCU section, BHs off. The delivery time is
+ * taken under the queue lock, once the frame is sure to fit in it.
+ */
+static bool generic_shaper_enqueue(struct generic_rx_queue *rxq,
+				   struct generic_shaper_cfg *cfg,
+				   struct sk_buff *skb, u64 now,
+				   unsigned int limit)
+{
+	struct generic_shaper_queue *sq = &rxq->shaper;
+	unsigned int idx;
+	u64 slot, t;
+
+	spin_lock(&sq->lock);
+	// A receiver going down cancels the timer once we are out of here
+	if (unlikely(!netif_running(rxq->dev) || sq->qlen >= limit)) {
+		spin_unlock(&sq->lock);
+		return false;
+	}
+
+	// An idle calendar starts over at the current slot
+	if (!sq->qlen)
+		sq->cursor = max(sq->cursor, now >> GENERIC_SHAPER_SLOT_SHIFT);
+
+	// The calendar holds GENERIC_SHAPER_SLOTS slots from the cursor on
+	if (!generic_shaper_time(cfg, skb->len, now,
+				 ((sq->cursor + GENERIC_SHAPER_SLOTS) <<
+				  GENERIC_SHAPER_SLOT_SHIFT) - 1, &t)) {
+		spin_unlock(&sq->lock);
+		return false;
+	}
+
+	// Past slots are due now
+	slot = max(t >> GENERIC_SHAPER_SLOT_SHIFT, sq->cursor);
+	idx = slot & (GENERIC_SHAPER_SLOTS - 1);
+	list_add_tail(&skb->list, &sq->slots[idx].skbs);
+	sq->slots[idx].len++;
+	__set_bit(idx, sq->busy);
+	sq->qlen++;
+
+	if (slot < sq->armed) {
+		sq->armed = slot;
+		hrtimer_start(&sq->timer,
+			      ns_to_ktime(slot << GENERIC_SHAPER_SLOT_SHIFT),
+			      HRTIMER_MODE_ABS_SOFT);
+	}
+	spin_unlock(&sq->lock);
+
+	return true;
+}
+
+static enum hrtimer_restart generic_shaper_timer(struct hrtimer *timer)
+{
+	struct generic_rx_queue *rxq =
+		container_of(timer, struct generic_rx_queue, shaper.timer);
+
+	napi_schedule(&rxq->napi);
+
+	return HRTIMER_NORESTART;
+}
+
+// Moves every due slot to the ready list and re-arms the timer
+static void generic_shaper_collect(struct generic_rx_queue *rxq)
+{
+	struct generic_shaper_queue *sq = &rxq->shaper;
+	u64 now = ktime_get_ns() >> GENERIC_SHAPER_SLOT_SHIFT;
+	unsigned int idx, bit;
+	u64 slot = U64_MAX;
+
+	spin_lock(&sq->lock);
+	while (sq->qlen) {
+		idx = sq->cursor & (GENERIC_SHAPER_SLOTS - 1);
+		bit = find_next_bit(sq->busy, GENERIC_SHAPER_SLOTS, idx);
+		if (bit >= GENERIC_SHAPER_SLOTS)
+			bit = find_first_bit(sq->busy, GENERIC_SHAPER_SLOTS);
+		slot = sq->cursor + ((bit - idx) & (GENERIC_SHAPER_SLOTS - 1));
+		if (slot > now)
+			break;
+
+		list_splice_tail_init(&sq->slots[bit].skbs, &sq->ready);
+		sq->qlen -= sq->slots[bit].len;
+		sq->slots[bit].len = 0;
+		__clear_bit(bit, sq->busy);
+		sq->cursor = slot;
+		slot = U64_MAX;
+	}
+	sq->cursor = max(sq->cursor, now);
+
+	if (slot != sq->armed) {
+		sq->armed = slot;
+		if (slot != U64_MAX)
+			hrtimer_start(&sq->timer,
+				      ns_to_ktime(slot << GENERIC_SHAPER_SLOT_SHIFT),
+				      HRTIMER_MODE_ABS_SOFT);
+	}
+	spin_unlock(&sq->lock);
+}
+
+// With NAPI off and the peer no longer enqueueing
+static void generic_shaper_purge(struct generic_rx_queue *rxq)
+{
+	struct generic_shaper_queue *sq = &rxq->shaper;
+	struct sk_buff *skb, *tmp;
+	unsigned int bit;
+
+	hrtimer_cancel(&sq->timer);
+
+	spin_lock_bh(&sq->lock);
+	for_each_set_bit(bit, sq->busy, GENERIC_SHAPER_SLOTS) {
+		list_splice_tail_init(&sq->slots[bit].skbs, &sq->ready);
+		sq->slots[bit].len = 0;
+	}
+	bitmap_zero(sq->busy, GENERIC_SHAPER_SLOTS);
+	sq->qlen = 0;
+	sq->armed = U64_MAX;
+	spin_unlock_bh(&sq->lock);
+
+	list_for_each_entry_safe(skb, tmp, &sq->ready, list) {
+		skb_list_del_init(skb);
+		kfree_skb(skb);
+	}
+}
+
+static int generic_poll(struct napi_struct *napi, int budget)
+{
+	struct generic_rx_queue *rxq =
+		container_of(napi, struct generic_rx_queue, napi);
+	struct net_device *dev = rxq->dev;
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_rx_ctx ctx = { .budget = budget };
+	bool xsk_busy = false;
+	unsigned int q;
+	void *ptr;
+	int done = 0;
+
+	// The TX queues sharing this interrupt
+	for (q = rxq->qid; q < dev->real_num_tx_queues; q += dev->real_num_rx_queues)
+		generic_tx_clean(dev, &priv->txq[q]);
+
+	rcu_read_lock();
+	ctx.prog = rcu_dereference(priv->xdp_prog);
+	ctx.pool = READ_ONCE(rxq->xsk_pool);
+	xdp_frame_bulk_init(&ctx.bq);
+
+	if (ctx.pool)
+		xsk_busy = generic_xsk_xmit(rxq, &ctx) == budget;
+
+	// Acknowledge the interrupt, frames from now on count for the next
+	atomic_set(&rxq->pending, 0);
+
+	// Shaped frames whose time has come, one timer for all of them
+	if (READ_ONCE(rxq->shaper.qlen))
+		generic_shaper_collect(rxq);
+	while (done < budget && !list_empty(&rxq->shaper.ready)) {
+		struct sk_buff *skb = list_first_entry(&rxq->shaper.ready,
+						       struct sk_buff, list);
+
+		skb_list_del_init(skb);
+		done++;
+
+		generic_rx_one(rxq, skb, &ctx);
+		generic_entry_complete(skb, &ctx);
+	}
+
+	// NAPI is the only consumer, no consumer lock needed
+	while (done < budget) {
+		ptr = __ptr_ring_consume(&rxq->ring);
+		if (!ptr)
+			break;
+		done++;
+
+		generic_rx_one(rxq, ptr, &ctx);
+		generic_entry_complete(ptr, &ctx);
+	}
+
+	if (ctx.xdp_tx_n)
+		generic_xdp_tx_flush(rxq, &ctx);
+	if (ctx.xdp_redirect)
+		xdp_do_flush();
+	xdp_flush_frame_bulk(&ctx.bq);
+	rcu_read_unlock();
+
+	if (ctx.last_txq)
+		napi_schedule(ctx.last_txq->napi);
+
+	if (done || ctx.xsk_tx)
+		generic_rx_stats_update(rxq, &ctx);
+
+	// More AF_XDP descriptors are waiting, stay in polling mode
+	if (xsk_busy)
+		return budget;
+
+	if (done < budget && napi_complete_done(napi, done)) {
+		// A producer may have queued after the last consume
+		smp_mb();
+		if (!__ptr_ring_empty(&rxq->ring) && napi_schedule_prep(napi))
+			__napi_schedule(napi);
+	}
+
+	return done;
+}
+
+static void generic_ring_free(void *ptr)
+{
+	if (generic_is_xdp_frame(ptr))
+		xdp_return_frame(generic_ptr_to_xdp(ptr));
+	else
+		kfree_skb(ptr);
+}
+
+// Drop what the peer queued for us, completing its TX descriptors
+static void generic_rx_purge(struct generic_rx_queue *rxq)
+{
+	void *ptr;
+
+	local_bh_disable();
+	while ((ptr = ptr_ring_consume(&rxq->ring))) {
+		if (!generic_is_xdp_frame(ptr)) {
+			generic_tx_done(ptr);
+			napi_schedule(GENERIC_SKB_CB((struct sk_buff *)ptr)->txq->napi);
+		}
+		generic_ring_free(ptr);
+	}
+	local_bh_enable();
+}
+
+static int generic_open(struct net_device *dev)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct net_device *peer = rtnl_dereference(priv->peer);
+	unsigned int i;
+
+	if (!peer)
+		return -ENOTCONN;
+
+	/*
+	 * Frames posted before the last stop may still be on the peer's
+	 * RX rings. Retire their generation and wait for the peer's poll
+	 * loops to see it, so they do not complete into the new BQL state.
+	 */
+	for (i = 0; i < dev->real_num_tx_queues; i++)
+		WRITE_ONCE(priv->txq[i].gen, priv->txq[i].gen + 1);
+	synchronize_net();
+
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		atomic_set(&priv->txq[i].done_pkts, 0);
+		atomic_set(&priv->txq[i].done_bytes, 0);
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+	}
+
+	for (i = 0; i < dev->real_num_rx_queues; i++)
+		napi_enable(&priv->rxq[i].napi);
+
+	netif_tx_start_all_queues(dev);
+
+	// The link is up once both ends are
+	if (peer->flags & IFF_UP) {
+		netif_carrier_on(dev);
+		netif_carrier_on(peer);
+	}
+
+	return 0;
+}
+
+static int generic_stop(struct net_device *dev)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct net_device *peer = rtnl_dereference(priv->peer);
+	unsigned int i;
+
+	netif_carrier_off(dev);
+	if (peer)
+		netif_carrier_off(peer);
+
+	// Waits for generic_start_xmit to finish on every queue
+	netif_tx_disable(dev);
+
+	// Frames posted without a doorbell, the stack sends no more
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct generic_tx_queue *txq = &priv->txq[i];
+
+		while (txq->count)
+			dev_kfree_skb_any(txq->ring[--txq->count]);
+	}
+
+	/*
+	 * NAPI first, its poll re-arms the shaper timer. The peer's doorbells
+	 * that still saw us running arm both timers from an RCU section: wait
+	 * them out, then nothing starts the timers again until we reopen.
+	 */
+	for (i = 0; i < dev->real_num_rx_queues; i++)
+		napi_disable(&priv->rxq[i].napi);
+	synchronize_net();
+
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		hrtimer_cancel(&priv->rxq[i].irq_timer);
+		hrtimer_cancel(&priv->rxq[i].shaper.timer);
+		atomic_set(&priv->rxq[i].pending, 0);
+	}
+
+	// Drop what the peer sent while we were going down
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		generic_rx_purge(&priv->rxq[i]);
+		generic_shaper_purge(&priv->rxq[i]);
+	}
+
+	return 0;
+}
+
+// Drop a posted frame, still completing it towards BQL
+static void generic_tx_drop(struct generic_tx_queue *txq, struct sk_buff *skb)
+{
+	generic_stats_inc(&txq->stats, &txq->stats.drops);
+	generic_tx_done(skb);
+	dev_kfree_skb_any(skb);
+}
+
+/*
+ * The doorbell with the shaper on: the frames leave the TX ring for the
+ * "wire" at once, so their descriptors complete now, and wait in the
+ * calendar of the peer RX queue until they arrive.
+ */
+static void generic_shaper_doorbell(struct generic_netdev_priv *priv,
+				    struct net_device *peer,
+				    struct generic_tx_queue *txq, unsigned int n,
+				    unsigned int *pkts, unsigned int *bytes)
+{
+	struct generic_netdev_priv *peer_priv = netdev_priv(peer);
+	struct generic_shaper_cfg *cfg = &priv->shaper;
+	struct generic_pcpu_stats *ps = this_cpu_ptr(priv->pcpu_stats);
+	unsigned int limit = READ_ONCE(cfg->limit);
+	u64 now = ktime_get_ns();
+	struct generic_rx_queue *rxq;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct sk_buff *skb = txq->ring[i];
+		unsigned int len = skb->len;
+
+		rxq = &peer_priv->rxq[reciprocal_scale(skb_get_hash(skb),
+						       peer->real_num_rx_queues)];
+
+		generic_tx_done(skb);
+		GENERIC_SKB_CB(skb)->txq = NULL;
+
+		if (generic_shaper_chance(READ_ONCE(cfg->loss_ppm))) {
+			generic_shaper_count(ps, &ps->shaper_loss);
+			dev_kfree_skb_any(skb);
+			continue;
+		}
+
+		// In flight for a while: let go of the socket's send buffer
+		// where netem would (TCP keeps it, TSQ depends on it)
+		skb_orphan_partial(skb);
+
+		// Over the limit or past the calendar's horizon
+		if (unlikely(!generic_shaper_enqueue(rxq, cfg, skb, now,
+						     limit))) {
+			generic_shaper_count(ps, &ps->shaper_overlimit);
+			dev_kfree_skb_any(skb);
+			continue;
+		}
+
+		(*pkts)++;
+		*bytes += len;
+	}
+
+	// One BQL completion for the batch
+	napi_schedule(txq->napi);
+}
 
-#define DRIVER_NAME "generic_netdev"
+/*
+ * Hands the frames posted since the last doorbell to the peer. Frames
+ * for the same RX queue are produced under one lock acquisition and
+ * raise one interrupt.
+ */
+static void generic_tx_doorbell(struct net_device *dev,
+				struct generic_tx_queue *txq)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_rx_queue *rxq, *cur = NULL;
+	struct generic_netdev_priv *peer_priv;
+	unsigned int i, n = txq->count, run = 0, pkts = 0, bytes = 0;
+	struct net_device *peer;
+	bool dropped = false;
 
-struct generic_netdev_priv {
-	// Private data for the device
-	// For example, hardware registers or statistics
+	txq->count = 0;
+
+	rcu_read_lock();
+	peer = rcu_dereference(priv->peer);
+	if (unlikely(!peer || !netif_running(peer))) {
+		for (i = 0; i < n; i++)
+			generic_tx_drop(txq, txq->ring[i]);
+		dropped = true;
+		goto out;
+	}
+
+	peer_priv = netdev_priv(peer);
+	if (READ_ONCE(priv->shaper.active)) {
+		generic_shaper_doorbell(priv, peer, txq, n, &pkts, &bytes);
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct sk_buff *skb = txq->ring[i];
+		unsigned int len = skb->len;
+
+		// RSS: the flow hash spreads flows over the peer RX queues
+		rxq = &peer_priv->rxq[reciprocal_scale(skb_get_hash(skb),
+						       peer->real_num_rx_queues)];
+		if (rxq != cur) {
+			if (cur) {
+				spin_unlock(&cur->ring.producer_lock);
+				if (run)
+					generic_raise_irq(cur, peer_priv, run);
+			}
+			cur = rxq;
+			run = 0;
+			spin_lock(&cur->ring.producer_lock);
+		}
+
+		if (unlikely(__ptr_ring_produce(&cur->ring, skb))) {
+			generic_rx_ring_full(peer_priv, 1);
+			generic_tx_drop(txq, skb);
+			dropped = true;
+			continue;
+		}
+
+		run++;
+		pkts++;
+		bytes += len;
+	}
+
+	if (cur) {
+		spin_unlock(&cur->ring.producer_lock);
+		if (run)
+			generic_raise_irq(cur, peer_priv, run);
+	}
+out:
+	rcu_read_unlock();
+
+	u64_stats_update_begin(&txq->stats.syncp);
+	u64_stats_add(&txq->stats.packets, pkts);
+	u64_stats_add(&txq->stats.bytes, bytes);
+	u64_stats_inc(&txq->doorbells);
+	u64_stats_update_end(&txq->stats.syncp);
+
+	// Nobody else completes dropped frames
+	if (dropped)
+		napi_schedule(txq->napi);
+}
+
+static netdev_tx_t generic_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	u16 qid = skb_get_queue_mapping(skb);
+	struct generic_tx_queue *txq = &priv->txq[qid];
+	struct netdev_queue *nq = netdev_get_tx_queue(dev, qid);
+
+	GENERIC_SKB_CB(skb)->txq = txq;
+	GENERIC_SKB_CB(skb)->gen = txq->gen;
+	skb_tx_timestamp(skb);
+	txq->ring[txq->count++] = skb;
+
+	/*
+	 * Ring the doorbell when the stack has nothing more queued for
+	 * us, when BQL stopped the queue (no further xmit will come to
+	 * flush the batch) or when the TX ring is full.
+	 */
+	if (__netdev_tx_sent_queue(nq, skb->len, netdev_xmit_more()) ||
+	    txq->count == GENERIC_TX_RING_SIZE)
+		generic_tx_doorbell(dev, txq);
+
+	return NETDEV_TX_OK;
+}
+
+static void generic_get_stats64(struct net_device *dev,
+				struct rtnl_link_stats64 *tot)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	u64 pcpu[GENERIC_PCPU_STATS_NUM];
+	u64 val[GENERIC_QUEUE_STATS_NUM];
+	unsigned int i;
+
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		generic_stats_read(&priv->rxq[i].stats, val);
+		tot->rx_packets += val[0];
+		tot->rx_bytes += val[1];
+		tot->rx_dropped += val[2];
+		tot->rx_errors += val[3];
+	}
+
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		generic_stats_read(&priv->txq[i].stats, val);
+		tot->tx_packets += val[0];
+		tot->tx_bytes += val[1];
+		tot->tx_dropped += val[2];
+		tot->tx_errors += val[3];
+	}
+
+	generic_pcpu_stats_read(priv, pcpu);
+	tot->rx_dropped += pcpu[0];
+	tot->tx_packets += pcpu[1];
+	tot->tx_dropped += pcpu[2] + pcpu[3] + pcpu[4];
+}
+
+static void generic_get_drvinfo(struct net_device *dev,
+				struct ethtool_drvinfo *info)
+{
+	strscpy(info->driver, DRIVER_NAME, sizeof(info->driver));
+}
+
+static int generic_get_sset_count(struct net_device *dev, int sset)
+{
+	if (sset != ETH_SS_STATS)
+		return -EOPNOTSUPP;
+
+	return dev->real_num_rx_queues *
+		(GENERIC_QUEUE_STATS_NUM + GENERIC_XDP_STATS_NUM) +
+		dev->real_num_tx_queues * (GENERIC_QUEUE_STATS_NUM + 1) +
+		GENERIC_PCPU_STATS_NUM + page_pool_ethtool_stats_get_count();
+}
+
+static void generic_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	unsigned int i, j;
+
+	if (sset != ETH_SS_STATS)
+		return;
+
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		for (j = 0; j < GENERIC_QUEUE_STATS_NUM; j++)
+			ethtool_sprintf(&data, "rx%u_%s", i,
+					generic_queue_stats_names[j]);
+		for (j = 0; j < GENERIC_XDP_STATS_NUM; j++)
+			ethtool_sprintf(&data, "rx%u_%s", i,
+					generic_xdp_stats_names[j]);
+	}
+
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		for (j = 0; j < GENERIC_QUEUE_STATS_NUM; j++)
+			ethtool_sprintf(&data, "tx%u_%s", i,
+					generic_queue_stats_names[j]);
+		ethtool_sprintf(&data, "tx%u_doorbells", i);
+	}
+
+	for (j = 0; j < GENERIC_PCPU_STATS_NUM; j++)
+		ethtool_puts(&data, generic_pcpu_stats_names[j]);
+
+	page_pool_ethtool_stats_get_strings(data);
+}
+
+// Allocation and recycling counters of all RX page pools together
+static void generic_get_page_pool_stats(struct net_device *dev, u64 *data)
+{
+#ifdef CONFIG_PAGE_POOL_STATS
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct page_pool_stats pp_stats = {};
+	unsigned int i;
+
+	for (i = 0; i < dev->real_num_rx_queues; i++)
+		page_pool_get_stats(priv->rxq[i].page_pool, &pp_stats);
+
+	page_pool_ethtool_stats_get(data, &pp_stats);
+#endif
+}
+
+static void generic_get_ethtool_stats(struct net_device *dev,
+				      struct ethtool_stats *stats, u64 *data)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	unsigned int i;
+
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		generic_stats_read(&priv->rxq[i].stats, data);
+		data += GENERIC_QUEUE_STATS_NUM;
+		generic_xdp_stats_read(&priv->rxq[i], data);
+		data += GENERIC_XDP_STATS_NUM;
+	}
+
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct generic_tx_queue *txq = &priv->txq[i];
+		unsigned int start;
+
+		generic_stats_read(&txq->stats, data);
+		data += GENERIC_QUEUE_STATS_NUM;
+		do {
+			start = u64_stats_fetch_begin(&txq->stats.syncp);
+			*data = u64_stats_read(&txq->doorbells);
+		} while (u64_stats_fetch_retry(&txq->stats.syncp, start));
+		data++;
+	}
+
+	generic_pcpu_stats_read(priv, data);
+	data += GENERIC_PCPU_STATS_NUM;
+
+	generic_get_page_pool_stats(dev, data);
+}
+
+static int generic_get_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec,
+				struct kernel_ethtool_coalesce *kec,
+				struct netlink_ext_ack *extack)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+
+	ec->rx_coalesce_usecs = priv->rx_coalesce_usecs;
+	ec->rx_max_coalesced_frames = priv->rx_max_coalesced_frames;
+
+	return 0;
+}
+
+static int generic_set_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec,
+				struct kernel_ethtool_coalesce *kec,
+				struct netlink_ext_ack *extack)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+
+	if (ec->rx_coalesce_usecs > GENERIC_MAX_COALESCE_USECS) {
+		NL_SET_ERR_MSG_MOD(extack, "rx-usecs out of range");
+		return -EINVAL;
+	}
+	if (ec->rx_max_coalesced_frames > GENERIC_RING_SIZE) {
+		NL_SET_ERR_MSG_MOD(extack, "rx-frames larger than the RX ring");
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(priv->rx_coalesce_usecs, ec->rx_coalesce_usecs);
+	WRITE_ONCE(priv->rx_max_coalesced_frames, ec->rx_max_coalesced_frames);
+
+	return 0;
+}
+
+static const struct ethtool_ops generic_ethtool_ops = {
+	.supported_coalesce_params = ETHTOOL_COALESCE_RX_USECS |
+				     ETHTOOL_COALESCE_RX_MAX_FRAMES,
+	.get_drvinfo = generic_get_drvinfo,
+	.get_link = ethtool_op_get_link,
+	.get_sset_count = generic_get_sset_count,
+	.get_strings = generic_get_strings,
+	.get_ethtool_stats = generic_get_ethtool_stats,
+	.get_coalesce = generic_get_coalesce,
+	.set_coalesce = generic_set_coalesce,
 };
 
-static int generic_open(struct net_device *dev)
+static int generic_xdp_setup(struct net_device *dev, struct bpf_prog *prog,
+			     struct netlink_ext_ack *extack)
 {
-	netif_start_queue(dev);
-	// Additional initialization if necessary
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct net_device *peer;
+	struct bpf_prog *old;
+
+	// The whole frame has to fit in one RX buffer
+	if (prog && dev->mtu > GENERIC_XDP_MAX_MTU) {
+		NL_SET_ERR_MSG_MOD(extack, "MTU too large for XDP");
+		return -EOPNOTSUPP;
+	}
+
+	old = rtnl_dereference(priv->xdp_prog);
+	rcu_assign_pointer(priv->xdp_prog, prog);
+	if (old)
+		bpf_prog_put(old);
+
+	// The peer stops or resumes sending super-packets
+	peer = rtnl_dereference(priv->peer);
+	if (peer && !old != !prog)
+		netdev_update_features(peer);
 
 	return 0;
 }
 
-static int generic_stop(struct net_device *dev)
+static int generic_xsk_pool_setup(struct net_device *dev,
+				  struct xsk_buff_pool *pool, u16 qid)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	bool running = netif_running(dev);
+	struct generic_rx_queue *rxq;
+	int err = 0;
+
+	if (qid >= dev->real_num_rx_queues || qid >= dev->real_num_tx_queues)
+		return -EINVAL;
+
+	rxq = &priv->rxq[qid];
+
+	// The queue pair's NAPI owns both the RX buffers and the XSK TX ring
+	if (running)
+		napi_disable(&rxq->napi);
+
+	xdp_rxq_info_unreg_mem_model(&rxq->xdp_rxq);
+	if (pool)
+		err = xdp_rxq_info_reg_mem_model(&rxq->xdp_rxq,
+						 MEM_TYPE_XSK_BUFF_POOL, NULL);
+	if (!pool || err) {
+		// RX buffers from the page_pool again
+		xdp_rxq_info_reg_mem_model(&rxq->xdp_rxq, MEM_TYPE_PAGE_POOL,
+					   rxq->page_pool);
+		pool = NULL;
+	} else {
+		xsk_pool_set_rxq_info(pool, &rxq->xdp_rxq);
+	}
+	rxq->xsk_pool = pool;
+
+	if (running) {
+		napi_enable(&rxq->napi);
+		// Pick up what is already on the fill and TX rings
+		local_bh_disable();
+		napi_schedule(&rxq->napi);
+		local_bh_enable();
+	}
+
+	return err;
+}
+
+static int generic_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return generic_xdp_setup(dev, bpf->prog, bpf->extack);
+	case XDP_SETUP_XSK_POOL:
+		return generic_xsk_pool_setup(dev, bpf->xsk.pool, bpf->xsk.queue_id);
+	default:
+		return -EINVAL;
+	}
+}
+
+// Redirect target: frames from XDP programs, on any CPU
+static int generic_xdp_xmit(struct net_device *dev, int n,
+			    struct xdp_frame **frames, u32 flags)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_pcpu_stats *ps;
+	int sent;
+
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
+	if (unlikely(!netif_running(dev)))
+		return -ENETDOWN;
+
+	// The caller frees what was not sent
+	sent = generic_xdp_xmit_frames(dev, smp_processor_id(), frames, n,
+				       flags & XDP_XMIT_FLUSH);
+
+	ps = this_cpu_ptr(priv->pcpu_stats);
+	u64_stats_update_begin(&ps->syncp);
+	u64_stats_add(&ps->xdp_xmit, sent);
+	u64_stats_add(&ps->xdp_xmit_err, n - sent);
+	u64_stats_update_end(&ps->syncp);
+
+	return sent;
+}
+
+// AF_XDP sendto()/poll(): run the queue pair's NAPI
+static int generic_xsk_wakeup(struct net_device *dev, u32 qid, u32 flags)
 {
-	netif_stop_queue(dev);
-	// Additional cleanup if necessary
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_rx_queue *rxq;
+
+	if (!netif_running(dev))
+		return -ENETDOWN;
+	if (qid >= dev->real_num_rx_queues)
+		return -EINVAL;
+
+	rxq = &priv->rxq[qid];
+	if (!READ_ONCE(rxq->xsk_pool))
+		return -ENXIO;
+
+	if (!napi_if_scheduled_mark_missed(&rxq->napi)) {
+		local_bh_disable();
+		napi_schedule(&rxq->napi);
+		local_bh_enable();
+	}
 
 	return 0;
 }
 
-static netdev_tx_t generic_start_xmit(struct sk_buff *skb, struct net_device *dev)
+static int generic_change_mtu(struct net_device *dev, int new_mtu)
 {
-	// Handle packet transmission here
-	// For example, write to a hardware register
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+
+	if (rtnl_dereference(priv->xdp_prog) && new_mtu > GENERIC_XDP_MAX_MTU)
+		return -EINVAL;
 
-	// Free the socket buffer
-	dev_kfree_skb(skb);
+	WRITE_ONCE(dev->mtu, new_mtu);
 
-	return NETDEV_TX_OK;
+	return 0;
+}
+
+static netdev_features_t generic_fix_features(struct net_device *dev,
+					      netdev_features_t features)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_netdev_priv *peer_priv;
+	struct net_device *peer;
+
+	// An XDP program on the peer only takes single-buffer frames
+	peer = rtnl_dereference(priv->peer);
+	if (peer) {
+		peer_priv = netdev_priv(peer);
+		if (rtnl_dereference(peer_priv->xdp_prog))
+			features &= ~NETIF_F_GSO_MASK;
+	}
+
+	return features;
+}
+
+static int generic_shaper_init(struct generic_shaper_queue *sq)
+{
+	unsigned int i;
+
+	sq->slots = kvcalloc(GENERIC_SHAPER_SLOTS, sizeof(*sq->slots),
+			     GFP_KERNEL);
+	sq->busy = bitmap_zalloc(GENERIC_SHAPER_SLOTS, GFP_KERNEL);
+	if (!sq->slots || !sq->busy) {
+		kvfree(sq->slots);
+		bitmap_free(sq->busy);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < GENERIC_SHAPER_SLOTS; i++)
+		INIT_LIST_HEAD(&sq->slots[i].skbs);
+	INIT_LIST_HEAD(&sq->ready);
+	spin_lock_init(&sq->lock);
+	sq->armed = U64_MAX;
+	hrtimer_init(&sq->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+	sq->timer.function = generic_shaper_timer;
+
+	return 0;
+}
+
+static void generic_shaper_fini(struct generic_shaper_queue *sq)
+{
+	hrtimer_cancel(&sq->timer);
+	kvfree(sq->slots);
+	bitmap_free(sq->busy);
+}
+
+static int generic_rxq_init(struct net_device *dev,
+			    struct generic_rx_queue *rxq, u16 qid)
+{
+	struct page_pool_params pp = {
+		.order = 0,
+		.pool_size = GENERIC_RING_SIZE,
+		.nid = NUMA_NO_NODE,
+		.napi = &rxq->napi,
+		.netdev = dev,
+	};
+	int err;
+
+	err = ptr_ring_init(&rxq->ring, GENERIC_RING_SIZE, GFP_KERNEL);
+	if (err)
+		return err;
+
+	err = generic_shaper_init(&rxq->shaper);
+	if (err) {
+		ptr_ring_cleanup(&rxq->ring, NULL);
+		return err;
+	}
+
+	rxq->dev = dev;
+	rxq->qid = qid;
+	atomic_set(&rxq->pending, 0);
+	u64_stats_init(&rxq->stats.syncp);
+	hrtimer_init(&rxq->irq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	rxq->irq_timer.function = generic_irq_timer;
+	netif_napi_add(dev, &rxq->napi, generic_poll);
+
+	/*
+	 * Nothing to DMA-map for a software device, so no PP_FLAG_DMA_MAP:
+	 * the pool only recycles pages. Tied to the NAPI instance, pages
+	 * freed from its poll loop go to the lockless direct cache.
+	 */
+	rxq->page_pool = page_pool_create(&pp);
+	if (IS_ERR(rxq->page_pool)) {
+		err = PTR_ERR(rxq->page_pool);
+		rxq->page_pool = NULL;
+		goto err_napi;
+	}
+
+	err = xdp_rxq_info_reg(&rxq->xdp_rxq, dev, qid, rxq->napi.napi_id);
+	if (err)
+		goto err_pool;
+
+	// RX buffers come from the page_pool until an XSK pool is bound
+	err = xdp_rxq_info_reg_mem_model(&rxq->xdp_rxq, MEM_TYPE_PAGE_POOL,
+					 rxq->page_pool);
+	if (err)
+		goto err_xdp;
+
+	return 0;
+
+err_xdp:
+	xdp_rxq_info_unreg(&rxq->xdp_rxq);
+err_pool:
+	page_pool_destroy(rxq->page_pool);
+err_napi:
+	netif_napi_del(&rxq->napi);
+	generic_shaper_fini(&rxq->shaper);
+	ptr_ring_cleanup(&rxq->ring, NULL);
+
+	return err;
+}
+
+static void generic_rxq_fini(struct generic_rx_queue *rxq)
+{
+	xdp_rxq_info_unreg(&rxq->xdp_rxq);
+	page_pool_destroy(rxq->page_pool);
+	netif_napi_del(&rxq->napi);
+	generic_shaper_fini(&rxq->shaper);
+	ptr_ring_cleanup(&rxq->ring, generic_ring_free);
+}
+
+static void generic_free_queues(struct net_device *dev)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	unsigned int i;
+
+	if (priv->rxq) {
+		for (i = 0; i < dev->num_rx_queues; i++)
+			generic_rxq_fini(&priv->rxq[i]);
+	}
+	kfree(priv->rxq);
+	kfree(priv->txq);
+	free_percpu(priv->pcpu_stats);
+	priv->rxq = NULL;
+	priv->txq = NULL;
+	priv->pcpu_stats = NULL;
+}
+
+static int generic_alloc_queues(struct net_device *dev)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	unsigned int i;
+	int cpu;
+
+	priv->pcpu_stats = alloc_percpu(struct generic_pcpu_stats);
+	priv->txq = kcalloc(dev->num_tx_queues, sizeof(*priv->txq), GFP_KERNEL);
+	priv->rxq = kcalloc(dev->num_rx_queues, sizeof(*priv->rxq), GFP_KERNEL);
+	if (!priv->pcpu_stats || !priv->txq || !priv->rxq)
+		goto err;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(priv->pcpu_stats, cpu)->syncp);
+
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		struct generic_tx_queue *txq = &priv->txq[i];
+
+		txq->qid = i;
+		txq->napi = &priv->rxq[i % dev->num_rx_queues].napi;
+		u64_stats_init(&txq->stats.syncp);
+	}
+
+	for (i = 0; i < dev->num_rx_queues; i++) {
+		if (generic_rxq_init(dev, &priv->rxq[i], i)) {
+			while (i--)
+				generic_rxq_fini(&priv->rxq[i]);
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	kfree(priv->rxq);
+	kfree(priv->txq);
+	free_percpu(priv->pcpu_stats);
+	priv->rxq = NULL;
+	priv->txq = NULL;
+	priv->pcpu_stats = NULL;
+
+	return -ENOMEM;
 }
 
-static struct net_device_stats *generic_get_stats(struct net_device *dev)
+static int generic_dev_init(struct net_device *dev)
 {
-	static struct net_device_stats stats;
-	// Populate stats based on device's state
+	return generic_alloc_queues(dev);
+}
 
-	return &stats;
+static void generic_dev_uninit(struct net_device *dev)
+{
+	generic_free_queues(dev);
 }
 
 static const struct net_device_ops generic_netdev_ops = {
+	.ndo_init = generic_dev_init,
+	.ndo_uninit = generic_dev_uninit,
 	.ndo_open = generic_open,
 	.ndo_stop = generic_stop,
 	.ndo_start_xmit = generic_start_xmit,
-	.ndo_get_stats = generic_get_stats,
+	.ndo_get_stats64 = generic_get_stats64,
+	.ndo_set_mac_address = eth_mac_addr,
+	.ndo_change_mtu = generic_change_mtu,
+	.ndo_fix_features = generic_fix_features,
+	.ndo_bpf = generic_bpf,
+	.ndo_xdp_xmit = generic_xdp_xmit,
+	.ndo_xsk_wakeup = generic_xsk_wakeup,
+};
+
+static void generic_shaper_update(struct generic_shaper_cfg *cfg)
+{
+	u64 rate = (u64)cfg->rate_mbit * (1000000 / BITS_PER_BYTE);
+	u64 ns_per_byte = rate ? div64_u64((u64)NSEC_PER_SEC << 20, rate) : 0;
+
+	WRITE_ONCE(cfg->ns_per_byte, ns_per_byte);
+	WRITE_ONCE(cfg->burst_ns, (cfg->burst * ns_per_byte) >> 20);
+	WRITE_ONCE(cfg->active, cfg->rate_mbit || cfg->delay_us ||
+		   cfg->jitter_us || cfg->loss_ppm || cfg->reorder_ppm);
+}
+
+static ssize_t generic_shaper_show(struct device *d, char *buf, size_t off)
+{
+	struct generic_netdev_priv *priv = netdev_priv(to_net_dev(d));
+
+	return sysfs_emit(buf, "%u\n",
+			  READ_ONCE(*(u32 *)((void *)&priv->shaper + off)));
+}
+
+static ssize_t generic_shaper_store(struct device *d, const char *buf,
+				    size_t len, size_t off, u32 max)
+{
+	struct generic_netdev_priv *priv = netdev_priv(to_net_dev(d));
+	struct generic_shaper_cfg *cfg = &priv->shaper;
+	u32 *field = (void *)cfg + off;
+	u32 val, old;
+	int err;
+
+	err = kstrtou32(buf, 0, &val);
+	if (err)
+		return err;
+	if (val > max)
+		return -EINVAL;
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	old = *field;
+	WRITE_ONCE(*field, val);
+
+	// Delay plus jitter has to stay within the calendar
+	if (cfg->delay_us + cfg->jitter_us > GENERIC_SHAPER_MAX_DELAY_US) {
+		WRITE_ONCE(*field, old);
+		rtnl_unlock();
+		return -EINVAL;
+	}
+
+	generic_shaper_update(cfg);
+	rtnl_unlock();
+
+	return len;
+}
+
+#define GENERIC_SHAPER_ATTR(_name, _max)					\
+static ssize_t _name##_show(struct device *d,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	return generic_shaper_show(d, buf,				\
+			offsetof(struct generic_shaper_cfg, _name));	\
+}									\
+static ssize_t _name##_store(struct device *d,				\
+			     struct device_attribute *attr,		\
+			     const char *buf, size_t len)		\
+{									\
+	return generic_shaper_store(d, buf, len,			\
+			offsetof(struct generic_shaper_cfg, _name), _max); \
+}									\
+static DEVICE_ATTR_RW(_name)
+
+GENERIC_SHAPER_ATTR(rate_mbit, 400000);
+GENERIC_SHAPER_ATTR(burst, SZ_16M);
+GENERIC_SHAPER_ATTR(delay_us, GENERIC_SHAPER_MAX_DELAY_US);
+GENERIC_SHAPER_ATTR(jitter_us, GENERIC_SHAPER_MAX_DELAY_US);
+GENERIC_SHAPER_ATTR(loss_ppm, 1000000);
+GENERIC_SHAPER_ATTR(reorder_ppm, 1000000);
+GENERIC_SHAPER_ATTR(limit, 1000000);
+
+// /sys/class/net/<dev>/shaper/, shapes what <dev> sends to its peer
+static struct attribute *generic_shaper_attrs[] = {
+	&dev_attr_rate_mbit.attr,
+	&dev_attr_burst.attr,
+	&dev_attr_delay_us.attr,
+	&dev_attr_jitter_us.attr,
+	&dev_attr_loss_ppm.attr,
+	&dev_attr_reorder_ppm.attr,
+	&dev_attr_limit.attr,
+	NULL,
+};
+
+static const struct attribute_group generic_shaper_group = {
+	.name = "shaper",
+	.attrs = generic_shaper_attrs,
 };
 
 static void setup_generic_netdev(struct net_device *dev)
 {
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+
 	// Set up the device structure
+	ether_setup(dev);
 	dev->netdev_ops = &generic_netdev_ops;
+	dev->ethtool_ops = &generic_ethtool_ops;
+
+	// Queues go in ndo_uninit, the core frees the rest on unregister
+	dev->needs_free_netdev = true;
+
+	// Shaper off, with a bucket for one TSO super-packet
+	dev->sysfs_groups[0] = &generic_shaper_group;
+	priv->shaper.burst = SZ_64K;
+	priv->shaper.limit = GENERIC_SHAPER_LIMIT;
 
 	// Set up MAC address, MTU, etc.
 	eth_hw_addr_random(dev);
+
+	/*
+	 * Offloads: the stack hands over partial checksums and TCP super-
+	 * packets up to 64 KiB in page fragments, the "DMA engine" copies
+	 * them in one go. GSO partial covers tunnels with outer checksums.
+	 */
+	dev->features |= NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_RXCSUM |
+			 NETIF_F_HIGHDMA | NETIF_F_TSO | NETIF_F_TSO6 |
+			 NETIF_F_TSO_ECN | NETIF_F_TSO_MANGLEID |
+			 NETIF_F_GSO_UDP_L4 | NETIF_F_GSO_GRE |
+			 NETIF_F_GSO_GRE_CSUM | NETIF_F_GSO_UDP_TUNNEL |
+			 NETIF_F_GSO_UDP_TUNNEL_CSUM | NETIF_F_GSO_PARTIAL;
+	dev->gso_partial_features = NETIF_F_GSO_GRE_CSUM |
+				    NETIF_F_GSO_UDP_TUNNEL_CSUM;
+	dev->hw_features = dev->features;
+	dev->hw_enc_features = dev->features;
+	dev->vlan_features = dev->features;
+	netif_set_tso_max_size(dev, GSO_LEGACY_MAX_SIZE);
+
+	dev->xdp_features = NETDEV_XDP_ACT_BASIC | NETDEV_XDP_ACT_REDIRECT |
+			    NETDEV_XDP_ACT_NDO_XMIT | NETDEV_XDP_ACT_XSK_ZEROCOPY;
+
+	/*
+	 * No IFF_NO_QUEUE: BQL stops the TX queues, which needs a qdisc
+	 * to hold back the traffic, and qdisc bulk dequeue is what sets
+	 * xmit_more for regular sockets.
+	 */
+}
+
+static unsigned int generic_get_num_queues(void)
+{
+	return num_queues ? num_queues : num_online_cpus();
 }
 
-static int __init generic_netdev_init(void) {
-	struct net_device *netdev;
+// XPS: every CPU transmits on its own queue, CPUs share queues round-robin
+static void generic_set_xps(struct net_device *dev)
+{
+	unsigned int nq = dev->real_num_tx_queues, q, i;
+	cpumask_var_t mask;
+	int cpu;
 
-	netdev = alloc_etherdev(sizeof(struct generic_netdev_priv));
-	if (!netdev)
-		return -ENOMEM;
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
 
-	setup_generic_netdev(netdev);
-	if (register_netdev(netdev)) {
-		free_netdev(netdev);
-		return -EINVAL;
+	for (q = 0; q < nq; q++) {
+		cpumask_clear(mask);
+		i = 0;
+		for_each_online_cpu(cpu)
+			if (i++ % nq == q)
+				cpumask_set_cpu(cpu, mask);
+		netif_set_xps_queue(dev, mask, q);
+	}
+
+	free_cpumask_var(mask);
+}
+
+static int generic_validate(struct nlattr *tb[], struct nlattr *data[],
+			    struct netlink_ext_ack *extack)
+{
+	if (tb[IFLA_ADDRESS]) {
+		if (nla_len(tb[IFLA_ADDRESS]) != ETH_ALEN)
+			return -EINVAL;
+		if (!is_valid_ether_addr(nla_data(tb[IFLA_ADDRESS])))
+			return -EADDRNOTAVAIL;
+	}
+
+	return 0;
+}
+
+static struct rtnl_link_ops generic_link_ops;
+
+/*
+ * ip link add NAME [numtxqueues N] [numrxqueues M] type generic_netdev
+ *
+ * Creates NAME and its peer NAMEp in the same namespace, both with the
+ * queue counts of the request (default: num_queues, or one per CPU).
+ * Called with the RTNL held, dev is allocated but not registered yet.
+ */
+static int generic_newlink(struct net *src_net, struct net_device *dev,
+			   struct nlattr *tb[], struct nlattr *data[],
+			   struct netlink_ext_ack *extack)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct generic_netdev_priv *peer_priv;
+	struct nlattr *peer_tb[IFLA_MAX + 1];
+	char peer_name[IFNAMSIZ];
+	struct net_device *peer;
+	int err;
+
+	// The default "<kind>%d" template does not fit in IFNAMSIZ
+	if (!tb[IFLA_IFNAME])
+		strscpy(dev->name, "gn%d", IFNAMSIZ);
+	if (snprintf(peer_name, IFNAMSIZ, "%sp", dev->name) >= IFNAMSIZ)
+		strscpy(peer_name, "gnp%d", IFNAMSIZ);
+
+	// Same queue counts and MTU as dev, but its own MAC address
+	memcpy(peer_tb, tb, sizeof(peer_tb));
+	peer_tb[IFLA_ADDRESS] = NULL;
+
+	peer = rtnl_create_link(dev_net(dev), peer_name, NET_NAME_ENUM,
+				&generic_link_ops, peer_tb, extack);
+	if (IS_ERR(peer))
+		return PTR_ERR(peer);
+
+	netif_carrier_off(peer);
+	err = register_netdevice(peer);
+	if (err) {
+		free_netdev(peer);
+		return err;
 	}
 
-	printk(KERN_INFO "%s: Generic network device registered\n", DRIVER_NAME);
+	err = rtnl_configure_link(peer, NULL, 0, NULL);
+	if (err)
+		goto err_peer;
+
+	netif_carrier_off(dev);
+	err = register_netdevice(dev);
+	if (err)
+		goto err_peer;
+
+	peer_priv = netdev_priv(peer);
+	rcu_assign_pointer(priv->peer, peer);
+	rcu_assign_pointer(peer_priv->peer, dev);
+
+	generic_set_xps(dev);
+	generic_set_xps(peer);
+
+	printk(KERN_INFO "%s: Generic network device pair %s <-> %s registered\n",
+		DRIVER_NAME, dev->name, peer->name);
+
+	return 0;
+
+err_peer:
+	unregister_netdevice(peer);
+
+	return err;
+}
+
+// Deleting either end deletes the pair, also on namespace teardown
+static void generic_dellink(struct net_device *dev, struct list_head *head)
+{
+	struct generic_netdev_priv *priv = netdev_priv(dev);
+	struct net_device *peer = rtnl_dereference(priv->peer);
+	struct generic_netdev_priv *peer_priv;
+
+	unregister_netdevice_queue(dev, head);
+	if (!peer)
+		return;
+
+	/*
+	 * Both devices are closed before either frees its queues, and the
+	 * datapath only follows the peer pointer under RCU, so clearing
+	 * it here is enough to cut the pair.
+	 */
+	peer_priv = netdev_priv(peer);
+	RCU_INIT_POINTER(priv->peer, NULL);
+	RCU_INIT_POINTER(peer_priv->peer, NULL);
+	unregister_netdevice_queue(peer, head);
+}
+
+static struct rtnl_link_ops generic_link_ops = {
+	.kind = DRIVER_NAME,
+	.priv_size = sizeof(struct generic_netdev_priv),
+	.setup = setup_generic_netdev,
+	.validate = generic_validate,
+	.newlink = generic_newlink,
+	.dellink = generic_dellink,
+	.get_num_tx_queues = generic_get_num_queues,
+	.get_num_rx_queues = generic_get_num_queues,
+};
+
+static int __init generic_netdev_init(void)
+{
+	int ret;
+
+	ret = rtnl_link_register(&generic_link_ops);
+	if (ret)
+		return ret;
+
+	printk(KERN_INFO "%s: Registered link type %s\n", DRIVER_NAME,
+		generic_link_ops.kind);
 
 	return 0;
 }
 
+// Deletes every pair still around, in all namespaces
 static void __exit generic_netdev_exit(void)
 {
-	struct net_device *netdev; // This should be stored when allocated
-	unregister_netdev(netdev);
-	free_netdev(netdev);
-	printk(KERN_INFO "%s: Generic network device unregistered\n", DRIVER_NAME);
+	rtnl_link_unregister(&generic_link_ops);
+	printk(KERN_INFO "%s: Link type unregistered\n", DRIVER_NAME);
 }
 
 module_init(generic_netdev_init);
@@ -92,3 +2304,4 @@ module_exit(generic_netdev_exit);
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("A Generic Network Device Driver");
 MODULE_VERSION("1.0");
+MODULE_ALIAS_RTNL_LINK(DRIVER_NAME);
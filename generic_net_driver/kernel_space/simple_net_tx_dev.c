@@ -31,43 +31,27 @@ static int my_close(struct net_device *dev)
 // Function to transmit packets
 static netdev_tx_t simple_tx(struct sk_buff *skb, struct net_device *dev)
 {
-	// Here we would typically add logic to send the packet out
-	printk(KERN_INFO "Transmitting packet from %s\n", dev->name);
+	// Here we would typically add logic to send the packet out.
+	// No printk: at line rate it would cost more than the packet itself
+	dev->stats.tx_packets++;
+	dev->stats.tx_bytes += skb->len;
 
 	// Free the skb after "transmission"
 	dev_kfree_skb(skb);
 	return NETDEV_TX_OK;
 }
 
-static netdev_tx_t generic_start_xmit(struct sk_buff *skb, struct net_device *dev)
-{
-	// Handle packet transmission here
-	// For example, write to a hardware register
-
-	// Free the socket buffer
-	dev_kfree_skb(skb);
-
-	return NETDEV_TX_OK;
-}
-
-static struct net_device_stats *generic_get_stats(struct net_device *dev)
-{
-	static struct net_device_stats stats;
-	// Populate stats based on device's state
-
-	return &stats;
-}
-
 // Define your net_device_ops structure statically
 static const struct net_device_ops my_netdev_ops = {
 	.ndo_open = my_open,
 	.ndo_stop = my_close,
 	.ndo_start_xmit = simple_tx,
-	.ndo_start_xmit = generic_start_xmit,
-	.ndo_get_stats = generic_get_stats,
 	// Initialize other operations as needed
 };
 
+// The device registered at module load, unregistered at unload
+static struct net_device *simple_dev;
+
 static void setup_generic_netdev(struct net_device *dev)
 {
 	// Set up MAC address, MTU, etc.
@@ -84,9 +68,7 @@ static int __init my_init(void)
 
 	dev = alloc_etherdev(sizeof(struct generic_netdev_priv));
 	if (!dev) {
-		// Handle allocation failure
-		free_netdev(dev);
-
+		// Handle allocation failure, nothing to free
 		return -ENOMEM;
 	}
 
@@ -101,14 +83,19 @@ static int __init my_init(void)
 		return -EINVAL;
 	}
 
-	printk(KERN_INFO "%s: Generic network device registered\n", DRIVER_NAME);
+	simple_dev = dev;
+	printk(KERN_INFO "%s: Generic network device %s registered\n",
+		DRIVER_NAME, dev->name);
 
 	return 0;
 }
 
 static void __exit my_exit(void)
 {
-	// Cleanup code, unregister the device, etc.
+	// Closes the device if it is up, then frees it
+	unregister_netdev(simple_dev);
+	free_netdev(simple_dev);
+	printk(KERN_INFO "%s: Generic network device unregistered\n", DRIVER_NAME);
 }
 
 module_init(my_init);
@@ -0,0 +1,126 @@
+#!/bin/bash
+#
+# net_bench.sh -- benchmark suite of generic_netdev
+#
+# Creates its own pair in two network namespaces for every queue
+# count, then drives it with pkt_bench (AF_PACKET TX_RING generator in
+# nb1, sink in nb2) over every combination of:
+#
+#	-q	queues per device (numtxqueues/numrxqueues)
+#	-t	generator threads = sink threads, the CPU count of a run;
+#		generators sit on CPUs 0..t-1, sinks on t..2t-1
+#	-s	frame size
+#
+# and reports what the sink received, plus the balance of the peer's
+# RX queues from ethtool -S rx<N>_packets: max/mean of the per-queue
+# packet counts (1.00 is perfect RSS) and the counts themselves.
+#
+# Usage: sudo ./net_bench.sh [-q "queue counts"] [-t "thread counts"]
+#			     [-s "frame sizes"] [-d seconds] [-b]
+#
+#	-b	PACKET_QDISC_BYPASS on the generator
+#
+# Needs generic_netdev.ko (loaded from ../kernel_space if modprobe
+# cannot find it) and pkt_bench (see Makefile) next to this script.
+# Output is CSV, one line per run:
+#
+#	queues,threads,pkt_size,pps,gbps,cycles_per_pkt,cpu_ns_per_pkt,rxq_max_over_mean,rxq_packets
+
+NS1=nb1
+NS2=nb2
+DEV=nb0
+PEER=nb0p
+
+QUEUES="1 4"
+THREADS="1 2 4"
+SIZES="64 512 1500"
+DURATION=5
+BYPASS=
+
+while getopts "q:t:s:d:bh" opt; do
+	case $opt in
+	q) QUEUES=$OPTARG ;;
+	t) THREADS=$OPTARG ;;
+	s) SIZES=$OPTARG ;;
+	d) DURATION=$OPTARG ;;
+	b) BYPASS=-q ;;
+	*) sed -n '2,28s/^# \?//p' "$0"; exit 1 ;;
+	esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BENCH=$HERE/pkt_bench
+
+if [ ! -x "$BENCH" ]; then
+	echo "build pkt_bench first, see $HERE/Makefile" >&2
+	exit 1
+fi
+
+modprobe generic_netdev 2>/dev/null ||
+	insmod "$HERE/../kernel_space/generic_netdev.ko" 2>/dev/null
+if ! ip link add "$DEV" type generic_netdev 2>/dev/null; then
+	echo "cannot create a generic_netdev pair, module not loaded?" >&2
+	exit 1
+fi
+ip link del "$DEV"
+
+teardown() {
+	ip netns del "$NS1" 2>/dev/null
+	ip netns del "$NS2" 2>/dev/null
+}
+trap teardown EXIT
+
+# A fresh pair with $1 queues, nb1/nb0 10.0.0.1 <-> nb2/nb0p 10.0.0.2
+setup() {
+	teardown
+	ip netns add "$NS1"
+	ip netns add "$NS2"
+	ip link add "$DEV" numtxqueues "$1" numrxqueues "$1" type generic_netdev
+	ip link set "$DEV" netns "$NS1"
+	ip link set "$PEER" netns "$NS2"
+	ip -n "$NS1" addr add 10.0.0.1/24 dev "$DEV"
+	ip -n "$NS2" addr add 10.0.0.2/24 dev "$PEER"
+	ip -n "$NS1" link set "$DEV" up
+	ip -n "$NS2" link set "$PEER" up
+}
+
+# rx<N>_packets of the peer, one per line
+rxq_packets() {
+	ip netns exec "$NS2" ethtool -S "$PEER" |
+		awk '$1 ~ /^rx[0-9]+_packets:$/ { print $2 }'
+}
+
+echo "queues,threads,pkt_size,pps,gbps,cycles_per_pkt,cpu_ns_per_pkt,rxq_max_over_mean,rxq_packets"
+
+for queues in $QUEUES; do
+	setup "$queues"
+	mac=$(ip netns exec "$NS2" cat /sys/class/net/$PEER/address)
+
+	for threads in $THREADS; do
+		for size in $SIZES; do
+			before=$(rxq_packets)
+
+			ip netns exec "$NS2" "$BENCH" rx -i "$PEER" -t "$threads" \
+				-c "$threads" -d "$DURATION" > /tmp/net_bench.rx.$$ &
+			rx_pid=$!
+			sleep 0.5
+
+			# Outlasts the sink's window, which starts with the
+			# first packet
+			ip netns exec "$NS1" "$BENCH" tx -i "$DEV" -m "$mac" \
+				-t "$threads" -c 0 -s "$size" \
+				-d $((DURATION + 2)) $BYPASS > /dev/null
+			wait $rx_pid
+
+			after=$(rxq_packets)
+			balance=$(paste <(echo "$before") <(echo "$after") |
+				awk '{ d = $2 - $1; n++; sum += d; if (d > max) max = d;
+				       list = list (n > 1 ? ";" : "") d }
+				     END { printf "%.2f,%s", sum ? max * n / sum : 0, list }')
+
+			echo "$queues,$threads,$size,$(cat /tmp/net_bench.rx.$$),$balance"
+		done
+	done
+done
+
+rm -f /tmp/net_bench.rx.$$
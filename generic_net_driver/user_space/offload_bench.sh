@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# offload_bench.sh -- bulk TCP throughput of generic_netdev with the
+# offloads switched off step by step
+#
+# Runs iperf3 from ns1 to ns2 once per offload set of the sending end,
+# the receiving end keeps its defaults:
+#
+#	all:	sg, tx checksumming, tso and gso on, 64 KiB super-packets
+#		cross the pair in one copy
+#	no-tso:	gso only, the stack segments in software before xmit
+#	no-gso:	sg and checksumming, one MTU sized skb per segment
+#	none:	no sg and no checksum offload either, linear skbs with
+#		the checksum computed by the sender
+#
+# Usage: sudo ./offload_bench.sh [-P streams] [-t seconds] [-c "configs"]
+#
+# Output is CSV, one line per configuration:
+#
+#	config,streams,gbps,retransmits
+
+NS1=${NS1:-ns1}
+NS2=${NS2:-ns2}
+DEV=${DEV:-eth1}
+DST=${DST:-10.0.0.2}
+
+STREAMS=1
+SECONDS_RUN=10
+CONFIGS="all no-tso no-gso none"
+
+while getopts "P:t:c:h" opt; do
+	case $opt in
+	P) STREAMS=$OPTARG ;;
+	t) SECONDS_RUN=$OPTARG ;;
+	c) CONFIGS=$OPTARG ;;
+	*) sed -n '2,20s/^# \?//p' "$0"; exit 1 ;;
+	esac
+done
+
+in_ns1() {
+	ip netns exec "$NS1" "$@"
+}
+
+set_offloads() {
+	case $1 in
+	all)	in_ns1 ethtool -K "$DEV" sg on tx on tso on gso on ;;
+	no-tso)	in_ns1 ethtool -K "$DEV" sg on tx on tso off gso on ;;
+	no-gso)	in_ns1 ethtool -K "$DEV" sg on tx on tso off gso off ;;
+	none)	in_ns1 ethtool -K "$DEV" tso off gso off sg off tx off ;;
+	*)	echo "unknown config $1" >&2; return 1 ;;
+	esac
+}
+
+echo "config,streams,gbps,retransmits"
+
+for config in $CONFIGS; do
+	set_offloads "$config" >/dev/null 2>&1 || continue
+	# One-off server per run
+	ip netns exec "$NS2" iperf3 -s -D -1 >/dev/null 2>&1
+	sleep 0.5
+
+	# The SUM line of the sender carries the retransmits, the
+	# receiver line the goodput
+	in_ns1 iperf3 -c "$DST" -P "$STREAMS" -t "$SECONDS_RUN" -f g |
+		awk -v config="$config" -v streams="$STREAMS" -v p="$STREAMS" '
+		(p == 1 || $1 == "[SUM]") && / sender$/ { retr = $(NF - 1) }
+		(p == 1 || $1 == "[SUM]") && / receiver$/ {
+			for (i = 1; i < NF; i++)
+				if ($(i + 1) == "Gbits/sec")
+					gbps = $i
+		}
+		END { printf "%s,%s,%s,%s\n", config, streams, gbps, retr }'
+done
+
+# Back to the driver defaults
+set_offloads all >/dev/null 2>&1
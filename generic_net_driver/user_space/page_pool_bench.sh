@@ -0,0 +1,77 @@
+#!/bin/bash
+#
+# page_pool_bench.sh -- RX buffer allocations per packet and pps of
+# generic_netdev at 64 and 1500 byte frames
+#
+# Drives pktgen_bench.sh from ns1 and reads the page_pool counters of
+# the receiving end (ethtool -S, needs CONFIG_PAGE_POOL_STATS):
+#
+#	fast/pkt:	pages taken from the pool's caches
+#	slow/pkt:	pages that had to come from the page allocator
+#	recycled/pkt:	pages returned to the pool by freed skbs
+#
+# RX buffers are page fragments, so even the fast path only asks the
+# pool once per page: 64 byte frames share a page with several others,
+# 1500 byte frames two to a page. In steady state slow/pkt is close
+# to zero, the pages go round between the socket and the pool.
+#
+# Usage: sudo ./page_pool_bench.sh [-t threads] [-n count] [-b burst]
+#				   [-s "frame sizes"]
+#
+# Output is CSV, one line per frame size:
+#
+#	pkt_size,pps,rx_packets,fast_per_pkt,slow_per_pkt,recycled_per_pkt
+
+NS2=${NS2:-ns2}
+PEER=${PEER:-eth2}
+
+THREADS=1
+COUNT=2000000
+BURST=32
+SIZES="64 1500"
+
+while getopts "t:n:b:s:h" opt; do
+	case $opt in
+	t) THREADS=$OPTARG ;;
+	n) COUNT=$OPTARG ;;
+	b) BURST=$OPTARG ;;
+	s) SIZES=$OPTARG ;;
+	*) sed -n '2,25s/^# \?//p' "$0"; exit 1 ;;
+	esac
+done
+
+HERE=$(dirname "$0")
+
+# Sum of the ethtool -S counters matching a regex
+rx_counter() {
+	ip netns exec "$NS2" ethtool -S "$PEER" |
+		awk -v re="^($1):\$" '$1 ~ re { sum += $2 } END { print sum + 0 }'
+}
+
+snapshot() {
+	packets=$(rx_counter 'rx[0-9]+_packets')
+	fast=$(rx_counter rx_pp_alloc_fast)
+	slow=$(rx_counter 'rx_pp_alloc_slow|rx_pp_alloc_slow_ho')
+	recycled=$(rx_counter 'rx_pp_recycle_cached|rx_pp_recycle_ring')
+}
+
+if ! ip netns exec "$NS2" ethtool -S "$PEER" | grep -q rx_pp_alloc_fast; then
+	echo "no page_pool counters on $PEER, kernel without CONFIG_PAGE_POOL_STATS?" >&2
+	exit 1
+fi
+
+echo "pkt_size,pps,rx_packets,fast_per_pkt,slow_per_pkt,recycled_per_pkt"
+
+for size in $SIZES; do
+	snapshot
+	p0=$packets f0=$fast s0=$slow r0=$recycled
+
+	pps=$("$HERE"/pktgen_bench.sh -t "$THREADS" -s "$size" -n "$COUNT" \
+		-b "$BURST" -p 0 | tail -n 1 | cut -d, -f4)
+
+	snapshot
+	awk -v size="$size" -v pps="$pps" -v p=$((packets - p0)) \
+	    -v f=$((fast - f0)) -v s=$((slow - s0)) -v r=$((recycled - r0)) \
+		'BEGIN { printf "%s,%s,%d,%.4f,%.4f,%.4f\n", size, pps, p,
+			 p ? f / p : 0, p ? s / p : 0, p ? r / p : 0 }'
+done
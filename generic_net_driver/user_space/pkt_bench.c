@@ -0,0 +1,599 @@
+/* pkt_bench.c
+ *
+ * Multi-threaded AF_PACKET generator and sink for generic_netdev,
+ * the packet engine of net_bench.sh:
+ *
+ *	tx:	every thread owns a TPACKET_V2 TX ring on the interface,
+ *		pre-filled with UDP frames of its own set of flows, and
+ *		hands the whole ring to the kernel with one send()
+ *	rx:	every thread owns a TPACKET_V3 RX ring, the sockets form
+ *		a PACKET_FANOUT_CPU group, so each thread takes what
+ *		NAPI received on "its" CPUs
+ *
+ * Threads are pinned to consecutive CPUs from -c on. The TX queue
+ * follows the CPU (XPS), the peer RX queue the flow hash (RSS).
+ *
+ * rx waits for the first packet, measures for -d seconds and prints
+ * one CSV line:
+ *
+ *	pps,gbps,cycles_per_pkt,cpu_ns_per_pkt
+ *
+ * cycles_per_pkt counts the CPU cycles of all CPUs (perf, so the
+ * sender, the driver and the softirqs are all in) per packet
+ * received, -1 if the PMU is not available (VMs); cpu_ns_per_pkt is
+ * the non-idle CPU time of /proc/stat per packet.
+ *
+ * tx runs for -d seconds and prints pps,gbps of what it queued.
+ *
+ * Usage: pkt_bench tx -i ifname -m dst_mac [-t threads] [-c first_cpu]
+ *		    [-s pkt_size] [-d seconds] [-f flows] [-q]
+ *	  pkt_bench rx -i ifname [-t threads] [-c first_cpu] [-d seconds]
+ *
+ *	-f	UDP flows per thread (source ports), 64 by default
+ *	-q	PACKET_QDISC_BYPASS, straight to ndo_start_xmit
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>	// getopt, close, syscall
+#include <errno.h>	// error handling
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>	// CPU_SET
+#include <net/if.h>	// if_nametoindex
+#include <arpa/inet.h>	// htons
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/perf_event.h>
+
+#define MAX_THREADS	64
+#define MAX_PKT_SIZE	1514
+
+// TX ring: 2048 frames of 2 KiB per thread
+#define TX_FRAME_SIZE	2048
+#define TX_FRAMES	2048
+
+// RX ring: 32 blocks of 1 MiB per thread, retired after 10 ms
+#define RX_BLOCK_SIZE	(1 << 20)
+#define RX_BLOCKS	32
+
+enum mode { MODE_TX, MODE_RX };
+
+struct thread {
+	pthread_t tid;
+	int idx;
+	int cpu;
+	int fd;
+	char *ring;
+	size_t ring_len;
+	uint64_t pkts;		// written by the thread only
+	uint64_t bytes;
+} __attribute__((aligned(64)));
+
+static struct {
+	enum mode mode;
+	const char *ifname;
+	int ifindex;
+	unsigned char dst_mac[ETH_ALEN];
+	unsigned char src_mac[ETH_ALEN];
+	uint32_t threads, first_cpu, pkt_size, duration, flows;
+	bool bypass;
+} cfg = {
+	.threads = 1,
+	.pkt_size = 64,
+	.duration = 10,
+	.flows = 64,
+};
+
+static struct thread threads[MAX_THREADS];
+static volatile bool stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = true;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint16_t ip_csum(const void *data, size_t len)
+{
+	const uint16_t *p = data;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+static void pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		fprintf(stderr, "cannot pin to CPU %d\n", cpu);
+}
+
+// 10.0.0.1:port -> 10.0.0.2:9, the source port makes the flow
+static void build_frame(char *frame, uint16_t sport)
+{
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	struct iphdr *ip = (struct iphdr *)(eth + 1);
+	struct udphdr *udp = (struct udphdr *)(ip + 1);
+
+	memset(frame, 0, cfg.pkt_size);
+	memcpy(eth->h_dest, cfg.dst_mac, ETH_ALEN);
+	memcpy(eth->h_source, cfg.src_mac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_UDP;
+	ip->tot_len = htons(cfg.pkt_size - sizeof(*eth));
+	ip->saddr = htonl(0x0a000001);
+	ip->daddr = htonl(0x0a000002);
+	ip->check = ip_csum(ip, sizeof(*ip));
+
+	udp->source = htons(sport);
+	udp->dest = htons(9);
+	udp->len = htons(cfg.pkt_size - sizeof(*eth) - sizeof(*ip));
+}
+
+static int packet_socket(int version)
+{
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+		.sll_ifindex = cfg.ifindex,
+	};
+	int fd, one = 1;
+
+	fd = socket(AF_PACKET, SOCK_RAW, cfg.mode == MODE_TX ? 0 : htons(ETH_P_ALL));
+	if (fd < 0) {
+		perror("socket(AF_PACKET)");
+		return -1;
+	}
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+		perror("PACKET_VERSION");
+		goto err;
+	}
+	if (cfg.bypass &&
+	    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one))) {
+		perror("PACKET_QDISC_BYPASS");
+		goto err;
+	}
+	if (cfg.mode == MODE_TX)
+		sll.sll_protocol = 0;	// send only, no copy of the RX path
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll))) {
+		perror("bind");
+		goto err;
+	}
+
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+static int tx_setup(struct thread *t)
+{
+	struct tpacket_req req = {
+		.tp_block_size = TX_FRAME_SIZE * 16,
+		.tp_frame_size = TX_FRAME_SIZE,
+		.tp_block_nr = TX_FRAMES / 16,
+		.tp_frame_nr = TX_FRAMES,
+	};
+	uint32_t i;
+
+	t->fd = packet_socket(TPACKET_V2);
+	if (t->fd < 0)
+		return -1;
+	if (setsockopt(t->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))) {
+		perror("PACKET_TX_RING");
+		return -1;
+	}
+
+	t->ring_len = (size_t)req.tp_block_size * req.tp_block_nr;
+	t->ring = mmap(NULL, t->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       t->fd, 0);
+	if (t->ring == MAP_FAILED) {
+		perror("mmap TX ring");
+		return -1;
+	}
+
+	// The frames never change, only the slot status goes back and forth
+	for (i = 0; i < TX_FRAMES; i++) {
+		char *slot = t->ring + (size_t)i * TX_FRAME_SIZE;
+		char *data = slot + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+		build_frame(data, 1024 + t->idx * cfg.flows + i % cfg.flows);
+	}
+
+	return 0;
+}
+
+static void *tx_thread(void *arg)
+{
+	struct thread *t = arg;
+	struct pollfd pfd = { .fd = t->fd, .events = POLLOUT };
+	uint32_t head = 0, queued;
+
+	pin_to_cpu(t->cpu);
+
+	while (!stop) {
+		// Fill every free slot, then one send() for all of them
+		for (queued = 0; queued < TX_FRAMES; queued++) {
+			struct tpacket2_hdr *hdr = (struct tpacket2_hdr *)
+				(t->ring + (size_t)head * TX_FRAME_SIZE);
+
+			if (hdr->tp_status != TP_STATUS_AVAILABLE)
+				break;
+			hdr->tp_len = cfg.pkt_size;
+			__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+					 __ATOMIC_RELEASE);
+			head = (head + 1) % TX_FRAMES;
+		}
+
+		if (!queued) {
+			poll(&pfd, 1, 10);
+			continue;
+		}
+
+		if (send(t->fd, NULL, 0, MSG_DONTWAIT) < 0 &&
+		    errno != EAGAIN && errno != ENOBUFS) {
+			perror("send");
+			break;
+		}
+		__atomic_store_n(&t->pkts, t->pkts + queued, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->bytes, t->bytes + queued * cfg.pkt_size,
+				 __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int rx_setup(struct thread *t)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = RX_BLOCK_SIZE,
+		.tp_block_nr = RX_BLOCKS,
+		.tp_frame_size = TX_FRAME_SIZE,
+		.tp_frame_nr = RX_BLOCK_SIZE / TX_FRAME_SIZE * RX_BLOCKS,
+		.tp_retire_blk_tov = 10,
+	};
+	int fanout = (getpid() & 0xffff) | (PACKET_FANOUT_CPU << 16), one = 1;
+
+	t->fd = packet_socket(TPACKET_V3);
+	if (t->fd < 0)
+		return -1;
+	if (setsockopt(t->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+		perror("PACKET_RX_RING");
+		return -1;
+	}
+
+	t->ring_len = (size_t)req.tp_block_size * req.tp_block_nr;
+	t->ring = mmap(NULL, t->ring_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_LOCKED, t->fd, 0);
+	if (t->ring == MAP_FAILED) {
+		perror("mmap RX ring");
+		return -1;
+	}
+
+	// Not the ICMP errors the peer stack sends back
+	if (setsockopt(t->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one))) {
+		perror("PACKET_IGNORE_OUTGOING");
+		return -1;
+	}
+
+	if (setsockopt(t->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout))) {
+		perror("PACKET_FANOUT");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *rx_thread(void *arg)
+{
+	struct thread *t = arg;
+	struct pollfd pfd = { .fd = t->fd, .events = POLLIN | POLLERR };
+	uint32_t block = 0;
+
+	pin_to_cpu(t->cpu);
+
+	while (!stop) {
+		struct tpacket_block_desc *bd = (struct tpacket_block_desc *)
+			(t->ring + (size_t)block * RX_BLOCK_SIZE);
+		struct tpacket3_hdr *hdr;
+		uint64_t bytes = 0;
+		uint32_t i, n;
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+		      TP_STATUS_USER)) {
+			poll(&pfd, 1, 10);
+			continue;
+		}
+
+		n = bd->hdr.bh1.num_pkts;
+		hdr = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < n; i++) {
+			bytes += hdr->tp_len;
+			hdr = (struct tpacket3_hdr *)((char *)hdr + hdr->tp_next_offset);
+		}
+
+		__atomic_store_n(&t->pkts, t->pkts + n, __ATOMIC_RELAXED);
+		__atomic_store_n(&t->bytes, t->bytes + bytes, __ATOMIC_RELAXED);
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		block = (block + 1) % RX_BLOCKS;
+	}
+
+	return NULL;
+}
+
+static void totals(uint64_t *pkts, uint64_t *bytes)
+{
+	uint32_t i;
+
+	*pkts = *bytes = 0;
+	for (i = 0; i < cfg.threads; i++) {
+		*pkts += __atomic_load_n(&threads[i].pkts, __ATOMIC_RELAXED);
+		*bytes += __atomic_load_n(&threads[i].bytes, __ATOMIC_RELAXED);
+	}
+}
+
+// Cycle counters of all online CPUs, fds[cpu] = -1 where unavailable
+static int cycles_open(int *fds, int nr_cpus)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HARDWARE,
+		.size = sizeof(attr),
+		.config = PERF_COUNT_HW_CPU_CYCLES,
+	};
+	int cpu, opened = 0;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		fds[cpu] = syscall(SYS_perf_event_open, &attr, -1, cpu, -1, 0);
+		if (fds[cpu] >= 0)
+			opened++;
+	}
+
+	return opened;
+}
+
+static uint64_t cycles_read(int *fds, int nr_cpus)
+{
+	uint64_t total = 0, val;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		if (fds[cpu] >= 0 && read(fds[cpu], &val, sizeof(val)) == sizeof(val))
+			total += val;
+
+	return total;
+}
+
+// Non-idle CPU time of all CPUs from the first line of /proc/stat, ns
+static uint64_t cpu_busy_ns(void)
+{
+	unsigned long long v[8] = { 0 };
+	FILE *f = fopen("/proc/stat", "r");
+	long hz = sysconf(_SC_CLK_TCK);
+
+	if (!f)
+		return 0;
+	// user nice system idle iowait irq softirq steal
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0],
+		   &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 8)
+		v[0] = v[1] = v[2] = v[5] = v[6] = v[7] = 0;
+	fclose(f);
+
+	return (v[0] + v[1] + v[2] + v[5] + v[6] + v[7]) * 1000000000ull / hz;
+}
+
+static int run_rx(void)
+{
+	int nr_cpus = sysconf(_SC_NPROCESSORS_CONF), *fds;
+	uint64_t pkts0, bytes0, pkts, bytes, cyc0, cyc, busy0, busy, t0, t;
+	bool pmu;
+
+	fds = calloc(nr_cpus, sizeof(*fds));
+	if (!fds)
+		return EXIT_FAILURE;
+	pmu = cycles_open(fds, nr_cpus) > 0;
+
+	// The window starts with the first packet
+	do {
+		totals(&pkts0, &bytes0);
+		usleep(1000);
+	} while (!pkts0 && !stop);
+
+	totals(&pkts0, &bytes0);
+	cyc0 = cycles_read(fds, nr_cpus);
+	busy0 = cpu_busy_ns();
+	t0 = now_ns();
+
+	while (!stop && now_ns() - t0 < cfg.duration * 1000000000ull)
+		usleep(100000);
+
+	totals(&pkts, &bytes);
+	cyc = cycles_read(fds, nr_cpus);
+	busy = cpu_busy_ns();
+	t = now_ns() - t0;
+	pkts -= pkts0;
+	bytes -= bytes0;
+
+	printf("%.0f,%.3f,%.0f,%.0f\n", pkts * 1e9 / t, bytes * 8.0 / t,
+		pmu && pkts ? (double)(cyc - cyc0) / pkts : -1.0,
+		pkts ? (double)(busy - busy0) / pkts : -1.0);
+
+	free(fds);
+	return 0;
+}
+
+static int run_tx(void)
+{
+	uint64_t pkts, bytes, t0, t;
+
+	t0 = now_ns();
+	while (!stop && now_ns() - t0 < cfg.duration * 1000000000ull)
+		usleep(100000);
+	stop = true;
+
+	totals(&pkts, &bytes);
+	t = now_ns() - t0;
+	printf("%.0f,%.3f\n", pkts * 1e9 / t, bytes * 8.0 / t);
+
+	return 0;
+}
+
+static int get_mac(const char *ifname, unsigned char *mac)
+{
+	struct ifreq ifr = { 0 };
+	int fd = socket(AF_INET, SOCK_DGRAM, 0), ret;
+
+	if (fd < 0)
+		return -1;
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ret = ioctl(fd, SIOCGIFHWADDR, &ifr);
+	if (!ret)
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	close(fd);
+
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s tx -i ifname -m dst_mac [-t threads] [-c first_cpu]\n"
+		"\t[-s pkt_size] [-d seconds] [-f flows] [-q]\n"
+		"       %s rx -i ifname [-t threads] [-c first_cpu] [-d seconds]\n",
+		prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	bool have_mac = false;
+	uint32_t i;
+	int opt, ret;
+
+	if (argc < 2)
+		usage(argv[0]);
+	if (!strcmp(argv[1], "tx"))
+		cfg.mode = MODE_TX;
+	else if (!strcmp(argv[1], "rx"))
+		cfg.mode = MODE_RX;
+	else
+		usage(argv[0]);
+
+	optind = 2;
+	while ((opt = getopt(argc, argv, "i:m:t:c:s:d:f:q")) != -1) {
+		switch (opt) {
+		case 'i':
+			cfg.ifname = optarg;
+			break;
+		case 'm':
+			if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+				   &cfg.dst_mac[0], &cfg.dst_mac[1], &cfg.dst_mac[2],
+				   &cfg.dst_mac[3], &cfg.dst_mac[4], &cfg.dst_mac[5]) != 6)
+				usage(argv[0]);
+			have_mac = true;
+			break;
+		case 't':
+			cfg.threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.first_cpu = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg.pkt_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			cfg.flows = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			cfg.bypass = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!cfg.ifname || (cfg.mode == MODE_TX && !have_mac))
+		usage(argv[0]);
+	if (!cfg.threads || cfg.threads > MAX_THREADS || !cfg.flows ||
+	    cfg.pkt_size < 60 || cfg.pkt_size > MAX_PKT_SIZE) {
+		fprintf(stderr, "threads 1..%d, flows > 0, pkt_size 60..%d\n",
+			MAX_THREADS, MAX_PKT_SIZE);
+		return EXIT_FAILURE;
+	}
+
+	cfg.ifindex = if_nametoindex(cfg.ifname);
+	if (!cfg.ifindex || get_mac(cfg.ifname, cfg.src_mac)) {
+		perror(cfg.ifname);
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	for (i = 0; i < cfg.threads; i++) {
+		struct thread *t = &threads[i];
+
+		t->idx = i;
+		t->cpu = cfg.first_cpu + i;
+		if (cfg.mode == MODE_TX ? tx_setup(t) : rx_setup(t))
+			return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < cfg.threads; i++) {
+		ret = pthread_create(&threads[i].tid, NULL,
+				     cfg.mode == MODE_TX ? tx_thread : rx_thread,
+				     &threads[i]);
+		if (ret) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			return EXIT_FAILURE;
+		}
+	}
+
+	ret = cfg.mode == MODE_TX ? run_tx() : run_rx();
+
+	stop = true;
+	for (i = 0; i < cfg.threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		munmap(threads[i].ring, threads[i].ring_len);
+		close(threads[i].fd);
+	}
+
+	return ret;
+}
@@ -0,0 +1,153 @@
+#!/bin/bash
+#
+# pktgen_bench.sh -- pps and latency of generic_netdev with and
+# without xmit_more batching
+#
+# pktgen "burst N" hands N packets to ndo_start_xmit back to back, all
+# but the last with xmit_more set, so the driver rings its doorbell
+# once per N packets; burst 1 rings it for every packet. For every
+# burst size the script reports the rate measured by pktgen, the
+# doorbells per packet (ethtool -S tx*_doorbells) and the RTT of a
+# ping crossing the pair while pktgen is loading it.
+#
+# Expects the namespace setup of kernel_space/README.md:
+#
+#	ns1/eth1 10.0.0.1  <->  ns2/eth2 10.0.0.2
+#
+# Usage: sudo ./pktgen_bench.sh [-t threads] [-s pkt_size] [-n count]
+#				 [-b "burst sizes"] [-p pings]
+#
+#	-p 0	no ping, the RTT columns stay empty
+#
+# Output is CSV, one line per burst size:
+#
+#	burst,threads,pkt_size,pps,mbps,doorbells_per_pkt,rtt_avg_us,rtt_mdev_us
+
+NS1=${NS1:-ns1}
+NS2=${NS2:-ns2}
+DEV=${DEV:-eth1}
+PEER=${PEER:-eth2}
+DST_IP=${DST_IP:-10.0.0.2}
+
+THREADS=1
+PKT_SIZE=64
+COUNT=1000000
+BURSTS="1 4 16 64"
+PINGS=200
+
+while getopts "t:s:n:b:p:h" opt; do
+	case $opt in
+	t) THREADS=$OPTARG ;;
+	s) PKT_SIZE=$OPTARG ;;
+	n) COUNT=$OPTARG ;;
+	b) BURSTS=$OPTARG ;;
+	p) PINGS=$OPTARG ;;
+	*) sed -n '2,26s/^# \?//p' "$0"; exit 1 ;;
+	esac
+done
+
+PGDIR=/proc/net/pktgen
+
+in_ns1() {
+	ip netns exec "$NS1" "$@"
+}
+
+# Write a pktgen command and check that pktgen accepted it
+pgset() {
+	local file=$PGDIR/$1 cmd=$2
+
+	in_ns1 sh -c "echo '$cmd' > $file"
+	if [ "$file" != "$PGDIR/pgctrl" ] &&
+	   ! in_ns1 grep -q "^Result: OK" "$file"; then
+		echo "pktgen: '$cmd' failed on $file:" >&2
+		in_ns1 grep "^Result:" "$file" >&2
+		exit 1
+	fi
+}
+
+# Sum of an ethtool -S counter over all TX queues, e.g. "doorbells"
+tx_counter() {
+	in_ns1 ethtool -S "$DEV" |
+		awk -v c="$1" '$1 ~ "^tx[0-9]+_" c ":$" { sum += $2 } END { print sum + 0 }'
+}
+
+modprobe pktgen || exit 1
+if ! in_ns1 test -d $PGDIR; then
+	echo "pktgen is not available in netns $NS1" >&2
+	exit 1
+fi
+
+DST_MAC=$(ip -n "$NS2" -br link show "$PEER" | awk '{ print $3 }')
+if [ -z "$DST_MAC" ]; then
+	echo "no $PEER in netns $NS2, see kernel_space/README.md" >&2
+	exit 1
+fi
+
+# ip netns exec mounts the sysfs of the namespace
+NR_TXQ=$(in_ns1 sh -c "ls -d /sys/class/net/$DEV/queues/tx-*" | wc -l)
+
+echo "burst,threads,pkt_size,pps,mbps,doorbells_per_pkt,rtt_avg_us,rtt_mdev_us"
+
+for burst in $BURSTS; do
+	pgset pgctrl reset
+
+	# One pktgen thread per TX queue, each on its own CPU
+	for ((t = 0; t < THREADS; t++)); do
+		q=$((t % NR_TXQ))
+		pgset kpktgend_$t "rem_device_all"
+		pgset kpktgend_$t "add_device $DEV@$t"
+
+		f=$DEV@$t
+		pgset $f "count $COUNT"
+		pgset $f "pkt_size $PKT_SIZE"
+		pgset $f "burst $burst"
+		pgset $f "delay 0"
+		pgset $f "clone_skb 0"
+		pgset $f "queue_map_min $q"
+		pgset $f "queue_map_max $q"
+		pgset $f "dst $DST_IP"
+		pgset $f "dst_mac $DST_MAC"
+		# Random source ports spread the flows over the peer RX queues
+		pgset $f "udp_src_min 1024"
+		pgset $f "udp_src_max 65535"
+		pgset $f "flag UDPSRC_RND"
+	done
+
+	doorbells=$(tx_counter doorbells)
+	packets=$(tx_counter packets)
+
+	# RTT under load, measured while pktgen runs
+	: > /tmp/pktgen_bench.ping.$$
+	ping_pid=
+	if [ "$PINGS" -gt 0 ]; then
+		in_ns1 ping -q -i 0.005 -c "$PINGS" "$DST_IP" \
+			> /tmp/pktgen_bench.ping.$$ 2>&1 &
+		ping_pid=$!
+	fi
+
+	# Blocks until every thread sent its count
+	pgset pgctrl start
+
+	[ -n "$ping_pid" ] && wait $ping_pid
+
+	doorbells=$(( $(tx_counter doorbells) - doorbells ))
+	packets=$(( $(tx_counter packets) - packets ))
+
+	pps=0
+	mbps=0
+	for ((t = 0; t < THREADS; t++)); do
+		res=$(in_ns1 grep -o '[0-9]*pps [0-9]*Mb/sec' $PGDIR/$DEV@$t)
+		pps=$((pps + $(echo "$res" | sed 's/pps.*//')))
+		mbps=$((mbps + $(echo "$res" | sed 's/.*pps \([0-9]*\)Mb.*/\1/')))
+	done
+
+	# rtt min/avg/max/mdev = 0.012/0.020/0.051/0.006 ms
+	rtt=$(awk -F'[/ ]' '/^rtt/ { printf "%.1f,%.1f", $8 * 1000, $10 * 1000 }' \
+		/tmp/pktgen_bench.ping.$$)
+	rm -f /tmp/pktgen_bench.ping.$$
+
+	echo "$burst,$THREADS,$PKT_SIZE,$pps,$mbps,$(awk -v d=$doorbells -v p=$packets \
+		'BEGIN { printf "%.3f", p ? d / p : 0 }'),${rtt:-,}"
+done
+
+pgset pgctrl reset
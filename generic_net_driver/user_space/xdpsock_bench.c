@@ -0,0 +1,645 @@
+/* xdpsock_bench.c
+ *
+ * AF_XDP benchmark for generic_netdev, in the spirit of the kernel's
+ * xdpsock sample but without libbpf/libxdp: the XSKMAP and the XDP
+ * program (redirect every frame of the queue to the socket) are set
+ * up with the bpf() system call, the rings are mapped by hand.
+ *
+ *	rxdrop:	receive and drop, the buffers go straight back to the
+ *		fill ring
+ *	txonly:	transmit a fixed UDP frame as fast as the TX ring allows
+ *	l2fwd:	swap the MAC addresses and send every frame back
+ *
+ * Run txonly on one end of the pair and rxdrop on the other, both on
+ * the same queue (frames of TX queue N arrive on the peer's queue N):
+ *
+ *	sudo ip netns exec ns2 ./xdpsock_bench -i eth2 -q 0 -m rxdrop &
+ *	sudo ip netns exec ns1 ./xdpsock_bench -i eth1 -q 0 -m txonly
+ *
+ * Usage: xdpsock_bench -i ifname [-q queue] [-m rxdrop|txonly|l2fwd]
+ *			[-s pkt_size] [-d seconds] [-b batch] [-c]
+ *
+ *	-c	copy mode (XDP_COPY) instead of zero-copy
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <signal.h>
+#include <unistd.h>	// getopt, close, syscall
+#include <errno.h>	// error handling
+#include <time.h>
+#include <poll.h>
+#include <net/if.h>	// if_nametoindex
+#include <arpa/inet.h>	// htons
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>	// XDP_FLAGS_DRV_MODE
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define NUM_FRAMES	4096
+#define FRAME_SIZE	2048
+#define RING_SIZE	2048	// fill, completion, RX and TX rings
+#define MAX_BATCH	256
+
+enum mode { MODE_RXDROP, MODE_TXONLY, MODE_L2FWD };
+
+// A producer or consumer ring shared with the kernel
+struct ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *descs;
+	uint32_t mask;
+	uint32_t size;
+	uint32_t cached_prod;
+	uint32_t cached_cons;
+	void *map;
+	size_t map_len;
+};
+
+struct xsk {
+	int fd;
+	char *umem;
+	struct ring fill, comp, rx, tx;
+	uint64_t free_frames[NUM_FRAMES];	// TX frames not in flight
+	uint32_t nr_free;
+	uint32_t outstanding_tx;
+	uint64_t rx_pkts, tx_pkts;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+// Free slots of a producer ring, refreshing the consumer index if needed
+static uint32_t ring_prod_free(struct ring *r, uint32_t nb)
+{
+	uint32_t free = r->cached_cons - r->cached_prod;
+
+	if (free >= nb)
+		return free;
+
+	r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE) + r->size;
+	return r->cached_cons - r->cached_prod;
+}
+
+static uint32_t ring_reserve(struct ring *r, uint32_t nb, uint32_t *idx)
+{
+	if (ring_prod_free(r, nb) < nb)
+		return 0;
+
+	*idx = r->cached_prod;
+	r->cached_prod += nb;
+	return nb;
+}
+
+static void ring_submit(struct ring *r)
+{
+	__atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+static uint32_t ring_peek(struct ring *r, uint32_t nb, uint32_t *idx)
+{
+	uint32_t entries = r->cached_prod - r->cached_cons;
+
+	if (!entries) {
+		r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+		entries = r->cached_prod - r->cached_cons;
+	}
+	if (entries > nb)
+		entries = nb;
+
+	*idx = r->cached_cons;
+	r->cached_cons += entries;
+	return entries;
+}
+
+static void ring_release(struct ring *r)
+{
+	__atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static bool ring_needs_wakeup(struct ring *r)
+{
+	return __atomic_load_n(r->flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP;
+}
+
+static uint64_t *addr_at(struct ring *r, uint32_t idx)
+{
+	return &((uint64_t *)r->descs)[idx & r->mask];
+}
+
+static struct xdp_desc *desc_at(struct ring *r, uint32_t idx)
+{
+	return &((struct xdp_desc *)r->descs)[idx & r->mask];
+}
+
+static int ring_map(int fd, struct ring *r, const struct xdp_ring_offset *off,
+		    size_t desc_size, off_t pgoff, bool producer)
+{
+	r->map_len = off->desc + RING_SIZE * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		perror("mmap ring");
+		return -1;
+	}
+
+	r->producer = (uint32_t *)((char *)r->map + off->producer);
+	r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+	r->flags = (uint32_t *)((char *)r->map + off->flags);
+	r->descs = (char *)r->map + off->desc;
+	r->size = RING_SIZE;
+	r->mask = RING_SIZE - 1;
+	r->cached_prod = *r->producer;
+	r->cached_cons = *r->consumer + (producer ? RING_SIZE : 0);
+
+	return 0;
+}
+
+static int xsk_create(struct xsk *xsk, int ifindex, int queue, bool copy)
+{
+	struct xdp_umem_reg mr = {
+		.len = NUM_FRAMES * FRAME_SIZE,
+		.chunk_size = FRAME_SIZE,
+	};
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_ifindex = ifindex,
+		.sxdp_queue_id = queue,
+		.sxdp_flags = (copy ? XDP_COPY : XDP_ZEROCOPY) | XDP_USE_NEED_WAKEUP,
+	};
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	int size = RING_SIZE;
+
+	xsk->umem = mmap(NULL, mr.len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xsk->umem == MAP_FAILED) {
+		perror("mmap umem");
+		return -1;
+	}
+	mr.addr = (uintptr_t)xsk->umem;
+
+	xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xsk->fd < 0) {
+		perror("socket(AF_XDP)");
+		return -1;
+	}
+
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size))) {
+		perror("setsockopt(SOL_XDP)");
+		return -1;
+	}
+
+	if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+		perror("XDP_MMAP_OFFSETS");
+		return -1;
+	}
+
+	if (ring_map(xsk->fd, &xsk->fill, &off.fr, sizeof(uint64_t),
+		     XDP_UMEM_PGOFF_FILL_RING, true) ||
+	    ring_map(xsk->fd, &xsk->comp, &off.cr, sizeof(uint64_t),
+		     XDP_UMEM_PGOFF_COMPLETION_RING, false) ||
+	    ring_map(xsk->fd, &xsk->rx, &off.rx, sizeof(struct xdp_desc),
+		     XDP_PGOFF_RX_RING, false) ||
+	    ring_map(xsk->fd, &xsk->tx, &off.tx, sizeof(struct xdp_desc),
+		     XDP_PGOFF_TX_RING, true))
+		return -1;
+
+	if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		perror(copy ? "bind(XDP_COPY)" : "bind(XDP_ZEROCOPY)");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * XSKMAP plus the program
+ *
+ *	return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ * attached in driver mode through a BPF link, which goes away with
+ * the process. Returns the link fd.
+ */
+static int xdp_attach(int ifindex, int queue, int xsk_fd)
+{
+	union bpf_attr attr;
+	char log[4096] = "";
+	int map_fd, prog_fd, link_fd;
+	uint32_t key = queue;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = 64;
+	map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (map_fd < 0) {
+		perror("BPF_MAP_CREATE");
+		return -1;
+	}
+
+	struct bpf_insn insns[] = {
+		// r2 = ctx->rx_queue_index
+		{ .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2,
+		  .src_reg = BPF_REG_1,
+		  .off = offsetof(struct xdp_md, rx_queue_index) },
+		// r1 = &xsks (two instruction immediate load)
+		{ .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+		  .src_reg = BPF_PSEUDO_MAP_FD, .imm = map_fd },
+		{ 0 },
+		// r3 = XDP_PASS, the action without a socket on the queue
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+		  .imm = XDP_PASS },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+	attr.license = (uintptr_t)"GPL";
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (prog_fd < 0) {
+		perror("BPF_PROG_LOAD");
+		fprintf(stderr, "%s", log);
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&xsk_fd;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+		perror("BPF_MAP_UPDATE_ELEM");
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+	link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (link_fd < 0) {
+		perror("BPF_LINK_CREATE");
+		return -1;
+	}
+
+	close(prog_fd);
+	close(map_fd);
+
+	return link_fd;
+}
+
+static uint16_t ip_csum(const void *data, size_t len)
+{
+	const uint16_t *p = data;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+// The UDP frame of txonly, 10.0.0.1:9 -> 10.0.0.2:9, broadcast MAC
+static void build_frame(char *frame, uint32_t size)
+{
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	struct iphdr *ip = (struct iphdr *)(eth + 1);
+	struct udphdr *udp = (struct udphdr *)(ip + 1);
+
+	memset(frame, 0, size);
+	memset(eth->h_dest, 0xff, ETH_ALEN);
+	memcpy(eth->h_source, "\x02\x00\x00\x00\x00\x01", ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_UDP;
+	ip->tot_len = htons(size - sizeof(*eth));
+	ip->saddr = htonl(0x0a000001);
+	ip->daddr = htonl(0x0a000002);
+	ip->check = ip_csum(ip, sizeof(*ip));
+
+	udp->source = htons(9);
+	udp->dest = htons(9);
+	udp->len = htons(size - sizeof(*eth) - sizeof(*ip));
+}
+
+static void kick_tx(struct xsk *xsk)
+{
+	if (ring_needs_wakeup(&xsk->tx))
+		sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+static void kick_rx(struct xsk *xsk)
+{
+	if (ring_needs_wakeup(&xsk->fill))
+		recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+// Completed TX frames go back to the free list, or to the fill ring
+static void complete_tx(struct xsk *xsk, bool to_fill, uint32_t batch)
+{
+	uint32_t i, n, idx_cq, idx_fq = 0;
+
+	if (!xsk->outstanding_tx)
+		return;
+
+	kick_tx(xsk);
+	n = ring_peek(&xsk->comp, batch, &idx_cq);
+	if (!n)
+		return;
+
+	if (to_fill) {
+		while (!ring_reserve(&xsk->fill, n, &idx_fq)) {
+			if (stop)
+				return;
+			kick_rx(xsk);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		uint64_t addr = *addr_at(&xsk->comp, idx_cq + i);
+
+		if (to_fill)
+			*addr_at(&xsk->fill, idx_fq + i) = addr;
+		else
+			xsk->free_frames[xsk->nr_free++] = addr;
+	}
+
+	if (to_fill)
+		ring_submit(&xsk->fill);
+	ring_release(&xsk->comp);
+	xsk->outstanding_tx -= n;
+	xsk->tx_pkts += n;
+}
+
+static void rx_drop(struct xsk *xsk, uint32_t batch)
+{
+	uint32_t i, n, idx_rx, idx_fq;
+
+	n = ring_peek(&xsk->rx, batch, &idx_rx);
+	if (!n) {
+		kick_rx(xsk);
+		return;
+	}
+
+	while (!ring_reserve(&xsk->fill, n, &idx_fq)) {
+		if (stop)
+			return;
+		kick_rx(xsk);
+	}
+	for (i = 0; i < n; i++)
+		*addr_at(&xsk->fill, idx_fq + i) = desc_at(&xsk->rx, idx_rx + i)->addr;
+
+	ring_submit(&xsk->fill);
+	ring_release(&xsk->rx);
+	xsk->rx_pkts += n;
+}
+
+static void tx_only(struct xsk *xsk, uint32_t batch, uint32_t pkt_size)
+{
+	uint32_t i, n, idx;
+
+	complete_tx(xsk, false, batch);
+
+	n = batch < xsk->nr_free ? batch : xsk->nr_free;
+	if (!n || !ring_reserve(&xsk->tx, n, &idx))
+		return;
+
+	for (i = 0; i < n; i++) {
+		struct xdp_desc *desc = desc_at(&xsk->tx, idx + i);
+
+		desc->addr = xsk->free_frames[--xsk->nr_free];
+		desc->len = pkt_size;
+		desc->options = 0;
+	}
+
+	ring_submit(&xsk->tx);
+	xsk->outstanding_tx += n;
+	kick_tx(xsk);
+}
+
+static void l2fwd(struct xsk *xsk, uint32_t batch)
+{
+	uint32_t i, n, idx_rx, idx_tx;
+	uint8_t tmp[ETH_ALEN];
+
+	complete_tx(xsk, true, batch);
+
+	n = ring_peek(&xsk->rx, batch, &idx_rx);
+	if (!n) {
+		kick_rx(xsk);
+		return;
+	}
+
+	while (!ring_reserve(&xsk->tx, n, &idx_tx)) {
+		if (stop)
+			return;
+		complete_tx(xsk, true, batch);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct xdp_desc *rx = desc_at(&xsk->rx, idx_rx + i);
+		struct xdp_desc *tx = desc_at(&xsk->tx, idx_tx + i);
+		struct ethhdr *eth = (struct ethhdr *)(xsk->umem + rx->addr);
+
+		memcpy(tmp, eth->h_dest, ETH_ALEN);
+		memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+		memcpy(eth->h_source, tmp, ETH_ALEN);
+
+		tx->addr = rx->addr;
+		tx->len = rx->len;
+		tx->options = 0;
+	}
+
+	ring_submit(&xsk->tx);
+	ring_release(&xsk->rx);
+	xsk->outstanding_tx += n;
+	xsk->rx_pkts += n;
+	kick_tx(xsk);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -i ifname [-q queue] [-m rxdrop|txonly|l2fwd]\n"
+		"\t[-s pkt_size] [-d seconds] [-b batch] [-c]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t batch = 64, pkt_size = 64, duration = 10, queue = 0, i, idx;
+	uint64_t start, last, now, last_rx = 0, last_tx = 0;
+	static struct xsk xsk;
+	const char *ifname = NULL;
+	enum mode mode = MODE_RXDROP;
+	bool copy = false;
+	int ifindex, link_fd = -1, opt;
+
+	while ((opt = getopt(argc, argv, "i:q:m:s:d:b:c")) != -1) {
+		switch (opt) {
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'q':
+			queue = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "rxdrop"))
+				mode = MODE_RXDROP;
+			else if (!strcmp(optarg, "txonly"))
+				mode = MODE_TXONLY;
+			else if (!strcmp(optarg, "l2fwd"))
+				mode = MODE_L2FWD;
+			else
+				usage(argv[0]);
+			break;
+		case 's':
+			pkt_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			copy = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!ifname)
+		usage(argv[0]);
+	if (pkt_size < 60 || pkt_size > FRAME_SIZE || !batch || batch > MAX_BATCH) {
+		fprintf(stderr, "pkt_size 60..%d, batch 1..%d\n", FRAME_SIZE, MAX_BATCH);
+		return EXIT_FAILURE;
+	}
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex) {
+		perror(ifname);
+		return EXIT_FAILURE;
+	}
+
+	if (xsk_create(&xsk, ifindex, queue, copy))
+		return EXIT_FAILURE;
+
+	// The first half of the umem feeds the fill ring, the rest is for TX
+	if (!ring_reserve(&xsk.fill, RING_SIZE, &idx))
+		return EXIT_FAILURE;
+	for (i = 0; i < RING_SIZE; i++)
+		*addr_at(&xsk.fill, idx + i) = (uint64_t)i * FRAME_SIZE;
+	ring_submit(&xsk.fill);
+
+	for (i = RING_SIZE; i < NUM_FRAMES; i++) {
+		build_frame(xsk.umem + (uint64_t)i * FRAME_SIZE, pkt_size);
+		xsk.free_frames[xsk.nr_free++] = (uint64_t)i * FRAME_SIZE;
+	}
+
+	if (mode != MODE_TXONLY) {
+		link_fd = xdp_attach(ifindex, queue, xsk.fd);
+		if (link_fd < 0)
+			return EXIT_FAILURE;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	printf("%s queue %u, %s, %s mode, %u byte frames, batch %u\n", ifname,
+		queue, mode == MODE_RXDROP ? "rxdrop" :
+		mode == MODE_TXONLY ? "txonly" : "l2fwd",
+		copy ? "copy" : "zero-copy", pkt_size, batch);
+	printf("%8s %14s %14s\n", "sec", "rx pps", "tx pps");
+
+	start = last = now_ns();
+	while (!stop) {
+		switch (mode) {
+		case MODE_RXDROP:
+			rx_drop(&xsk, batch);
+			break;
+		case MODE_TXONLY:
+			tx_only(&xsk, batch, pkt_size);
+			break;
+		case MODE_L2FWD:
+			l2fwd(&xsk, batch);
+			break;
+		}
+
+		now = now_ns();
+		if (now - last < 1000000000ull)
+			continue;
+
+		printf("%8.1f %14.0f %14.0f\n", (now - start) / 1e9,
+			(xsk.rx_pkts - last_rx) * 1e9 / (now - last),
+			(xsk.tx_pkts - last_tx) * 1e9 / (now - last));
+		fflush(stdout);
+		last_rx = xsk.rx_pkts;
+		last_tx = xsk.tx_pkts;
+		last = now;
+
+		if (duration && now - start >= duration * 1000000000ull)
+			break;
+	}
+
+	now = now_ns();
+	printf("total: %lu rx, %lu tx packets, %.0f rx pps, %.0f tx pps\n",
+		(unsigned long)xsk.rx_pkts, (unsigned long)xsk.tx_pkts,
+		xsk.rx_pkts * 1e9 / (now - start), xsk.tx_pkts * 1e9 / (now - start));
+
+	if (link_fd >= 0)
+		close(link_fd);
+	close(xsk.fd);
+
+	return 0;
+}
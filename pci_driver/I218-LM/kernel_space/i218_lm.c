@@ -2,13 +2,47 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/pci_ids.h>
-#include <linux/io.h>		// for ioremap, ioread32, iowrite32
+#include <linux/io.h>		// for ioremap, ioread32, memcpy_fromio
 #include <linux/pci.h>		// for PCI device support
+#include <linux/ktime.h>
+#include <linux/printk.h>	// print_hex_dump
+#include <linux/platform_device.h>	// the mock adapters
+#include <linux/vmalloc.h>
+#include <linux/idr.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>		// the mock's interrupt descriptors
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/if_ether.h>	// ETH_ZLEN
+#include <linux/pm_runtime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/hash.h>
+#include <linux/sort.h>
+#include <linux/timex.h>	// get_cycles
+#ifdef CONFIG_X86
+#include <asm/msr.h>		// rdtsc_ordered
+#endif
+
+#define DRIVER_NAME "i218_lm"
+#define MOCK_NAME "i218_lm_mock"
+#define MOCK_VF_NAME "i218_lm_mock_vf"
 
 // Determined by: lspci -xxx -s 00:19.0
-#define PCI_VENDOR_ID_INTEL 0x8086	// Vendor ID
 #define PCI_DEVICE_ID_I218  0x155A	// Example device ID for Intel I218-LM
 
+// The rest of the I218 family, same register layout
+#define PCI_DEVICE_ID_I218_V	0x1559
+#define PCI_DEVICE_ID_I218_LM2	0x15A0
+#define PCI_DEVICE_ID_I218_V2	0x15A1
+#define PCI_DEVICE_ID_I218_LM3	0x15A2
+#define PCI_DEVICE_ID_I218_V3	0x15A3
+
 /*
  * 00:19.0 Ethernet controller: Intel Corporation Ethernet
  * Connection I218-LM (rev 04)
@@ -18,184 +52,2884 @@
  *	Region 0: Memory at d0800000 (32-bit, non-prefetchable) [size=128K]
  *	Region 1: Memory at d083e000 (32-bit, non-prefetchable) [size=4K]
  *	Region 2: I/O ports at 4080 [size=32]
+ *
+ * The device normally belongs to e1000e. To hand it to this driver:
+ *
+ *	echo 0000:00:19.0 > /sys/bus/pci/drivers/e1000e/unbind
+ *	echo 0000:00:19.0 > /sys/bus/pci/drivers/i218_lm/bind
+ *
+ * Without the hardware, mock=N creates N stand-in adapters: platform
+ * devices whose BARs are plain memory, driven by the same code.
  */
 
-/*
- * PCI_STD_RESOURCE_END: This constant is used
- * to iterate over the standard BAR resources,
- * typically ranging from 0 to 5 for most devices.
- */
-#define PCI_STD_RESOURCE_END 5
+// Control registers of BAR0, the e1000e layout
+#define I218_CTRL	0x0000
+#define I218_CTRL_EXT	0x0018
+#define I218_ITR	0x00C4	// interrupt throttling
+
+// Interrupt registers of BAR0
+#define I218_ICR	0x00C0	// cause, read to clear
+#define I218_ICS	0x00C8	// cause set, raises the interrupt
+#define I218_IMS	0x00D0	// mask set
+#define I218_IMC	0x00D8	// mask clear
+#define I218_ICR_RXSEQ	BIT(3)	// what the e1000e MSI self test sets
+
+// Ring registers of queue n
+#define I218_RDBAL(n)	(0x02800 + (n) * 0x100)
+#define I218_RDBAH(n)	(0x02804 + (n) * 0x100)
+#define I218_RDLEN(n)	(0x02808 + (n) * 0x100)
+#define I218_RDH(n)	(0x02810 + (n) * 0x100)
+#define I218_RDT(n)	(0x02818 + (n) * 0x100)
+#define I218_TDBAL(n)	(0x03800 + (n) * 0x100)
+#define I218_TDBAH(n)	(0x03804 + (n) * 0x100)
+#define I218_TDLEN(n)	(0x03808 + (n) * 0x100)
+#define I218_TDH(n)	(0x03810 + (n) * 0x100)
+#define I218_TDT(n)	(0x03818 + (n) * 0x100)
+
+// Legacy descriptors, 16 bytes each
+struct i218_tx_desc {
+	__le64 addr;
+	__le16 length;
+	u8 cso;
+	u8 cmd;
+	u8 status;
+	u8 css;
+	__le16 special;
+};
+
+#define I218_TXD_CMD_EOP	BIT(0)
+#define I218_TXD_CMD_IFCS	BIT(1)
+#define I218_TXD_CMD_RS		BIT(3)	// report status: write back DD
+#define I218_TXD_STAT_DD	BIT(0)
+
+struct i218_rx_desc {
+	__le64 addr;
+	__le16 length;
+	__le16 csum;
+	u8 status;
+	u8 errors;
+	__le16 special;
+};
+
+#define I218_RXD_STAT_DD	BIT(0)
+#define I218_RXD_STAT_EOP	BIT(1)
+
+// One frame buffer, TX or RX
+#define I218_LM_BUF_LEN		2048
 
 // Show first 64 bytes from mapped MMIO space
 #define SPACE_SIZE 64
 
-void	*mapped_addr;
+// 32-bit registers read from the start of every BAR
+#define TOP_REGS 4
+
+// Rounds of each dump method in the timing comparison, 0 = skip it
+static unsigned int bench_iterations = 100;
+module_param(bench_iterations, uint, 0444);
+MODULE_PARM_DESC(bench_iterations, "Timed rounds per dump method at probe (0 = none)");
+
+// Devices to bind, whatever their IDs, instead of the whole id_table
+#define I218_LM_MAX_BDF 8
+static char *bdf[I218_LM_MAX_BDF];
+static int nr_bdf;
+module_param_array(bdf, charp, &nr_bdf, 0444);
+MODULE_PARM_DESC(bdf, "Bind only these devices, e.g. bdf=0000:00:19.0,03:00.0");
+
+static unsigned int mock;
+module_param(mock, uint, 0444);
+MODULE_PARM_DESC(mock, "Stand-in adapters to create, no hardware needed");
+
+// Vectors to ask for, one per queue
+#define I218_LM_MAX_QUEUES 8
+static unsigned int num_queues;
+// The queues of an adapter are one pool, a VF takes at least one
+#define I218_LM_MAX_VFS (I218_LM_MAX_QUEUES - 1)
+module_param(num_queues, uint, 0444);
+MODULE_PARM_DESC(num_queues, "Interrupt vectors, one per queue (0 = one per CPU, at most 8)");
+
+static unsigned int ring_size = 256;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Descriptors per ring, power of 2, 64..4096");
+
+static unsigned int autosuspend_ms = 2000;
+module_param(autosuspend_ms, uint, 0444);
+MODULE_PARM_DESC(autosuspend_ms, "Idle time before the adapter is runtime suspended, ms");
+
+static unsigned int trace_entries = 4096;
+module_param(trace_entries, uint, 0444);
+MODULE_PARM_DESC(trace_entries, "MMIO trace entries per CPU, power of 2");
+
+// The BARs of a mock adapter, sized like those of the I218-LM
+#define I218_LM_MOCK_BAR0_LEN	SZ_128K
+#define I218_LM_MOCK_BAR1_LEN	SZ_4K
+#define I218_LM_MOCK_VF_BAR0_LEN	SZ_16K	// a VF has its rings only
+
+enum i218_lm_irq_mode {
+	I218_LM_IRQ_MSIX,
+	I218_LM_IRQ_MSI,
+	I218_LM_IRQ_INTX,
+	I218_LM_IRQ_MOCK,
+};
+
+static const char * const i218_lm_irq_modes[] = {
+	[I218_LM_IRQ_MSIX] = "msix",
+	[I218_LM_IRQ_MSI] = "msi",
+	[I218_LM_IRQ_INTX] = "intx",
+	[I218_LM_IRQ_MOCK] = "mock",
+};
+
+// Latency of the software triggered interrupts and of PM, in ns
+struct i218_lm_lat {
+	u64 n;
+	u64 min;
+	u64 max;
+	u64 sum;
+};
+
+struct i218_lm_vector {
+	struct i218_lm_priv *priv;
+	int idx;
+	int irq;
+	const struct cpumask *affinity;	// NULL: wherever the line goes
+	char name[24];
+
+	// Written by this vector's handlers only
+	unsigned long hardirqs;
+	unsigned long threads;
+	unsigned long spurious;		// shared INTx, not ours
+	unsigned int last_cpu;
+
+	// irq_test
+	bool testing;
+	u64 t_trigger;
+	u64 t_hard;
+	struct completion done;
+	struct i218_lm_lat hard_lat;	// trigger to hard handler
+	struct i218_lm_lat thread_lat;	// trigger to threaded handler
+
+	struct i218_lm_ring *ring;	// NULL: no ring on this vector
+};
+
+// Outcome of ring_bench on one ring
+struct i218_lm_bench_res {
+	u64 frames;
+	unsigned int len;
+	u64 ns;
+	u64 doorbells;			// TX and RX tail writes
+	u64 irqs;
+	u64 missed;			// no RX buffer posted
+	int err;
+};
+
+/*
+ * The counters run freely, the slot is counter & (count - 1). tx_ntu
+ * is written by the poster, tx_ntc by the cleaner (the threaded IRQ
+ * handler), the RX side is the cleaner's alone.
+ */
+struct i218_lm_ring {
+	struct i218_lm_priv *priv;
+	struct i218_lm_vector *vec;
+	int idx;
+	u32 count;
+	u32 batch;			// frames per doorbell
+
+	struct i218_tx_desc *tx_desc;	// coherent
+	dma_addr_t tx_dma;
+	void **tx_buf;
+	dma_addr_t *tx_buf_dma;		// mapped while posted
+	u32 tx_ntu;
+	u32 tx_ntc;
+	u32 tx_pending;			// posted since the last doorbell
+	u64 tx_frames;			// completed
+	u64 tx_doorbells;
+
+	struct i218_rx_desc *rx_desc;	// coherent
+	dma_addr_t rx_dma;
+	void **rx_buf;
+	dma_addr_t *rx_buf_dma;		// mapped for the life of the ring
+	u32 rx_ntu;
+	u32 rx_ntc;
+	u32 rx_pending;
+	u64 rx_frames;
+	u64 rx_bytes;
+	u64 rx_doorbells;
+
+	wait_queue_head_t wq;		// ring_bench waits for completions
+
+	// The software device model, mock adapters only
+	struct work_struct model_work;
+	u32 model_tdh;
+	u32 model_rdh;
+	u64 model_missed;
+
+	struct completion bench_done;
+	struct i218_lm_bench_res res;
+};
+
+// One per bound adapter, the BARs are mapped once at probe
+struct i218_lm_priv {
+	struct device *dev;		// of the PCI or the mock device
+	struct pci_dev *pdev;		// NULL on a mock adapter
+	int id;				// i218_lm<id> in the log
+	void __iomem *bar[PCI_STD_NUM_BARS];	// NULL: I/O or unused BAR
+	resource_size_t bar_len[PCI_STD_NUM_BARS];
+
+	enum i218_lm_irq_mode irq_mode;
+	int nr_vectors;
+	struct i218_lm_vector *vectors;
+	int mock_irq_base;		// mock: first of nr_vectors descs
+	struct mutex test_lock;		// one irq_test, ring_bench or pm_cycle
+
+	int nr_rings;
+	struct i218_lm_ring *rings;
+
+	// Registers kept over a suspend, restored in this order
+	int pm_nr_regs;
+	u32 *pm_offs;
+	u32 *pm_saved;
+	u32 pm_ims;			// IMS goes back last
+	bool suspended;			// BAR0 not to be touched
+	bool pm_started;		// the probe reference dropped
+	struct i218_lm_lat pm_suspend;	// the save
+	struct i218_lm_lat pm_resume;	// the restore
+	struct i218_lm_lat pm_wake;	// asleep to usable, PCI core included
+	unsigned long pm_restore_errors;
+
+	// SR-IOV: a PF shares out its queue pool, a VF runs on one share
+	struct i218_lm_priv *pf;	// VF: its PF, NULL on a PF
+	int vf;				// VF: index under the PF
+	unsigned int vf_queues;		// the queues of each VF
+	struct mutex sriov_lock;	// PF: one enable or disable at a time
+	int num_vfs;
+	struct platform_device *mock_vfs[I218_LM_MAX_VFS];
+	struct mutex vf_lock;		// PF: vfs[] and sriov_bench
+	struct i218_lm_priv *vfs[I218_LM_MAX_VFS];	// bound VFs
+	struct i218_lm_sriov_res {
+		int functions;
+		int rings;
+		u64 frames;
+		u64 ns;
+	} sriov_res;
+};
+
+// What a mock VF gets from its PF, as platform data
+struct i218_lm_vf_info {
+	struct i218_lm_priv *pf;
+	int vf;
+	unsigned int queues;
+};
+
+// bdf= parsed once at load
+struct i218_lm_bdf {
+	u32 domain;
+	u32 bus;
+	u32 devfn;
+};
+
+static struct i218_lm_bdf bdf_list[I218_LM_MAX_BDF];
+static DEFINE_IDA(i218_lm_ida);
+static struct platform_device **mock_devs;
+static struct workqueue_struct *model_wq;	// device model of the mocks
+static struct pci_driver i218_lm_driver;	// VF dynamic IDs go to it
+
+static void i218_lm_lat_add(struct i218_lm_lat *lat, u64 ns)
+{
+	if (!lat->n || ns < lat->min)
+		lat->min = ns;
+	if (ns > lat->max)
+		lat->max = ns;
+	lat->sum += ns;
+	lat->n++;
+}
+
+/*
+ * MMIO tracing. Every register access of the driver goes through the
+ * accessors below. With tracing on (debugfs i218_lm/enable) each one
+ * is timed in TSC cycles and recorded on its CPU: in a ring of the
+ * last trace_entries accesses and in a histogram per register. The
+ * writer owns its CPU's buffers with interrupts off, there are no
+ * locks; readers on other CPUs check the seq of every entry. Off, an
+ * access costs a patched out jump.
+ */
+struct i218_lm_trace_ent {
+	u64 cycles;
+	u32 off;
+	u32 val;
+	u32 seq;			// i218_lm_trace_seq(), written last; 0 = empty
+	u16 id;				// i218_lm<id>
+	u8 bar;				// BAR, I218_LM_TRACE_WRITE
+	u8 width;			// bytes
+};
+
+#define I218_LM_TRACE_WRITE	BIT(7)
+
+// Log2 buckets of cycles, the last one takes the rest
+#define I218_LM_HIST_BUCKETS	24
+#define I218_LM_HIST_BITS	7
+#define I218_LM_HIST_SLOTS	BIT(I218_LM_HIST_BITS)
+
+struct i218_lm_hist_ent {
+	u64 key;			// 0 = free
+	u64 n;
+	u64 sum;
+	u64 max;
+	u32 buckets[I218_LM_HIST_BUCKETS];
+};
+
+struct i218_lm_trace_cpu {
+	u32 head;			// next slot, runs freely
+	u64 hist_full;			// accesses with no histogram slot
+	struct i218_lm_trace_ent *ring;
+	struct i218_lm_hist_ent *hist;
+};
+
+static DEFINE_STATIC_KEY_FALSE(i218_lm_tracing);
+static DEFINE_MUTEX(trace_mutex);	// enable and the readers
+static struct i218_lm_trace_cpu __percpu *trace_cpu;	// on first enable
+static struct dentry *trace_dir;
+
+// Ordered, so the access is inside the two stamps
+static u64 i218_lm_cycles(void)
+{
+#ifdef CONFIG_X86
+	return rdtsc_ordered();
+#else
+	return get_cycles();
+#endif
+}
+
+static u64 i218_lm_trace_key(u16 id, u8 bar, u8 width, u32 off)
+{
+	return BIT_ULL(63) | (u64)id << 40 | (u64)bar << 32 |
+	       (u64)width << 24 | off;
+}
+
+// Never 0, which is an empty entry, not even once head wraps
+static u32 i218_lm_trace_seq(u32 slot)
+{
+	return slot + 1 ?: 1;
+}
+
+/*
+ * The whole record runs with interrupts off, an RCU read side section:
+ * disabling tracing waits for it with synchronize_rcu(), and the key
+ * is checked again in here for an access that saw it on before.
+ */
+static void i218_lm_trace(struct i218_lm_priv *priv, u8 bar, u32 off,
+			  u8 width, u32 val, u64 cycles)
+{
+	struct i218_lm_trace_cpu *tc;
+	struct i218_lm_trace_ent *e;
+	struct i218_lm_hist_ent *h = NULL;
+	u64 key = i218_lm_trace_key(priv->id, bar, width, off);
+	unsigned long flags;
+	u32 slot, i, hash;
+
+	local_irq_save(flags);
+	if (!static_branch_unlikely(&i218_lm_tracing))
+		goto out;
+	tc = this_cpu_ptr(trace_cpu);
+
+	slot = tc->head++;
+	e = &tc->ring[slot & (trace_entries - 1)];
+	WRITE_ONCE(e->seq, 0);
+	smp_wmb();
+	e->cycles = cycles;
+	e->off = off;
+	e->val = val;
+	e->id = priv->id;
+	e->bar = bar;
+	e->width = width;
+	smp_store_release(&e->seq, i218_lm_trace_seq(slot));
+
+	hash = hash_64(key, I218_LM_HIST_BITS);
+	for (i = 0; i < I218_LM_HIST_SLOTS; i++) {
+		h = &tc->hist[(hash + i) & (I218_LM_HIST_SLOTS - 1)];
+		if (h->key == key || !h->key)
+			break;
+	}
+	if (i < I218_LM_HIST_SLOTS) {
+		h->key = key;
+		h->n++;
+		h->sum += cycles;
+		if (cycles > h->max)
+			h->max = cycles;
+		h->buckets[min(fls64(cycles), I218_LM_HIST_BUCKETS - 1)]++;
+	} else {
+		tc->hist_full++;
+	}
+
+out:
+	local_irq_restore(flags);
+}
+
+// addr in a mapping of BAR bar at off, the BAR's own or a temporary one
+static u8 i218_lm_rd8_at(struct i218_lm_priv *priv, int bar, u32 off,
+			 void __iomem *addr)
+{
+	u64 t0;
+	u8 val;
+
+	if (!static_branch_unlikely(&i218_lm_tracing))
+		return ioread8(addr);
+
+	t0 = i218_lm_cycles();
+	val = ioread8(addr);
+	i218_lm_trace(priv, bar, off, 1, val, i218_lm_cycles() - t0);
+
+	return val;
+}
+
+static u8 i218_lm_bar_rd8(struct i218_lm_priv *priv, int bar, u32 off)
+{
+	return i218_lm_rd8_at(priv, bar, off, priv->bar[bar] + off);
+}
+
+static u32 i218_lm_bar_rd32(struct i218_lm_priv *priv, int bar, u32 off)
+{
+	u64 t0;
+	u32 val;
+
+	if (!static_branch_unlikely(&i218_lm_tracing))
+		return ioread32(priv->bar[bar] + off);
+
+	t0 = i218_lm_cycles();
+	val = ioread32(priv->bar[bar] + off);
+	i218_lm_trace(priv, bar, off, 4, val, i218_lm_cycles() - t0);
+
+	return val;
+}
+
+// len bytes from the start of the BAR: one entry, the first dword as value
+static void i218_lm_bar_copy(struct i218_lm_priv *priv, int bar, u8 *buf,
+			     size_t len)
+{
+	u32 first;
+	u64 t0;
+
+	if (!static_branch_unlikely(&i218_lm_tracing)) {
+		memcpy_fromio(buf, priv->bar[bar], len);
+		return;
+	}
+
+	t0 = i218_lm_cycles();
+	memcpy_fromio(buf, priv->bar[bar], len);
+	memcpy(&first, buf, sizeof(first));
+	i218_lm_trace(priv, bar, 0, len, first, i218_lm_cycles() - t0);
+}
+
+// BAR0 registers, what the rest of the driver uses
+static u32 i218_lm_rd32(struct i218_lm_priv *priv, u32 reg)
+{
+	return i218_lm_bar_rd32(priv, 0, reg);
+}
+
+static void i218_lm_wr32(struct i218_lm_priv *priv, u32 reg, u32 val)
+{
+	u64 t0;
+
+	if (!static_branch_unlikely(&i218_lm_tracing)) {
+		iowrite32(val, priv->bar[0] + reg);
+		return;
+	}
 
-// Target PCI device's bus, device, and function numbers
-#define TARGET_BUS 0
-#define TARGET_DEVICE 0x19
-#define TARGET_FUNCTION 0
+	// Posted: the CPU's cost, not the device's
+	t0 = i218_lm_cycles();
+	iowrite32(val, priv->bar[0] + reg);
+	i218_lm_trace(priv, I218_LM_TRACE_WRITE, reg, 4, val,
+		      i218_lm_cycles() - t0);
+}
 
 // Acess the configuration space of the PCI device
-static int if_pdev_matches(struct pci_dev *pdev)
+static void i218_lm_show_config(struct pci_dev *pdev)
 {
 	u16	vendor_id, device_id;
 	u8	revision_id;
 	u32	bar0;
 
-	// pr_info("pdev at address 0x%p", pdev);
-	if ((TARGET_BUS == pdev->bus->number) &&
-		(TARGET_DEVICE == PCI_SLOT(pdev->devfn)) &&
-		(TARGET_FUNCTION == PCI_FUNC(pdev->devfn))) {
+	// Read Vendor ID and Device ID
+	pci_read_config_word(pdev, PCI_VENDOR_ID, &vendor_id);
+	pci_read_config_word(pdev, PCI_DEVICE_ID, &device_id);
 
-		pr_info("Found PCI device at %02x:%02x.%x",
-			TARGET_BUS, TARGET_DEVICE, TARGET_FUNCTION);
+	dev_info(&pdev->dev, "Vendor ID: 0x%x, Device ID: 0x%x", vendor_id,
+		 device_id);
 
-		// Read Vendor ID and Device ID
-		pci_read_config_word(pdev, PCI_VENDOR_ID, &vendor_id);
-		pci_read_config_word(pdev, PCI_DEVICE_ID, &device_id);
+	// Read Revision ID (offset 0x08)
+	pci_read_config_byte(pdev, PCI_REVISION_ID, &revision_id);
+	dev_info(&pdev->dev, "Revision ID: 0x%x", revision_id);
+
+	// Read Base Address Register 0 (BAR0) (offset 0x10)
+	pci_read_config_dword(pdev, PCI_BASE_ADDRESS_0, &bar0);
+	dev_info(&pdev->dev, "Lowest BAR0 is at 0x%x PHY address", bar0);
+}
 
-		pr_info("Vendor ID: 0x%x, Device ID: 0x%x", vendor_id, device_id);
+// The whole window in one go, then a hex dump from the copy
+static void i218_lm_dump_bar(struct i218_lm_priv *priv, int bar)
+{
+	u8 buf[SPACE_SIZE];
+	char prefix[24];
+	int i;
 
-		// Read Revision ID (offset 0x08)
-		pci_read_config_byte(pdev, PCI_REVISION_ID, &revision_id);
-		pr_info("Revision ID: 0x%x", revision_id);
+	// Several adapters dump at once with async probing, tag every line
+	snprintf(prefix, sizeof(prefix), "i218_lm%d BAR%d: ", priv->id, bar);
+	i218_lm_bar_copy(priv, bar, buf, SPACE_SIZE);
+	print_hex_dump(KERN_INFO, prefix, DUMP_PREFIX_OFFSET, 16, 1, buf,
+		       SPACE_SIZE, false);
 
-		// Read Base Address Register 0 (BAR0) (offset 0x10)
-		pci_read_config_dword(pdev, PCI_BASE_ADDRESS_0, &bar0);
-		pr_info("Lowest BAR0 is at 0x%x PHY address", bar0);
+	// Read designated 32-bit values from the MMIO region
+	for (i = 0; i < TOP_REGS; i++)
+		dev_info(priv->dev, "BAR%d register 0x%02x: 0x%08x", bar, i * 4,
+			 i218_lm_bar_rd32(priv, bar, i * 4));
+}
 
-		return 0;
+/*
+ * What the dump used to cost: one ioremap()/iounmap() pair, with its
+ * page table update and TLB flush, for every byte
+ */
+static int i218_lm_dump_remap(struct i218_lm_priv *priv, int bar, u8 *buf)
+{
+	resource_size_t start = pci_resource_start(priv->pdev, bar);
+	void __iomem *addr;
+	int i;
+
+	for (i = 0; i < SPACE_SIZE; i++) {
+		addr = ioremap(start + i, SPACE_SIZE - i);
+		if (!addr)
+			return -ENOMEM;
+		buf[i] = i218_lm_rd8_at(priv, bar, i, addr);
+		iounmap(addr);
+	}
+
+	return 0;
+}
+
+static void i218_lm_dump_ioread8(struct i218_lm_priv *priv, int bar, u8 *buf)
+{
+	int i;
+
+	for (i = 0; i < SPACE_SIZE; i++)
+		buf[i] = i218_lm_bar_rd8(priv, bar, i);
+}
+
+/*
+ * ns per dump with the per-byte remap, byte reads and memcpy_fromio.
+ * A mock BAR has no bus address to remap, that column reads 0.
+ */
+static void i218_lm_bench(struct i218_lm_priv *priv, int bar)
+{
+	u64 t0, remap_ns = 0, read8_ns, memcpy_ns;
+	u8 buf[SPACE_SIZE];
+	unsigned int i;
+
+	if (!bench_iterations)
+		return;
+
+	if (priv->pdev) {
+		t0 = ktime_get_ns();
+		for (i = 0; i < bench_iterations; i++)
+			if (i218_lm_dump_remap(priv, bar, buf))
+				return;
+		remap_ns = ktime_get_ns() - t0;
+	}
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < bench_iterations; i++)
+		i218_lm_dump_ioread8(priv, bar, buf);
+	read8_ns = ktime_get_ns() - t0;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < bench_iterations; i++)
+		i218_lm_bar_copy(priv, bar, buf, SPACE_SIZE);
+	memcpy_ns = ktime_get_ns() - t0;
+
+	dev_info(priv->dev, "BAR%d %d byte dump: ioremap per byte %llu ns, ioread8 %llu ns, memcpy_fromio %llu ns",
+		 bar, SPACE_SIZE, div_u64(remap_ns, bench_iterations),
+		 div_u64(read8_ns, bench_iterations),
+		 div_u64(memcpy_ns, bench_iterations));
+}
+
+static void i218_lm_put_id(void *data)
+{
+	struct i218_lm_priv *priv = data;
+
+	ida_free(&i218_lm_ida, priv->id);
+}
+
+// Context shared by real and mock adapters, freed with the device
+static struct i218_lm_priv *i218_lm_alloc(struct device *dev)
+{
+	struct i218_lm_priv *priv;
+
+	priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return NULL;
+	priv->dev = dev;
+	mutex_init(&priv->test_lock);
+	mutex_init(&priv->sriov_lock);
+	mutex_init(&priv->vf_lock);
+
+	priv->id = ida_alloc(&i218_lm_ida, GFP_KERNEL);
+	if (priv->id < 0)
+		return NULL;
+	if (devm_add_action_or_reset(dev, i218_lm_put_id, priv))
+		return NULL;
+
+	return priv;
+}
+
+// Everything after the BARs are mapped, the same for both kinds
+static void i218_lm_setup(struct i218_lm_priv *priv)
+{
+	int bar;
+
+	for (bar = 0; bar < PCI_STD_NUM_BARS; bar++) {
+		if (!priv->bar[bar])
+			continue;
+		dev_info(priv->dev, "i218_lm%d: BAR%d mapped, %pa bytes",
+			 priv->id, bar, &priv->bar_len[bar]);
+		if (priv->bar_len[bar] >= SPACE_SIZE) {
+			i218_lm_dump_bar(priv, bar);
+			i218_lm_bench(priv, bar);
+		}
 	}
-	else
-		return -1;
 }
 
-static int __init I218_LM_driver_init(void)
+/*
+ * Descriptor rings, one TX/RX pair per vector. The descriptors live in
+ * coherent memory, the frame buffers are streaming mappings: a TX
+ * buffer is mapped while it is posted, an RX buffer for the life of
+ * the ring and synced around every frame. Posting only moves the
+ * software tail; the tail register (the doorbell) is written once per
+ * batch, as e1000e does with xmit_more.
+ */
+static u32 i218_lm_tx_free(struct i218_lm_ring *ring)
+{
+	return ring->count - 1 - (ring->tx_ntu - READ_ONCE(ring->tx_ntc));
+}
+
+static void i218_lm_model_kick(struct i218_lm_ring *ring)
+{
+	if (ring->priv->irq_mode == I218_LM_IRQ_MOCK)
+		queue_work(model_wq, &ring->model_work);
+}
+
+static void i218_lm_tx_doorbell(struct i218_lm_ring *ring)
+{
+	if (!ring->tx_pending)
+		return;
+
+	// Descriptors are visible before the device reads the tail
+	dma_wmb();
+	i218_lm_wr32(ring->priv, I218_TDT(ring->idx),
+		     ring->tx_ntu & (ring->count - 1));
+	ring->tx_pending = 0;
+	ring->tx_doorbells++;
+	i218_lm_model_kick(ring);
+}
+
+static void i218_lm_rx_doorbell(struct i218_lm_ring *ring)
 {
-	struct pci_dev	*pdev = NULL;
-	unsigned long	mem_start, addr_s;
-	unsigned long	mem_len;
-	int		i, ret_code, space_size;
-	int		top = 4;
+	if (!ring->rx_pending)
+		return;
 
-	// @ the beginning, iterate via all PCI
-	// devices to find the target device
-	for_each_pci_dev(pdev) {
-		if (0 == if_pdev_matches(pdev)) {
-			ret_code = 0;
+	dma_wmb();
+	i218_lm_wr32(ring->priv, I218_RDT(ring->idx),
+		     ring->rx_ntu & (ring->count - 1));
+	ring->rx_pending = 0;
+	ring->rx_doorbells++;
+	i218_lm_model_kick(ring);
+}
+
+// Post one frame of len bytes from the ring's own buffer
+static int i218_lm_xmit(struct i218_lm_ring *ring, unsigned int len)
+{
+	u32 i = ring->tx_ntu & (ring->count - 1);
+	struct i218_tx_desc *desc = &ring->tx_desc[i];
+	dma_addr_t dma;
+
+	if (!i218_lm_tx_free(ring))
+		return -EBUSY;
+
+	dma = dma_map_single(ring->priv->dev, ring->tx_buf[i], len,
+			     DMA_TO_DEVICE);
+	if (dma_mapping_error(ring->priv->dev, dma))
+		return -ENOMEM;
+	ring->tx_buf_dma[i] = dma;
+
+	desc->addr = cpu_to_le64(dma);
+	desc->length = cpu_to_le16(len);
+	desc->cmd = I218_TXD_CMD_EOP | I218_TXD_CMD_IFCS | I218_TXD_CMD_RS;
+	desc->status = 0;
+
+	// The cleaner reads tx_ntu without the bench thread's lock
+	smp_store_release(&ring->tx_ntu, ring->tx_ntu + 1);
+	if (++ring->tx_pending >= ring->batch)
+		i218_lm_tx_doorbell(ring);
+
+	return 0;
+}
+
+static void i218_lm_clean_tx(struct i218_lm_ring *ring)
+{
+	u32 ntc = ring->tx_ntc, ntu = smp_load_acquire(&ring->tx_ntu);
+	struct i218_tx_desc *desc;
+	u32 i, done = 0;
+
+	while (ntc != ntu) {
+		i = ntc & (ring->count - 1);
+		desc = &ring->tx_desc[i];
+		if (!(READ_ONCE(desc->status) & I218_TXD_STAT_DD))
 			break;
-		} else
-			ret_code = -1;
+		dma_rmb();
+		dma_unmap_single(ring->priv->dev, ring->tx_buf_dma[i],
+				 le16_to_cpu(desc->length), DMA_TO_DEVICE);
+		ntc++;
+		done++;
 	}
 
-	if (-1 == ret_code) {
-		pr_err("PCI device %02x:%02x.%x not found",
-			TARGET_BUS, TARGET_DEVICE, TARGET_FUNCTION);
+	if (done) {
+		smp_store_release(&ring->tx_ntc, ntc);
+		WRITE_ONCE(ring->tx_frames, ring->tx_frames + done);
+		wake_up(&ring->wq);
+	}
+}
 
-		return -ENODEV;
+/*
+ * A received frame is only counted, its buffer goes straight back to
+ * the ring. The tail moves every batch and once at the end of the pass.
+ */
+static void i218_lm_clean_rx(struct i218_lm_ring *ring)
+{
+	struct i218_rx_desc *desc;
+	unsigned int len;
+	u32 i, done = 0;
+
+	for (;;) {
+		i = ring->rx_ntc & (ring->count - 1);
+		desc = &ring->rx_desc[i];
+		if (!(READ_ONCE(desc->status) & I218_RXD_STAT_DD))
+			break;
+		dma_rmb();
+		len = le16_to_cpu(desc->length);
+		dma_sync_single_for_cpu(ring->priv->dev, ring->rx_buf_dma[i],
+					len, DMA_FROM_DEVICE);
+		ring->rx_bytes += len;
+		dma_sync_single_for_device(ring->priv->dev, ring->rx_buf_dma[i],
+					   len, DMA_FROM_DEVICE);
+		desc->status = 0;
+		ring->rx_ntc++;
+		done++;
+
+		ring->rx_ntu++;
+		if (++ring->rx_pending >= ring->batch)
+			i218_lm_rx_doorbell(ring);
 	}
+	i218_lm_rx_doorbell(ring);
 
-	// Find the PCI device
-	pdev = pci_get_device(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218, NULL);
-	if (!pdev) {
-		pr_err("PCI device not found");
-		return -ENODEV;
-	} else
-		pr_info("pdev at address 0x%p", pdev);
+	if (done) {
+		WRITE_ONCE(ring->rx_frames, ring->rx_frames + done);
+		wake_up(&ring->wq);
+	}
+}
 
-	/*
-	 * PCI devices can have multiple BARs, and not all
-	 * of them may be memory-mapped. Some might be I/O
-	 * ports, so it's important to check if the resource
-	 * is actually memory (IORESOURCE_MEM) before
-	 * processing.
-	 */
-	for (int bar_index = 0; bar_index < PCI_STD_RESOURCE_END; bar_index++) {
-		printk("\n");
-		if (pci_resource_flags(pdev, bar_index) & IORESOURCE_MEM) {
-			// Base address of BAR
-			addr_s = mem_start = pci_resource_start(pdev, bar_index);
-			// BAR size
-			mem_len = pci_resource_len(pdev, bar_index);
-
-			pr_info("Found BAR%x at 0x%lx, mapping %lu bytes",
-				bar_index, mem_start, mem_len);
-
-#if 1
-			// Print the MMIO region (hex dump)
-			space_size = SPACE_SIZE;
-			// printf("PCI Configuration Space for %s:\n", TARGET_BDF);
-			for (i = 0; i < SPACE_SIZE; i++) {
-				mapped_addr = ioremap(addr_s, space_size);
-				if (!mapped_addr) {
-					pr_err("ioremap region BAR%x failed", bar_index);
-					return -ENOMEM;
-				}
-
-				u8 reg_val8 = ioread8(mapped_addr);
-				if (0 == i % 16)
-					pr_info("0x%02x: ", i);
-
-				printk(KERN_CONT "%02x ", reg_val8);
-
-				// Unmap the current chunk after use
-				iounmap(mapped_addr);
-				mapped_addr = NULL;
-
-				// Move to the next chunk
-				addr_s += 1;
-				space_size -= 1;
-			}
-			printk("\n");
-#endif
+/*
+ * The software device model of a mock adapter: it reads the tail
+ * registers like the hardware, moves every posted TX frame into the
+ * next free RX buffer (dropping it when there is none), writes back
+ * the DD bits and the head registers, and raises one interrupt per
+ * pass. The model reaches the buffers through their CPU addresses,
+ * where a device would use the DMA addresses in the descriptors.
+ * It plays the device, so its register accesses are not traced.
+ */
+static void i218_lm_model_work(struct work_struct *work)
+{
+	struct i218_lm_ring *ring = container_of(work, struct i218_lm_ring,
+						 model_work);
+	void __iomem *bar0 = ring->priv->bar[0];
+	u32 mask = ring->count - 1;
+	struct i218_tx_desc *txd;
+	struct i218_rx_desc *rxd;
+	u32 tdt, rdt, done;
+	unsigned int len;
+
+	do {
+		tdt = readl(bar0 + I218_TDT(ring->idx)) & mask;
+		rdt = readl(bar0 + I218_RDT(ring->idx)) & mask;
+		dma_rmb();
 
-			// Read designated 32-bit values from the MMIO region
-			addr_s = mem_start;
-			space_size = SPACE_SIZE;
-			// addr_l = mem_len;
-			for (i=0; i < top; i++) {
-				// pr_info("mem_start 0x%lx, space_size %lu",
-				//	addr_s, space_size);
-				mapped_addr = ioremap(addr_s, space_size);
-				if (!mapped_addr) {
-					pr_err("ioremap region BAR%x failed", bar_index);
-					return -ENOMEM;
-				}
-
-				u32 reg_val32 = ioread32(mapped_addr);
-				pr_info("Read value from mapped_addr register %p: 0x%08x",
-					mapped_addr, reg_val32);
-
-				// Unmap the current chunk after use
-				iounmap(mapped_addr);
-				mapped_addr = NULL;
-
-				// Move to the next chunk
-				addr_s += 4;
-				space_size -= 4;
+		for (done = 0; ring->model_tdh != tdt; done++) {
+			txd = &ring->tx_desc[ring->model_tdh];
+			len = le16_to_cpu(txd->length);
+
+			if (ring->model_rdh != rdt) {
+				rxd = &ring->rx_desc[ring->model_rdh];
+				memcpy(ring->rx_buf[ring->model_rdh],
+				       ring->tx_buf[ring->model_tdh], len);
+				rxd->length = cpu_to_le16(len);
+				dma_wmb();
+				WRITE_ONCE(rxd->status,
+					   I218_RXD_STAT_DD | I218_RXD_STAT_EOP);
+				ring->model_rdh = (ring->model_rdh + 1) & mask;
+			} else {
+				WRITE_ONCE(ring->model_missed,
+					   ring->model_missed + 1);
 			}
-		} else {
-			pr_info("Highest BAR index is at BAR%x", bar_index - 1);
-			break;
+
+			dma_wmb();
+			WRITE_ONCE(txd->status, I218_TXD_STAT_DD);
+			ring->model_tdh = (ring->model_tdh + 1) & mask;
+		}
+
+		writel(ring->model_tdh, bar0 + I218_TDH(ring->idx));
+		writel(ring->model_rdh, bar0 + I218_RDH(ring->idx));
+		if (done)
+			generic_handle_irq_safe(ring->vec->irq);
+	} while (done);
+}
+
+static void i218_lm_rings_free(void *data)
+{
+	struct i218_lm_priv *priv = data;
+	struct i218_lm_ring *ring;
+	u32 i;
+	int r;
+
+	for (r = 0; r < priv->nr_rings; r++) {
+		ring = &priv->rings[r];
+		cancel_work_sync(&ring->model_work);
+
+		for (i = ring->tx_ntc; i != ring->tx_ntu; i++) {
+			u32 slot = i & (ring->count - 1);
+
+			dma_unmap_single(priv->dev, ring->tx_buf_dma[slot],
+					 le16_to_cpu(ring->tx_desc[slot].length),
+					 DMA_TO_DEVICE);
+		}
+		for (i = 0; i < ring->count; i++) {
+			if (ring->rx_buf_dma && ring->rx_buf_dma[i])
+				dma_unmap_single(priv->dev, ring->rx_buf_dma[i],
+						 I218_LM_BUF_LEN,
+						 DMA_FROM_DEVICE);
+			if (ring->rx_buf)
+				kfree(ring->rx_buf[i]);
+			if (ring->tx_buf)
+				kfree(ring->tx_buf[i]);
+		}
+	}
+}
+
+static int i218_lm_ring_alloc(struct i218_lm_ring *ring)
+{
+	struct device *dev = ring->priv->dev;
+	u32 i;
+
+	ring->tx_desc = dmam_alloc_coherent(dev, ring->count *
+					    sizeof(*ring->tx_desc),
+					    &ring->tx_dma, GFP_KERNEL);
+	ring->rx_desc = dmam_alloc_coherent(dev, ring->count *
+					    sizeof(*ring->rx_desc),
+					    &ring->rx_dma, GFP_KERNEL);
+	ring->tx_buf = devm_kcalloc(dev, ring->count, sizeof(void *),
+				    GFP_KERNEL);
+	ring->rx_buf = devm_kcalloc(dev, ring->count, sizeof(void *),
+				    GFP_KERNEL);
+	ring->tx_buf_dma = devm_kcalloc(dev, ring->count, sizeof(dma_addr_t),
+					GFP_KERNEL);
+	ring->rx_buf_dma = devm_kcalloc(dev, ring->count, sizeof(dma_addr_t),
+					GFP_KERNEL);
+	if (!ring->tx_desc || !ring->rx_desc || !ring->tx_buf ||
+	    !ring->rx_buf || !ring->tx_buf_dma || !ring->rx_buf_dma)
+		return -ENOMEM;
+
+	for (i = 0; i < ring->count; i++) {
+		ring->tx_buf[i] = kzalloc(I218_LM_BUF_LEN, GFP_KERNEL);
+		ring->rx_buf[i] = kzalloc(I218_LM_BUF_LEN, GFP_KERNEL);
+		if (!ring->tx_buf[i] || !ring->rx_buf[i])
+			return -ENOMEM;
+
+		ring->rx_buf_dma[i] = dma_map_single(dev, ring->rx_buf[i],
+						     I218_LM_BUF_LEN,
+						     DMA_FROM_DEVICE);
+		if (dma_mapping_error(dev, ring->rx_buf_dma[i])) {
+			ring->rx_buf_dma[i] = 0;
+			return -ENOMEM;
+		}
+		ring->rx_desc[i].addr = cpu_to_le64(ring->rx_buf_dma[i]);
+	}
+
+	return 0;
+}
+
+// Base, length, head and tail of both rings; all but one RX buffer posted
+static void i218_lm_ring_program(struct i218_lm_ring *ring)
+{
+	struct i218_lm_priv *priv = ring->priv;
+	int n = ring->idx;
+
+	i218_lm_wr32(priv, I218_TDBAL(n), lower_32_bits(ring->tx_dma));
+	i218_lm_wr32(priv, I218_TDBAH(n), upper_32_bits(ring->tx_dma));
+	i218_lm_wr32(priv, I218_TDLEN(n), ring->count * sizeof(*ring->tx_desc));
+	i218_lm_wr32(priv, I218_TDH(n), 0);
+	i218_lm_wr32(priv, I218_TDT(n), 0);
+
+	i218_lm_wr32(priv, I218_RDBAL(n), lower_32_bits(ring->rx_dma));
+	i218_lm_wr32(priv, I218_RDBAH(n), upper_32_bits(ring->rx_dma));
+	i218_lm_wr32(priv, I218_RDLEN(n), ring->count * sizeof(*ring->rx_desc));
+	i218_lm_wr32(priv, I218_RDH(n), 0);
+
+	ring->rx_ntu = ring->count - 1;
+	ring->rx_pending = 1;
+	i218_lm_rx_doorbell(ring);
+}
+
+/*
+ * A ring per vector on a mock adapter; the hardware gets queue 0 only,
+ * its registers are programmed but the MAC is left off.
+ */
+static int i218_lm_rings_init(struct i218_lm_priv *priv)
+{
+	struct i218_lm_ring *ring;
+	int r, ret;
+
+	if (!priv->bar[0])
+		return 0;
+
+	// The registers of the last ring, TDT the highest, must be in BAR0
+	r = priv->irq_mode == I218_LM_IRQ_MOCK ? priv->nr_vectors : 1;
+	if (I218_TDT(r - 1) + 4 > priv->bar_len[0])
+		return 0;
+
+	ret = dma_set_mask_and_coherent(priv->dev, DMA_BIT_MASK(64));
+	if (ret)
+		ret = dma_set_mask_and_coherent(priv->dev, DMA_BIT_MASK(32));
+	if (ret)
+		return ret;
+
+	priv->nr_rings = r;
+	priv->rings = devm_kcalloc(priv->dev, priv->nr_rings,
+				   sizeof(*priv->rings), GFP_KERNEL);
+	if (!priv->rings)
+		return -ENOMEM;
+
+	for (r = 0; r < priv->nr_rings; r++) {
+		ring = &priv->rings[r];
+		ring->priv = priv;
+		ring->vec = &priv->vectors[r];
+		ring->vec->ring = ring;
+		ring->idx = r;
+		ring->count = roundup_pow_of_two(clamp(ring_size, 64U, 4096U));
+		ring->batch = 1;
+		init_waitqueue_head(&ring->wq);
+		INIT_WORK(&ring->model_work, i218_lm_model_work);
+	}
+
+	/*
+	 * The action goes in after the managed arrays it walks, so it
+	 * runs before they are freed; a failed ring is undone by hand.
+	 */
+	for (r = 0; r < priv->nr_rings; r++) {
+		ret = i218_lm_ring_alloc(&priv->rings[r]);
+		if (ret) {
+			i218_lm_rings_free(priv);
+			return ret;
 		}
 	}
-	pr_info("Driver I218_LM loaded\n");
+	ret = devm_add_action_or_reset(priv->dev, i218_lm_rings_free, priv);
+	if (ret)
+		return ret;
+
+	for (r = 0; r < priv->nr_rings; r++)
+		i218_lm_ring_program(&priv->rings[r]);
 
 	return 0;
 }
 
-static void __exit I218_LM_driver_exit(void)
+static bool i218_lm_bench_drained(struct i218_lm_ring *ring, u64 tx, u64 rx)
+{
+	return READ_ONCE(ring->tx_frames) == tx &&
+	       READ_ONCE(ring->rx_frames) + READ_ONCE(ring->model_missed) == rx;
+}
+
+// One per ring, on the CPU of the ring's vector
+static int i218_lm_bench_thread(void *data)
 {
-	if (mapped_addr)
-		iounmap(mapped_addr);	// Unmap the MMIO region
+	struct i218_lm_ring *ring = data;
+	struct i218_lm_bench_res *res = &ring->res;
+	u64 tx0, rx0, missed0, irqs0, dbs0, t0;
+	u64 sent;
+	int ret = 0;
+
+	tx0 = READ_ONCE(ring->tx_frames);
+	rx0 = READ_ONCE(ring->rx_frames);
+	missed0 = READ_ONCE(ring->model_missed);
+	irqs0 = READ_ONCE(ring->vec->hardirqs);
+	dbs0 = ring->tx_doorbells + READ_ONCE(ring->rx_doorbells);
+
+	t0 = ktime_get_ns();
+	for (sent = 0; sent < res->frames && !ret; ) {
+		ret = i218_lm_xmit(ring, res->len);
+		if (!ret) {
+			sent++;
+			continue;
+		}
+		if (ret != -EBUSY)
+			break;
+
+		// Full: whatever is posted must reach the device first
+		i218_lm_tx_doorbell(ring);
+		ret = wait_event_timeout(ring->wq, i218_lm_tx_free(ring),
+					 HZ) ? 0 : -ETIMEDOUT;
+	}
+	i218_lm_tx_doorbell(ring);
+
+	if (!ret && !wait_event_timeout(ring->wq,
+					i218_lm_bench_drained(ring,
+							      tx0 + sent,
+							      rx0 + missed0 + sent),
+					5 * HZ))
+		ret = -ETIMEDOUT;
+
+	res->ns = ktime_get_ns() - t0;
+	res->frames = sent;
+	res->missed = READ_ONCE(ring->model_missed) - missed0;
+	res->irqs = READ_ONCE(ring->vec->hardirqs) - irqs0;
+	res->doorbells = ring->tx_doorbells + READ_ONCE(ring->rx_doorbells) -
+			 dbs0;
+	res->err = ret;
 
-	pr_info("Driver I218_LM unloaded\n");
+	// The module may go once the waiter wakes up
+	kthread_complete_and_exit(&ring->bench_done, 0);
+}
+
+/*
+ * frames per ring, posted in batches of batch with len bytes each;
+ * all rings at once, each from a thread on its vector's CPU. Returns
+ * with the threads running, i218_lm_ring_bench_wait() collects them.
+ */
+static int i218_lm_ring_bench_start(struct i218_lm_priv *priv, u64 frames,
+				    unsigned int batch, unsigned int len)
+{
+	struct task_struct *t;
+	struct i218_lm_ring *ring;
+	int r;
+
+	// The MAC of a real adapter is not brought up, nothing would move
+	if (priv->irq_mode != I218_LM_IRQ_MOCK || !priv->nr_rings)
+		return -EOPNOTSUPP;
+
+	for (r = 0; r < priv->nr_rings; r++) {
+		ring = &priv->rings[r];
+		ring->batch = clamp(batch, 1U, ring->count - 1);
+		memset(&ring->res, 0, sizeof(ring->res));
+		ring->res.frames = frames;
+		ring->res.len = len;
+		init_completion(&ring->bench_done);
+	}
+
+	for (r = 0; r < priv->nr_rings; r++) {
+		ring = &priv->rings[r];
+		t = kthread_run_on_cpu(i218_lm_bench_thread, ring,
+				       cpumask_first(ring->vec->affinity),
+				       "i218_lm_bench/%u");
+		if (IS_ERR(t)) {
+			ring->res.err = PTR_ERR(t);
+			complete(&ring->bench_done);
+		}
+	}
+
+	return 0;
+}
+
+static int i218_lm_ring_bench_wait(struct i218_lm_priv *priv)
+{
+	int r, ret = 0;
+
+	for (r = 0; r < priv->nr_rings; r++) {
+		wait_for_completion(&priv->rings[r].bench_done);
+		if (priv->rings[r].res.err && !ret)
+			ret = priv->rings[r].res.err;
+	}
+
+	return ret;
+}
+
+static int i218_lm_ring_bench(struct i218_lm_priv *priv, u64 frames,
+			      unsigned int batch, unsigned int len)
+{
+	int ret;
+
+	ret = i218_lm_ring_bench_start(priv, frames, batch, len);
+	if (ret)
+		return ret;
+
+	return i218_lm_ring_bench_wait(priv);
+}
+
+/*
+ * Keeps the adapter awake around BAR0 work; a wake from suspend is
+ * timed as a whole, PCI core and register restore together
+ */
+static int i218_lm_pm_get(struct i218_lm_priv *priv)
+{
+	bool asleep = pm_runtime_suspended(priv->dev);
+	u64 t0 = ktime_get_ns();
+	int ret;
+
+	ret = pm_runtime_resume_and_get(priv->dev);
+	if (!ret && asleep)
+		i218_lm_lat_add(&priv->pm_wake, ktime_get_ns() - t0);
+
+	return ret;
+}
+
+static void i218_lm_pm_put(struct i218_lm_priv *priv)
+{
+	pm_runtime_mark_last_busy(priv->dev);
+	pm_runtime_put_autosuspend(priv->dev);
+}
+
+// queue frames ns kpps doorbells irqs missed
+static ssize_t ring_bench_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	struct i218_lm_bench_res *res;
+	int r, len = 0;
+
+	mutex_lock(&priv->test_lock);
+	for (r = 0; r < priv->nr_rings; r++) {
+		res = &priv->rings[r].res;
+		if (!res->ns)
+			continue;
+		len += sysfs_emit_at(buf, len,
+				     "%d %llu %llu %llu %llu %llu %llu\n", r,
+				     res->frames, res->ns,
+				     div64_u64(res->frames * NSEC_PER_MSEC,
+					       res->ns),
+				     res->doorbells, res->irqs, res->missed);
+	}
+	mutex_unlock(&priv->test_lock);
+
+	return len;
+}
+
+// "frames [batch [len]]"
+static ssize_t ring_bench_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	unsigned int batch = 1, len = 64;
+	u64 frames;
+	int ret;
+
+	if (sscanf(buf, "%llu %u %u", &frames, &batch, &len) < 1)
+		return -EINVAL;
+	if (!frames || len < ETH_ZLEN || len > I218_LM_BUF_LEN)
+		return -EINVAL;
+
+	mutex_lock(&priv->test_lock);
+	ret = i218_lm_pm_get(priv);
+	if (!ret) {
+		ret = i218_lm_ring_bench(priv, frames, batch, len);
+		i218_lm_pm_put(priv);
+	}
+	mutex_unlock(&priv->test_lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(ring_bench);
+
+// Vectors to ask for, one per queue; a VF gets its share of the pool
+static unsigned int i218_lm_queues(struct i218_lm_priv *priv)
+{
+	if (priv->pf)
+		return priv->vf_queues;
+
+	return clamp(num_queues ? num_queues : num_online_cpus(), 1U,
+		     (unsigned int)I218_LM_MAX_QUEUES);
+}
+
+static irqreturn_t i218_lm_irq(int irq, void *data)
+{
+	struct i218_lm_vector *vec = data;
+	struct i218_lm_priv *priv = vec->priv;
+
+	// A shared line may fire while we sleep, the BAR is not there
+	if (READ_ONCE(priv->suspended)) {
+		vec->spurious++;
+		return IRQ_NONE;
+	}
+
+	// Reading ICR acks the causes; zero on a shared line is not ours
+	if (priv->pdev && priv->bar[0] &&
+	    !i218_lm_rd32(priv, I218_ICR) &&
+	    priv->irq_mode == I218_LM_IRQ_INTX) {
+		vec->spurious++;
+		return IRQ_NONE;
+	}
+
+	vec->t_hard = ktime_get_ns();
+	vec->hardirqs++;
+	vec->last_cpu = smp_processor_id();
+
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t i218_lm_irq_thread(int irq, void *data)
+{
+	struct i218_lm_vector *vec = data;
+
+	vec->threads++;
+	if (vec->ring) {
+		i218_lm_clean_tx(vec->ring);
+		i218_lm_clean_rx(vec->ring);
+	}
+	if (READ_ONCE(vec->testing)) {
+		u64 now = ktime_get_ns();
+
+		i218_lm_lat_add(&vec->hard_lat, vec->t_hard - vec->t_trigger);
+		i218_lm_lat_add(&vec->thread_lat, now - vec->t_trigger);
+		complete(&vec->done);
+	}
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * Common to both kinds once every vector has its Linux IRQ number.
+ * The rings come first, so devm frees them after the handlers.
+ */
+static int i218_lm_request_irqs(struct i218_lm_priv *priv, unsigned long flags)
+{
+	struct i218_lm_vector *vec;
+	int i, ret;
+
+	ret = i218_lm_rings_init(priv);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < priv->nr_vectors; i++) {
+		vec = &priv->vectors[i];
+		snprintf(vec->name, sizeof(vec->name), "i218_lm%d-q%d",
+			 priv->id, i);
+		ret = devm_request_threaded_irq(priv->dev, vec->irq,
+						i218_lm_irq, i218_lm_irq_thread,
+						flags, vec->name, vec);
+		if (ret)
+			return ret;
+	}
+
+	dev_info(priv->dev, "i218_lm%d: %d %s vector(s)", priv->id,
+		 priv->nr_vectors, i218_lm_irq_modes[priv->irq_mode]);
+
+	return 0;
+}
+
+static int i218_lm_alloc_vectors(struct i218_lm_priv *priv, int n)
+{
+	int i;
+
+	priv->vectors = devm_kcalloc(priv->dev, n, sizeof(*priv->vectors),
+				     GFP_KERNEL);
+	if (!priv->vectors)
+		return -ENOMEM;
+	priv->nr_vectors = n;
+
+	for (i = 0; i < n; i++) {
+		priv->vectors[i].priv = priv;
+		priv->vectors[i].idx = i;
+		init_completion(&priv->vectors[i].done);
+	}
+
+	return 0;
+}
+
+/*
+ * MSI-X with one vector per queue, spread over the CPUs by the core;
+ * else MSI or INTx, which give one vector. The I218 itself has no
+ * MSI-X capability and ends up with MSI. Vectors are released with the
+ * device, it was enabled with pcim_enable_device().
+ */
+static int i218_lm_pci_irqs(struct i218_lm_priv *priv)
+{
+	struct pci_dev *pdev = priv->pdev;
+	struct irq_affinity affd = { };
+	unsigned long flags = 0;
+	int i, nvec, ret;
+
+	// MSI is a memory write from the device
+	pci_set_master(pdev);
+
+	nvec = pci_alloc_irq_vectors_affinity(pdev, 1, i218_lm_queues(priv),
+					      PCI_IRQ_MSIX | PCI_IRQ_MSI |
+					      PCI_IRQ_INTX | PCI_IRQ_AFFINITY,
+					      &affd);
+	if (nvec < 0)
+		return nvec;
+
+	if (pdev->msix_enabled) {
+		priv->irq_mode = I218_LM_IRQ_MSIX;
+	} else if (pdev->msi_enabled) {
+		priv->irq_mode = I218_LM_IRQ_MSI;
+	} else {
+		priv->irq_mode = I218_LM_IRQ_INTX;
+		flags = IRQF_SHARED;
+	}
+
+	ret = i218_lm_alloc_vectors(priv, nvec);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nvec; i++) {
+		priv->vectors[i].irq = pci_irq_vector(pdev, i);
+		priv->vectors[i].affinity = pci_irq_get_affinity(pdev, i);
+	}
+
+	// Nothing is unmasked until irq_test asks for it
+	if (priv->bar[0])
+		i218_lm_wr32(priv, I218_IMC, ~0U);
+
+	return i218_lm_request_irqs(priv, flags);
+}
+
+static void i218_lm_mock_free_irqs(void *data)
+{
+	struct i218_lm_priv *priv = data;
+
+	irq_free_descs(priv->mock_irq_base, priv->nr_vectors);
+}
+
+/*
+ * The mock's interrupt controller: plain interrupt descriptors with
+ * the dummy chip, raised by an IPI to the vector's CPU. They show up
+ * in /proc/interrupts and go through the same threaded handlers.
+ */
+static int i218_lm_mock_irqs(struct i218_lm_priv *priv)
+{
+	int node = dev_to_node(priv->dev);
+	int i, irq, nvec = i218_lm_queues(priv);
+	int ret;
+
+	ret = i218_lm_alloc_vectors(priv, nvec);
+	if (ret)
+		return ret;
+	priv->irq_mode = I218_LM_IRQ_MOCK;
+
+	priv->mock_irq_base = irq_alloc_descs(-1, 1, nvec, node);
+	if (priv->mock_irq_base < 0)
+		return priv->mock_irq_base;
+	ret = devm_add_action_or_reset(priv->dev, i218_lm_mock_free_irqs, priv);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nvec; i++) {
+		irq = priv->mock_irq_base + i;
+		irq_set_chip_and_handler(irq, &dummy_irq_chip,
+					 handle_simple_irq);
+		irq_clear_status_flags(irq, IRQ_NOREQUEST | IRQ_NOPROBE);
+		priv->vectors[i].irq = irq;
+		priv->vectors[i].affinity =
+			cpumask_of(cpumask_local_spread(i, node));
+	}
+
+	return i218_lm_request_irqs(priv, 0);
+}
+
+static void i218_lm_mock_fire(void *data)
+{
+	struct i218_lm_vector *vec = data;
+
+	generic_handle_irq_safe(vec->irq);
+}
+
+static int i218_lm_irq_fire(struct i218_lm_vector *vec)
+{
+	struct i218_lm_priv *priv = vec->priv;
+
+	if (priv->irq_mode != I218_LM_IRQ_MOCK) {
+		i218_lm_wr32(priv, I218_ICS, I218_ICR_RXSEQ);
+		return 0;
+	}
+
+	return smp_call_function_single(cpumask_first(vec->affinity),
+					i218_lm_mock_fire, vec, 0);
+}
+
+/*
+ * rounds interrupts per vector, one at a time: stamp, raise, wait for
+ * the threaded handler. The hardware raises its one cause on vector 0
+ * only, the I218 has no way to route it to another.
+ */
+static int i218_lm_irq_test(struct i218_lm_priv *priv, unsigned int rounds)
+{
+	struct i218_lm_vector *vec;
+	int i, nvec = priv->nr_vectors;
+	unsigned int r;
+	int ret = 0;
+
+	if (priv->irq_mode != I218_LM_IRQ_MOCK) {
+		if (!priv->bar[0])
+			return -ENODEV;
+		nvec = 1;
+	}
+
+	for (i = 0; i < nvec && !ret; i++) {
+		vec = &priv->vectors[i];
+		memset(&vec->hard_lat, 0, sizeof(vec->hard_lat));
+		memset(&vec->thread_lat, 0, sizeof(vec->thread_lat));
+		WRITE_ONCE(vec->testing, true);
+		if (priv->irq_mode != I218_LM_IRQ_MOCK)
+			i218_lm_wr32(priv, I218_IMS, I218_ICR_RXSEQ);
+
+		for (r = 0; r < rounds; r++) {
+			reinit_completion(&vec->done);
+			vec->t_trigger = ktime_get_ns();
+			ret = i218_lm_irq_fire(vec);
+			if (ret)
+				break;
+			if (!wait_for_completion_timeout(&vec->done, HZ)) {
+				dev_err(priv->dev, "vector %d: no interrupt", i);
+				ret = -ETIMEDOUT;
+				break;
+			}
+		}
+
+		if (priv->irq_mode != I218_LM_IRQ_MOCK)
+			i218_lm_wr32(priv, I218_IMC, ~0U);
+		WRITE_ONCE(vec->testing, false);
+	}
+
+	return ret;
+}
+
+static ssize_t irq_mode_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%s %d\n", i218_lm_irq_modes[priv->irq_mode],
+			  priv->nr_vectors);
+}
+static DEVICE_ATTR_RO(irq_mode);
+
+// vector irq cpus hardirqs threads spurious last_cpu
+static ssize_t irq_stats_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	struct i218_lm_vector *vec;
+	int i, len = 0;
+
+	for (i = 0; i < priv->nr_vectors; i++) {
+		vec = &priv->vectors[i];
+		len += sysfs_emit_at(buf, len, "%d %d %*pbl %lu %lu %lu %u\n",
+				     i, vec->irq,
+				     cpumask_pr_args(vec->affinity ?:
+						     cpu_online_mask),
+				     READ_ONCE(vec->hardirqs),
+				     READ_ONCE(vec->threads),
+				     READ_ONCE(vec->spurious),
+				     READ_ONCE(vec->last_cpu));
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RO(irq_stats);
+
+// vector rounds, then min avg max ns to the hard and threaded handler
+static ssize_t irq_test_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	struct i218_lm_lat *h, *t;
+	int i, len = 0;
+
+	mutex_lock(&priv->test_lock);
+	for (i = 0; i < priv->nr_vectors; i++) {
+		h = &priv->vectors[i].hard_lat;
+		t = &priv->vectors[i].thread_lat;
+		if (!h->n)
+			continue;
+		len += sysfs_emit_at(buf, len,
+				     "%d %llu %llu %llu %llu %llu %llu %llu\n",
+				     i, h->n, h->min, div64_u64(h->sum, h->n),
+				     h->max, t->min, div64_u64(t->sum, t->n),
+				     t->max);
+	}
+	mutex_unlock(&priv->test_lock);
+
+	return len;
+}
+
+static ssize_t irq_test_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	unsigned int rounds;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &rounds);
+	if (ret)
+		return ret;
+	if (!rounds || rounds > 100000)
+		return -EINVAL;
+
+	mutex_lock(&priv->test_lock);
+	ret = i218_lm_pm_get(priv);
+	if (!ret) {
+		ret = i218_lm_irq_test(priv, rounds);
+		i218_lm_pm_put(priv);
+	}
+	mutex_unlock(&priv->test_lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(irq_test);
+
+/*
+ * Power-on contents of a mock BAR: the offset of every register in its
+ * low half, so a dump shows which bytes were read
+ */
+static void i218_lm_mock_fill(u32 *regs, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / sizeof(u32); i++)
+		regs[i] = 0x12180000 | (i * sizeof(u32) & 0xffff);
+}
+
+// BAR0 registers lost in D3hot, and the ring ones of queue 0
+static const u32 i218_lm_pm_regs[] = {
+	I218_CTRL, I218_CTRL_EXT, I218_ITR,
+};
+
+static const u32 i218_lm_pm_ring_regs[] = {
+	I218_TDBAL(0), I218_TDBAH(0), I218_TDLEN(0), I218_TDH(0), I218_TDT(0),
+	I218_RDBAL(0), I218_RDBAH(0), I218_RDLEN(0), I218_RDH(0), I218_RDT(0),
+};
+
+/*
+ * Quiesce and save. Whoever moves frames holds a runtime PM reference,
+ * so the rings are idle here; only a late interrupt or a model pass
+ * can be in flight.
+ */
+static void i218_lm_pm_save(struct i218_lm_priv *priv)
+{
+	int i;
+
+	priv->pm_ims = i218_lm_rd32(priv, I218_IMS);
+	i218_lm_wr32(priv, I218_IMC, ~0U);
+	WRITE_ONCE(priv->suspended, true);
+	for (i = 0; i < priv->nr_vectors; i++)
+		synchronize_irq(priv->vectors[i].irq);
+	if (priv->irq_mode == I218_LM_IRQ_MOCK)
+		for (i = 0; i < priv->nr_rings; i++)
+			flush_work(&priv->rings[i].model_work);
+
+	for (i = 0; i < priv->pm_nr_regs; i++)
+		priv->pm_saved[i] = i218_lm_rd32(priv, priv->pm_offs[i]);
+
+	// What D3hot does to the real adapter: back to power-on values
+	if (!priv->pdev)
+		i218_lm_mock_fill((u32 __force *)priv->bar[0],
+				  priv->bar_len[0]);
+}
+
+// Rings before the mask, so no interrupt sees a half restored queue
+static void i218_lm_pm_restore(struct i218_lm_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < priv->pm_nr_regs; i++)
+		i218_lm_wr32(priv, priv->pm_offs[i], priv->pm_saved[i]);
+
+	WRITE_ONCE(priv->suspended, false);
+	i218_lm_wr32(priv, I218_IMC, ~0U);
+	i218_lm_wr32(priv, I218_IMS, priv->pm_ims);
+}
+
+/*
+ * The PCI core saves config space and moves the device to D3hot after
+ * this, and back to D0 before the resume; BAR0 is only ours to keep.
+ */
+static int i218_lm_runtime_suspend(struct device *dev)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	u64 t0 = ktime_get_ns();
+
+	i218_lm_pm_save(priv);
+	i218_lm_lat_add(&priv->pm_suspend, ktime_get_ns() - t0);
+
+	return 0;
+}
+
+static int i218_lm_runtime_resume(struct device *dev)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	u64 t0 = ktime_get_ns();
+
+	i218_lm_pm_restore(priv);
+	i218_lm_lat_add(&priv->pm_resume, ktime_get_ns() - t0);
+
+	return 0;
+}
+
+/*
+ * System sleep. The PCI core wakes a runtime suspended adapter before
+ * this, the platform bus of the mock does not: then the registers are
+ * saved already and stay so until the next runtime resume.
+ */
+static int i218_lm_suspend(struct device *dev)
+{
+	if (pm_runtime_suspended(dev))
+		return 0;
+
+	return i218_lm_runtime_suspend(dev);
+}
+
+static int i218_lm_resume(struct device *dev)
+{
+	if (pm_runtime_suspended(dev))
+		return 0;
+
+	return i218_lm_runtime_resume(dev);
+}
+
+static const struct dev_pm_ops i218_lm_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(i218_lm_suspend, i218_lm_resume)
+	RUNTIME_PM_OPS(i218_lm_runtime_suspend, i218_lm_runtime_resume, NULL)
+};
+
+// The ring registers read back as saved, after a wake
+static void i218_lm_pm_check(struct i218_lm_priv *priv)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(i218_lm_pm_regs); i < priv->pm_nr_regs; i++)
+		if (i218_lm_rd32(priv, priv->pm_offs[i]) !=
+		    priv->pm_saved[i])
+			priv->pm_restore_errors++;
+}
+
+// state, then count min avg max ns of the save, restore and whole wake
+static ssize_t pm_stats_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	static const char * const names[] = { "suspend", "resume", "wake" };
+	const struct i218_lm_lat *lat[] = {
+		&priv->pm_suspend, &priv->pm_resume, &priv->pm_wake,
+	};
+	int i, len;
+
+	len = sysfs_emit(buf, "%s restore_errors %lu\n",
+			 pm_runtime_suspended(dev) ? "suspended" : "active",
+			 READ_ONCE(priv->pm_restore_errors));
+	for (i = 0; i < ARRAY_SIZE(lat); i++)
+		len += sysfs_emit_at(buf, len, "%s %llu %llu %llu %llu\n",
+				     names[i], lat[i]->n, lat[i]->min,
+				     lat[i]->n ? div64_u64(lat[i]->sum,
+							   lat[i]->n) : 0,
+				     lat[i]->max);
+
+	return len;
+}
+static DEVICE_ATTR_RO(pm_stats);
+
+/*
+ * rounds of suspend now, wake, check the ring registers; needs runtime
+ * PM allowed, power/control at auto
+ */
+static ssize_t pm_cycle_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	unsigned int i, rounds;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &rounds);
+	if (ret)
+		return ret;
+	if (!rounds || rounds > 10000)
+		return -EINVAL;
+
+	mutex_lock(&priv->test_lock);
+	for (i = 0; i < rounds; i++) {
+		// Not waiting out autosuspend_ms; 1 is asleep already
+		ret = pm_runtime_suspend(dev);
+		if (ret < 0)
+			break;
+
+		ret = i218_lm_pm_get(priv);
+		if (ret)
+			break;
+		i218_lm_pm_check(priv);
+		i218_lm_pm_put(priv);
+	}
+	mutex_unlock(&priv->test_lock);
+
+	return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_WO(pm_cycle);
+
+// A mock whose probe failed before i218_lm_pm_start()
+static void i218_lm_pm_drop(void *data)
+{
+	struct i218_lm_priv *priv = data;
+
+	if (!priv->pm_started)
+		pm_runtime_put_noidle(priv->dev);
+}
+
+/*
+ * Runtime PM with autosuspend: the adapter sleeps autosuspend_ms after
+ * its last user. The PCI core enters probe holding a reference on an
+ * active device, the mock is brought to the same point here; the
+ * reference is dropped by i218_lm_pm_start() once probe can no longer
+ * fail.
+ */
+static int i218_lm_pm_init(struct i218_lm_priv *priv)
+{
+	struct device *dev = priv->dev;
+	int i, r, n = 0, ret;
+
+	// Nothing to save without BAR0; the PCI core's reference keeps it up
+	if (!priv->bar[0])
+		return 0;
+
+	priv->pm_nr_regs = ARRAY_SIZE(i218_lm_pm_regs) +
+			   priv->nr_rings * ARRAY_SIZE(i218_lm_pm_ring_regs);
+	priv->pm_offs = devm_kcalloc(dev, priv->pm_nr_regs, sizeof(u32),
+				     GFP_KERNEL);
+	priv->pm_saved = devm_kcalloc(dev, priv->pm_nr_regs, sizeof(u32),
+				      GFP_KERNEL);
+	if (!priv->pm_offs || !priv->pm_saved)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(i218_lm_pm_regs); i++)
+		priv->pm_offs[n++] = i218_lm_pm_regs[i];
+	for (r = 0; r < priv->nr_rings; r++)
+		for (i = 0; i < ARRAY_SIZE(i218_lm_pm_ring_regs); i++)
+			priv->pm_offs[n++] = i218_lm_pm_ring_regs[i] +
+					     r * 0x100;
+
+	if (!priv->pdev) {
+		pm_runtime_set_active(dev);
+		// Disabled again, autosuspend off, on detach
+		ret = devm_pm_runtime_enable(dev);
+		if (ret)
+			return ret;
+		pm_runtime_get_noresume(dev);
+		return devm_add_action_or_reset(dev, i218_lm_pm_drop, priv);
+	}
+
+	return 0;
+}
+
+// The end of probe: lets the adapter go
+static void i218_lm_pm_start(struct i218_lm_priv *priv)
+{
+	struct device *dev = priv->dev;
+
+	// No BAR0, no runtime PM: the PCI core's reference stays ours
+	if (!priv->bar[0])
+		return;
+
+	pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
+	pm_runtime_use_autosuspend(dev);
+	// Forbidden on PCI until the user writes auto to power/control
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+	priv->pm_started = true;
+}
+
+/*
+ * SR-IOV. The queues of an adapter are one pool of I218_LM_MAX_QUEUES:
+ * the PF keeps those it took at probe, the VFs split the rest evenly.
+ * A VF has its own BAR, vectors and rings on its share.
+ */
+static int i218_lm_sriov_share(struct i218_lm_priv *pf, int num_vfs)
+{
+	int left = I218_LM_MAX_QUEUES - pf->nr_vectors;
+
+	if (num_vfs > left) {
+		dev_err(pf->dev, "%d queues left for %d VFs, load with a lower num_queues",
+			left, num_vfs);
+		return -ENOSPC;
+	}
+	pf->vf_queues = left / num_vfs;
+	dev_info(pf->dev, "i218_lm%d: %d VFs, %u queues each", pf->id,
+		 num_vfs, pf->vf_queues);
+
+	return 0;
+}
+
+static void i218_lm_vf_detach(void *data)
+{
+	struct i218_lm_priv *priv = data;
+
+	mutex_lock(&priv->pf->vf_lock);
+	priv->pf->vfs[priv->vf] = NULL;
+	mutex_unlock(&priv->pf->vf_lock);
+}
+
+// The last step of a VF probe: the PF may use it from now on
+static int i218_lm_vf_attach(struct i218_lm_priv *priv)
+{
+	if (priv->vf < 0 || priv->vf >= I218_LM_MAX_VFS)
+		return -EINVAL;
+
+	mutex_lock(&priv->pf->vf_lock);
+	priv->pf->vfs[priv->vf] = priv;
+	mutex_unlock(&priv->pf->vf_lock);
+
+	return devm_add_action_or_reset(priv->dev, i218_lm_vf_detach, priv);
+}
+
+// Unbinds and removes them; the PF's sriov_lock is held or not needed
+static void i218_lm_mock_disable_vfs(struct i218_lm_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < priv->num_vfs; i++) {
+		platform_device_unregister(priv->mock_vfs[i]);
+		priv->mock_vfs[i] = NULL;
+	}
+	priv->num_vfs = 0;
+	priv->vf_queues = 0;
+}
+
+static void i218_lm_mock_sriov_release(void *data)
+{
+	i218_lm_mock_disable_vfs(data);
+}
+
+/*
+ * sriov_numvfs of a mock PF, as the PCI core has it: N VFs from none,
+ * 0 to go back to none. The VFs are platform devices under the PF,
+ * bound before this returns.
+ */
+static int i218_lm_mock_sriov_configure(struct i218_lm_priv *priv,
+					int num_vfs)
+{
+	struct i218_lm_vf_info vfi = { .pf = priv };
+	struct platform_device_info info = {
+		.parent = priv->dev,
+		.name = MOCK_VF_NAME,
+		.id = PLATFORM_DEVID_AUTO,
+		.data = &vfi,
+		.size_data = sizeof(vfi),
+		.dma_mask = DMA_BIT_MASK(64),
+	};
+	struct platform_device *vf;
+	int ret;
+
+	if (!num_vfs) {
+		i218_lm_mock_disable_vfs(priv);
+		return 0;
+	}
+	if (priv->num_vfs)
+		return -EBUSY;
+
+	ret = i218_lm_sriov_share(priv, num_vfs);
+	if (ret)
+		return ret;
+
+	// A failed VF unregisters the others and undoes the share
+	vfi.queues = priv->vf_queues;
+	for (vfi.vf = 0; vfi.vf < num_vfs; vfi.vf++) {
+		vf = platform_device_register_full(&info);
+		if (IS_ERR(vf)) {
+			i218_lm_mock_disable_vfs(priv);
+			return PTR_ERR(vf);
+		}
+		priv->mock_vfs[priv->num_vfs++] = vf;
+	}
+	wait_for_device_probe();
+
+	return 0;
+}
+
+static ssize_t sriov_totalvfs_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n",
+			  min(I218_LM_MAX_QUEUES - priv->nr_vectors,
+			      I218_LM_MAX_VFS));
+}
+static DEVICE_ATTR_RO(sriov_totalvfs);
+
+static ssize_t sriov_numvfs_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(priv->num_vfs));
+}
+
+static ssize_t sriov_numvfs_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	unsigned int num_vfs;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &num_vfs);
+	if (ret)
+		return ret;
+	if (num_vfs > I218_LM_MAX_VFS)
+		return -ERANGE;
+
+	mutex_lock(&priv->sriov_lock);
+	ret = i218_lm_mock_sriov_configure(priv, num_vfs);
+	mutex_unlock(&priv->sriov_lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(sriov_numvfs);
+
+/*
+ * sriov_bench runs ring_bench on the PF and every bound VF at once,
+ * all their rings together, and times the whole; stepping through
+ * sriov_numvfs shows how the aggregate scales with VFs.
+ */
+static int i218_lm_sriov_bench(struct i218_lm_priv *priv, u64 frames,
+			       unsigned int batch, unsigned int len)
+{
+	struct i218_lm_priv *fn[1 + I218_LM_MAX_VFS];
+	struct i218_lm_sriov_res *res = &priv->sriov_res;
+	int i, n = 0, locked, awake, ret = 0, err;
+	u64 t0;
+
+	mutex_lock(&priv->vf_lock);
+	fn[n++] = priv;
+	for (i = 0; i < I218_LM_MAX_VFS; i++)
+		if (priv->vfs[i])
+			fn[n++] = priv->vfs[i];
+
+	// The PF's test_lock is held by the caller; a busy VF fails it all
+	for (locked = 1; locked < n; locked++)
+		if (!mutex_trylock(&fn[locked]->test_lock)) {
+			ret = -EBUSY;
+			goto unlock;
+		}
+
+	for (awake = 0; awake < n; awake++) {
+		ret = i218_lm_pm_get(fn[awake]);
+		if (ret)
+			goto sleep;
+	}
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		ret = i218_lm_ring_bench_start(fn[i], frames, batch, len);
+		if (ret)
+			break;
+	}
+	// Every function started has threads to collect
+	n = i;
+	for (i = 0; i < n; i++) {
+		err = i218_lm_ring_bench_wait(fn[i]);
+		if (err && !ret)
+			ret = err;
+	}
+
+	memset(res, 0, sizeof(*res));
+	if (!ret) {
+		res->ns = ktime_get_ns() - t0;
+		res->functions = n;
+		for (i = 0; i < n; i++)
+			res->rings += fn[i]->nr_rings;
+		res->frames = frames * res->rings;
+	}
+
+sleep:
+	while (awake--)
+		i218_lm_pm_put(fn[awake]);
+unlock:
+	while (--locked > 0)
+		mutex_unlock(&fn[locked]->test_lock);
+	mutex_unlock(&priv->vf_lock);
+
+	return ret;
+}
+
+// functions rings frames ns kpps
+static ssize_t sriov_bench_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	struct i218_lm_sriov_res *res = &priv->sriov_res;
+	int len = 0;
+
+	mutex_lock(&priv->test_lock);
+	if (res->ns)
+		len = sysfs_emit(buf, "%d %d %llu %llu %llu\n", res->functions,
+				 res->rings, res->frames, res->ns,
+				 div64_u64(res->frames * NSEC_PER_MSEC,
+					   res->ns));
+	mutex_unlock(&priv->test_lock);
+
+	return len;
+}
+
+// "frames [batch [len]]" per ring, as ring_bench
+static ssize_t sriov_bench_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(dev);
+	unsigned int batch = 1, len = 64;
+	u64 frames;
+	int ret;
+
+	if (sscanf(buf, "%llu %u %u", &frames, &batch, &len) < 1)
+		return -EINVAL;
+	if (!frames || len < ETH_ZLEN || len > I218_LM_BUF_LEN)
+		return -EINVAL;
+
+	mutex_lock(&priv->test_lock);
+	ret = i218_lm_sriov_bench(priv, frames, batch, len);
+	mutex_unlock(&priv->test_lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(sriov_bench);
+
+static struct attribute *i218_lm_attrs[] = {
+	&dev_attr_irq_mode.attr,
+	&dev_attr_irq_stats.attr,
+	&dev_attr_irq_test.attr,
+	&dev_attr_ring_bench.attr,
+	&dev_attr_pm_stats.attr,
+	&dev_attr_pm_cycle.attr,
+	NULL
+};
+
+static const struct attribute_group i218_lm_group = {
+	.attrs = i218_lm_attrs,
+};
+
+static struct attribute *i218_lm_sriov_attrs[] = {
+	&dev_attr_sriov_totalvfs.attr,
+	&dev_attr_sriov_numvfs.attr,
+	&dev_attr_sriov_bench.attr,
+	NULL
+};
+
+// PFs only; a PCI PF has the PCI core's sriov_numvfs instead
+static umode_t i218_lm_sriov_visible(struct kobject *kobj,
+				     struct attribute *attr, int n)
+{
+	struct i218_lm_priv *priv = dev_get_drvdata(kobj_to_dev(kobj));
+
+	if (priv->pf)
+		return 0;
+	if (priv->pdev && attr != &dev_attr_sriov_bench.attr)
+		return 0;
+
+	return attr->mode;
+}
+
+static const struct attribute_group i218_lm_sriov_group = {
+	.attrs = i218_lm_sriov_attrs,
+	.is_visible = i218_lm_sriov_visible,
+};
+
+static const struct attribute_group *i218_lm_groups[] = {
+	&i218_lm_group,
+	&i218_lm_sriov_group,
+	NULL
+};
+
+static bool i218_lm_bdf_wanted(struct pci_dev *pdev)
+{
+	int i;
+
+	if (!nr_bdf)
+		return true;
+
+	for (i = 0; i < nr_bdf; i++)
+		if (bdf_list[i].domain == pci_domain_nr(pdev->bus) &&
+		    bdf_list[i].bus == pdev->bus->number &&
+		    bdf_list[i].devfn == pdev->devfn)
+			return true;
+
+	return false;
+}
+
+static int i218_lm_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct i218_lm_priv *priv, *pf = NULL;
+	void __iomem * const *table;
+	int bar, mask = 0, ret;
+
+	// A VF comes from sriov_configure of a PF bound here, not bdf=
+	if (pdev->is_virtfn) {
+		pf = pci_iov_get_pf_drvdata(pdev, &i218_lm_driver);
+		if (IS_ERR(pf))
+			return PTR_ERR(pf);
+	} else if (!i218_lm_bdf_wanted(pdev)) {
+		return -ENODEV;
+	}
+
+	i218_lm_show_config(pdev);
+
+	priv = i218_lm_alloc(&pdev->dev);
+	if (!priv)
+		return -ENOMEM;
+	priv->pdev = pdev;
+	if (pf) {
+		priv->pf = pf;
+		priv->vf = pci_iov_vf_id(pdev);
+		priv->vf_queues = pf->vf_queues;
+	}
+
+	// Managed: disabled again when the driver detaches
+	ret = pcim_enable_device(pdev);
+	if (ret)
+		return ret;
+
+	/*
+	 * PCI devices can have multiple BARs, and not all
+	 * of them may be memory-mapped. Some might be I/O
+	 * ports, so it's important to check if the resource
+	 * is actually memory (IORESOURCE_MEM) before
+	 * processing.
+	 */
+	for (bar = 0; bar < PCI_STD_NUM_BARS; bar++)
+		if ((pci_resource_flags(pdev, bar) & IORESOURCE_MEM) &&
+		    pci_resource_len(pdev, bar))
+			mask |= BIT(bar);
+	if (!mask) {
+		dev_err(&pdev->dev, "no memory BAR");
+		return -ENODEV;
+	}
+
+	// Requests and maps every memory BAR, undone on detach
+	ret = pcim_iomap_regions(pdev, mask, DRIVER_NAME);
+	if (ret)
+		return ret;
+
+	table = pcim_iomap_table(pdev);
+	for (bar = 0; bar < PCI_STD_NUM_BARS; bar++) {
+		if (!(mask & BIT(bar)))
+			continue;
+		priv->bar[bar] = table[bar];
+		priv->bar_len[bar] = pci_resource_len(pdev, bar);
+		dev_info(&pdev->dev, "Found BAR%x at %pa", bar,
+			 &pdev->resource[bar].start);
+	}
+
+	i218_lm_setup(priv);
+
+	ret = i218_lm_pci_irqs(priv);
+	if (ret)
+		return ret;
+
+	pci_set_drvdata(pdev, priv);
+
+	ret = i218_lm_pm_init(priv);
+	if (ret)
+		return ret;
+
+	if (pf) {
+		ret = i218_lm_vf_attach(priv);
+		if (ret)
+			return ret;
+		i218_lm_pm_start(priv);
+		dev_info(&pdev->dev, "Driver I218_LM bound as i218_lm%d, VF%d of i218_lm%d\n",
+			 priv->id, priv->vf, pf->id);
+		return 0;
+	}
+
+	i218_lm_pm_start(priv);
+	dev_info(&pdev->dev, "Driver I218_LM bound as i218_lm%d\n", priv->id);
+
+	return 0;
+}
+
+/*
+ * The mappings, regions and the enable count are managed. The reference
+ * dropped at the end of probe, if it was, is taken again as the PCI
+ * core expects; allow/forbid is the user's through power/control and
+ * left alone.
+ */
+static void i218_lm_remove(struct pci_dev *pdev)
+{
+	struct i218_lm_priv *priv = pci_get_drvdata(pdev);
+
+	// The VFs point at this PF, they go first
+	pci_disable_sriov(pdev);
+	if (priv->pm_started) {
+		pm_runtime_dont_use_autosuspend(&pdev->dev);
+		pm_runtime_get_noresume(&pdev->dev);
+	}
+	dev_info(&pdev->dev, "Driver I218_LM unbound\n");
+}
+
+static const struct pci_device_id i218_lm_ids[] = {
+	{ PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218) },
+	{ PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218_V) },
+	{ PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218_LM2) },
+	{ PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218_V2) },
+	{ PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218_LM3) },
+	{ PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_I218_V3) },
+	{ }
+};
+MODULE_DEVICE_TABLE(pci, i218_lm_ids);
+
+/*
+ * The dynamic IDs added so far: pci_add_dynid() does not look for
+ * duplicates, and sriov_numvfs asks again on every enable. The PCI
+ * core frees the IDs themselves when the driver is unregistered.
+ */
+#define I218_LM_MAX_DYNIDS (2 * I218_LM_MAX_BDF)
+static DEFINE_MUTEX(dynid_lock);
+static u32 dynids[I218_LM_MAX_DYNIDS];	// vendor << 16 | device
+static int nr_dynids;
+
+// vendor:device to i218_lm_driver, unless it matches already
+static int i218_lm_add_dynid(u16 vendor, u16 device)
+{
+	const struct pci_device_id *id;
+	u32 key = (u32)vendor << 16 | device;
+	int i, ret = 0;
+
+	for (id = i218_lm_ids; id->vendor; id++)
+		if (id->vendor == vendor && id->device == device)
+			return 0;
+
+	mutex_lock(&dynid_lock);
+	for (i = 0; i < nr_dynids; i++)
+		if (dynids[i] == key)
+			goto out;
+	if (nr_dynids == I218_LM_MAX_DYNIDS) {
+		ret = -ENOSPC;
+		goto out;
+	}
+	ret = pci_add_dynid(&i218_lm_driver, vendor, device, PCI_ANY_ID,
+			    PCI_ANY_ID, 0, 0, 0);
+	if (!ret)
+		dynids[nr_dynids++] = key;
+out:
+	mutex_unlock(&dynid_lock);
+
+	return ret;
+}
+
+/*
+ * sriov_numvfs of a PCI PF. The VFs bind here too: their device ID,
+ * from the SR-IOV capability, becomes a dynamic ID. The I218 has no
+ * SR-IOV capability, so the PCI core shows no sriov_numvfs for it;
+ * the mock PF has its own.
+ */
+static int i218_lm_sriov_configure(struct pci_dev *pdev, int num_vfs)
+{
+	struct i218_lm_priv *priv = pci_get_drvdata(pdev);
+	int pos, ret;
+	u16 vf_did;
+
+	if (!num_vfs) {
+		if (pci_vfs_assigned(pdev))
+			return -EPERM;
+		pci_disable_sriov(pdev);
+		priv->num_vfs = 0;
+		priv->vf_queues = 0;
+		return 0;
+	}
+
+	ret = i218_lm_sriov_share(priv, num_vfs);
+	if (ret)
+		return ret;
+
+	pos = pci_find_ext_capability(pdev, PCI_EXT_CAP_ID_SRIOV);
+	if (!pos) {
+		ret = -ENODEV;
+		goto err;
+	}
+	pci_read_config_word(pdev, pos + PCI_SRIOV_VF_DID, &vf_did);
+	ret = i218_lm_add_dynid(pdev->vendor, vf_did);
+	if (ret)
+		goto err;
+
+	ret = pci_enable_sriov(pdev, num_vfs);
+	if (ret)
+		goto err;
+	priv->num_vfs = num_vfs;
+
+	return num_vfs;
+
+err:
+	priv->vf_queues = 0;
+	return ret;
+}
+
+static struct pci_driver i218_lm_driver = {
+	.name = DRIVER_NAME,
+	.id_table = i218_lm_ids,
+	.probe = i218_lm_probe,
+	.remove = i218_lm_remove,
+	.sriov_configure = i218_lm_sriov_configure,
+	// Adapters probe in parallel, boot does not wait on each in turn
+	.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+	.driver.dev_groups = i218_lm_groups,
+	.driver.pm = pm_ptr(&i218_lm_pm_ops),
+};
+
+static void i218_lm_vfree(void *data)
+{
+	vfree(data);
+}
+
+// A BAR of the mock adapter, memory in its power-on state
+static void __iomem *i218_lm_mock_bar(struct device *dev, size_t len)
+{
+	u32 *regs;
+
+	regs = vzalloc(len);
+	if (!regs)
+		return NULL;
+	if (devm_add_action_or_reset(dev, i218_lm_vfree, regs))
+		return NULL;
+
+	i218_lm_mock_fill(regs, len);
+
+	return (void __iomem __force *)regs;
+}
+
+// A mock VF, platform data from its PF, or a mock PF
+static int i218_lm_mock_probe(struct platform_device *pdev)
+{
+	const struct i218_lm_vf_info *vfi = dev_get_platdata(&pdev->dev);
+	struct i218_lm_priv *priv;
+	int ret;
+
+	priv = i218_lm_alloc(&pdev->dev);
+	if (!priv)
+		return -ENOMEM;
+
+	if (vfi) {
+		priv->pf = vfi->pf;
+		priv->vf = vfi->vf;
+		priv->vf_queues = vfi->queues;
+		priv->bar[0] = i218_lm_mock_bar(&pdev->dev,
+						I218_LM_MOCK_VF_BAR0_LEN);
+		if (!priv->bar[0])
+			return -ENOMEM;
+		priv->bar_len[0] = I218_LM_MOCK_VF_BAR0_LEN;
+	} else {
+		priv->bar[0] = i218_lm_mock_bar(&pdev->dev,
+						I218_LM_MOCK_BAR0_LEN);
+		priv->bar[1] = i218_lm_mock_bar(&pdev->dev,
+						I218_LM_MOCK_BAR1_LEN);
+		if (!priv->bar[0] || !priv->bar[1])
+			return -ENOMEM;
+		priv->bar_len[0] = I218_LM_MOCK_BAR0_LEN;
+		priv->bar_len[1] = I218_LM_MOCK_BAR1_LEN;
+	}
+
+	i218_lm_setup(priv);
+
+	ret = i218_lm_mock_irqs(priv);
+	if (ret)
+		return ret;
+
+	platform_set_drvdata(pdev, priv);
+
+	ret = i218_lm_pm_init(priv);
+	if (ret)
+		return ret;
+
+	if (vfi) {
+		ret = i218_lm_vf_attach(priv);
+		if (ret)
+			return ret;
+		i218_lm_pm_start(priv);
+		dev_info(&pdev->dev, "Mock I218_LM bound as i218_lm%d, VF%d of i218_lm%d\n",
+			 priv->id, priv->vf, priv->pf->id);
+		return 0;
+	}
+
+	// Runs first on detach: the VFs point at this PF
+	ret = devm_add_action_or_reset(&pdev->dev, i218_lm_mock_sriov_release,
+				       priv);
+	if (ret)
+		return ret;
+
+	i218_lm_pm_start(priv);
+	dev_info(&pdev->dev, "Mock I218_LM bound as i218_lm%d\n", priv->id);
+
+	return 0;
+}
+
+// Both kinds of mock function bind here
+static const struct platform_device_id i218_lm_mock_ids[] = {
+	{ MOCK_NAME },
+	{ MOCK_VF_NAME },
+	{ }
+};
+
+static struct platform_driver i218_lm_mock_driver = {
+	.driver = {
+		.name = MOCK_NAME,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.dev_groups = i218_lm_groups,
+		.pm = pm_ptr(&i218_lm_pm_ops),
+	},
+	.probe = i218_lm_mock_probe,
+	.id_table = i218_lm_mock_ids,
+};
+
+static void i218_lm_mock_destroy(void)
+{
+	unsigned int i;
+
+	if (!mock_devs)
+		return;
+
+	for (i = 0; i < mock; i++)
+		if (!IS_ERR_OR_NULL(mock_devs[i]))
+			platform_device_unregister(mock_devs[i]);
+	kfree(mock_devs);
+	mock_devs = NULL;
+	platform_driver_unregister(&i218_lm_mock_driver);
+	destroy_workqueue(model_wq);
+}
+
+static int i218_lm_mock_create(void)
+{
+	struct platform_device_info info = {
+		.name = MOCK_NAME,
+		.dma_mask = DMA_BIT_MASK(64),	// rings in any memory
+	};
+	unsigned int i;
+	int ret;
+
+	if (!mock)
+		return 0;
+
+	// The model stands for a device, it runs on any CPU
+	model_wq = alloc_workqueue("i218_lm_model", WQ_UNBOUND | WQ_HIGHPRI,
+				   0);
+	if (!model_wq)
+		return -ENOMEM;
+
+	ret = platform_driver_register(&i218_lm_mock_driver);
+	if (ret) {
+		destroy_workqueue(model_wq);
+		return ret;
+	}
+
+	mock_devs = kcalloc(mock, sizeof(*mock_devs), GFP_KERNEL);
+	if (!mock_devs) {
+		platform_driver_unregister(&i218_lm_mock_driver);
+		destroy_workqueue(model_wq);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < mock; i++) {
+		info.id = i;
+		mock_devs[i] = platform_device_register_full(&info);
+		if (IS_ERR(mock_devs[i])) {
+			ret = PTR_ERR(mock_devs[i]);
+			i218_lm_mock_destroy();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void i218_lm_trace_free(void)
+{
+	struct i218_lm_trace_cpu *tc;
+	int cpu;
+
+	if (!trace_cpu)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		tc = per_cpu_ptr(trace_cpu, cpu);
+		kvfree(tc->ring);
+		kvfree(tc->hist);
+	}
+	free_percpu(trace_cpu);
+	trace_cpu = NULL;
+}
+
+// The buffers of every possible CPU, on its node, at the first enable
+static int i218_lm_trace_alloc(void)
+{
+	struct i218_lm_trace_cpu *tc;
+	int cpu;
+
+	if (trace_cpu)
+		return 0;
+
+	trace_cpu = alloc_percpu(struct i218_lm_trace_cpu);
+	if (!trace_cpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		tc = per_cpu_ptr(trace_cpu, cpu);
+		tc->ring = kvzalloc_node(array_size(trace_entries,
+						    sizeof(*tc->ring)),
+					 GFP_KERNEL, cpu_to_node(cpu));
+		tc->hist = kvzalloc_node(array_size(I218_LM_HIST_SLOTS,
+						    sizeof(*tc->hist)),
+					 GFP_KERNEL, cpu_to_node(cpu));
+		if (!tc->ring || !tc->hist) {
+			i218_lm_trace_free();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+// Off, and every record already under way finished
+static void i218_lm_trace_stop(void)
+{
+	static_branch_disable(&i218_lm_tracing);
+	synchronize_rcu();
+}
+
+// After i218_lm_trace_stop(), or before the first start: nobody writes
+static void i218_lm_trace_clear(void)
+{
+	struct i218_lm_trace_cpu *tc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		tc = per_cpu_ptr(trace_cpu, cpu);
+		tc->head = 0;
+		tc->hist_full = 0;
+		memset(tc->ring, 0, array_size(trace_entries, sizeof(*tc->ring)));
+		memset(tc->hist, 0,
+		       array_size(I218_LM_HIST_SLOTS, sizeof(*tc->hist)));
+	}
+}
+
+static int i218_lm_trace_enable_get(void *data, u64 *val)
+{
+	*val = static_key_enabled(&i218_lm_tracing);
+
+	return 0;
+}
+
+// 1 clears the buffers and starts, 0 stops and keeps them to be read
+static int i218_lm_trace_enable_set(void *data, u64 val)
+{
+	int ret = 0;
+
+	mutex_lock(&trace_mutex);
+	if (val && !static_key_enabled(&i218_lm_tracing)) {
+		ret = i218_lm_trace_alloc();
+		if (!ret) {
+			i218_lm_trace_clear();
+			static_branch_enable(&i218_lm_tracing);
+		}
+	} else if (!val && static_key_enabled(&i218_lm_tracing)) {
+		i218_lm_trace_stop();
+	}
+	mutex_unlock(&trace_mutex);
+
+	return ret;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(i218_lm_trace_enable_fops, i218_lm_trace_enable_get,
+			 i218_lm_trace_enable_set, "%llu\n");
+
+/*
+ * trace: position 0 is the header, then trace_entries per CPU, oldest
+ * first. Entries not written yet, or overwritten while we read, are
+ * left out.
+ */
+static void *i218_lm_trace_buf_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&trace_mutex);
+	if (!trace_cpu)
+		return NULL;
+	if (!*pos)
+		return SEQ_START_TOKEN;
+
+	return *pos <= (loff_t)nr_cpu_ids * trace_entries ? pos : NULL;
+}
+
+static void *i218_lm_trace_buf_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+
+	return *pos <= (loff_t)nr_cpu_ids * trace_entries ? pos : NULL;
+}
+
+static void i218_lm_trace_buf_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&trace_mutex);
+}
+
+static int i218_lm_trace_buf_show(struct seq_file *m, void *v)
+{
+	struct i218_lm_trace_cpu *tc;
+	struct i218_lm_trace_ent *ent, e;
+	u32 head, slot, seq, i;
+	int cpu;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "cpu slot device bar op width offset value cycles\n");
+		return 0;
+	}
+
+	cpu = div_u64_rem(*(loff_t *)v - 1, trace_entries, &i);
+	if (!cpu_possible(cpu))
+		return 0;
+	tc = per_cpu_ptr(trace_cpu, cpu);
+
+	head = READ_ONCE(tc->head);
+	if (head < trace_entries) {
+		if (i >= head)
+			return 0;
+		slot = i;
+	} else {
+		slot = head - trace_entries + i;
+	}
+
+	ent = &tc->ring[slot & (trace_entries - 1)];
+	seq = smp_load_acquire(&ent->seq);
+	e = *ent;
+	smp_rmb();
+	if (seq != i218_lm_trace_seq(slot) || READ_ONCE(ent->seq) != seq)
+		return 0;
+
+	seq_printf(m, "%d %u i218_lm%u %u %c %u 0x%05x 0x%08x %llu\n", cpu,
+		   slot, e.id, e.bar & ~I218_LM_TRACE_WRITE,
+		   e.bar & I218_LM_TRACE_WRITE ? 'w' : 'r', e.width, e.off,
+		   e.val, e.cycles);
+
+	return 0;
+}
+
+static const struct seq_operations i218_lm_trace_buf_sops = {
+	.start = i218_lm_trace_buf_start,
+	.next = i218_lm_trace_buf_next,
+	.stop = i218_lm_trace_buf_stop,
+	.show = i218_lm_trace_buf_show,
+};
+DEFINE_SEQ_ATTRIBUTE(i218_lm_trace_buf);
+
+static int i218_lm_hist_cmp(const void *a, const void *b)
+{
+	const struct i218_lm_hist_ent *x = a, *y = b;
+
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+// Smallest bucket bound with pct percent of the accesses below it
+static unsigned int i218_lm_hist_pct(const struct i218_lm_hist_ent *h,
+				     unsigned int pct)
+{
+	u64 sum = 0;
+	int b;
+
+	for (b = 0; b < I218_LM_HIST_BUCKETS - 1; b++) {
+		sum += h->buckets[b];
+		if (sum * 100 >= h->n * pct)
+			break;
+	}
+
+	return b;
+}
+
+/*
+ * hist: the tables of all CPUs merged, one line per register and
+ * access: count, avg and max cycles, the p50 and p99 bucket, then
+ * every bucket in use as B:count, cycles below 2^B
+ */
+static int i218_lm_hist_show(struct seq_file *m, void *v)
+{
+	struct i218_lm_trace_cpu *tc;
+	struct i218_lm_hist_ent *all, *h, *t;
+	int cpu, i, j, b, n = 0, ret = 0;
+	u64 full = 0;
+	u8 bar;
+
+	mutex_lock(&trace_mutex);
+	if (!trace_cpu)
+		goto out;
+
+	all = kvcalloc(num_possible_cpus() * I218_LM_HIST_SLOTS,
+		       sizeof(*all), GFP_KERNEL);
+	if (!all) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for_each_possible_cpu(cpu) {
+		tc = per_cpu_ptr(trace_cpu, cpu);
+		full += READ_ONCE(tc->hist_full);
+		for (i = 0; i < I218_LM_HIST_SLOTS; i++) {
+			h = &tc->hist[i];
+			if (!READ_ONCE(h->key))
+				continue;
+			for (j = 0; j < n && all[j].key != h->key; j++)
+				;
+			t = &all[j];
+			if (j == n) {
+				t->key = h->key;
+				n++;
+			}
+			t->n += h->n;
+			t->sum += h->sum;
+			t->max = max(t->max, h->max);
+			for (b = 0; b < I218_LM_HIST_BUCKETS; b++)
+				t->buckets[b] += h->buckets[b];
+		}
+	}
+	sort(all, n, sizeof(*all), i218_lm_hist_cmp, NULL);
+
+#ifdef CONFIG_X86
+	seq_printf(m, "# cycles of the TSC at %u kHz\n", tsc_khz);
+#endif
+	seq_puts(m, "device bar op width offset count avg max p50 p99 buckets\n");
+	for (j = 0; j < n; j++) {
+		t = &all[j];
+		if (!t->n)
+			continue;
+		bar = t->key >> 32;
+		seq_printf(m, "i218_lm%u %u %c %u 0x%05x %llu %llu %llu %u %u",
+			   (u16)(t->key >> 40), bar & ~I218_LM_TRACE_WRITE,
+			   bar & I218_LM_TRACE_WRITE ? 'w' : 'r',
+			   (u8)(t->key >> 24), (u32)(t->key & 0xffffff), t->n,
+			   div64_u64(t->sum, t->n), t->max,
+			   i218_lm_hist_pct(t, 50), i218_lm_hist_pct(t, 99));
+		for (b = 0; b < I218_LM_HIST_BUCKETS; b++)
+			if (t->buckets[b])
+				seq_printf(m, " %d:%u", b, t->buckets[b]);
+		seq_putc(m, '\n');
+	}
+	if (full)
+		seq_printf(m, "# %llu accesses found the table full\n", full);
+
+	kvfree(all);
+out:
+	mutex_unlock(&trace_mutex);
+
+	return ret;
+}
+DEFINE_SHOW_ATTRIBUTE(i218_lm_hist);
+
+// /sys/kernel/debug/i218_lm: enable, trace, hist
+static void i218_lm_debugfs_init(void)
+{
+	trace_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+	debugfs_create_file_unsafe("enable", 0600, trace_dir, NULL,
+				   &i218_lm_trace_enable_fops);
+	debugfs_create_file("trace", 0400, trace_dir, NULL,
+			    &i218_lm_trace_buf_fops);
+	debugfs_create_file("hist", 0400, trace_dir, NULL,
+			    &i218_lm_hist_fops);
+}
+
+// No adapter is left to trace
+static void i218_lm_debugfs_exit(void)
+{
+	debugfs_remove_recursive(trace_dir);
+	i218_lm_trace_stop();
+	i218_lm_trace_free();
+}
+
+// "0000:00:19.0" or "00:19.0"
+static int i218_lm_parse_bdf(const char *s, struct i218_lm_bdf *b)
+{
+	u32 slot, fn;
+
+	if (sscanf(s, "%x:%x:%x.%x", &b->domain, &b->bus, &slot, &fn) != 4) {
+		b->domain = 0;
+		if (sscanf(s, "%x:%x.%x", &b->bus, &slot, &fn) != 3)
+			return -EINVAL;
+	}
+	if (b->bus > 0xff || slot > 0x1f || fn > 7)
+		return -EINVAL;
+	b->devfn = PCI_DEVFN(slot, fn);
+
+	return 0;
+}
+
+/*
+ * A device named in bdf= that is not in the id_table gets a dynamic
+ * ID, as vfio-pci does for ids=; probe still binds only the listed
+ * BDFs, not every device with the same vendor:device.
+ */
+static void i218_lm_add_bdf_ids(void)
+{
+	struct pci_dev *pdev;
+	int i;
+
+	for (i = 0; i < nr_bdf; i++) {
+		pdev = pci_get_domain_bus_and_slot(bdf_list[i].domain,
+						   bdf_list[i].bus,
+						   bdf_list[i].devfn);
+		if (!pdev) {
+			pr_warn("%s: no device at %s\n", DRIVER_NAME, bdf[i]);
+			continue;
+		}
+		if (i218_lm_add_dynid(pdev->vendor, pdev->device))
+			pr_warn("%s: cannot add %04x:%04x for %s\n", DRIVER_NAME,
+				pdev->vendor, pdev->device, bdf[i]);
+		pci_dev_put(pdev);
+	}
+}
+
+static int __init i218_lm_init(void)
+{
+	int i, ret;
+
+	for (i = 0; i < nr_bdf; i++) {
+		if (i218_lm_parse_bdf(bdf[i], &bdf_list[i])) {
+			pr_err("%s: bad bdf %s\n", DRIVER_NAME, bdf[i]);
+			return -EINVAL;
+		}
+	}
+	if (!is_power_of_2(trace_entries)) {
+		pr_err("%s: trace_entries %u is not a power of 2\n",
+		       DRIVER_NAME, trace_entries);
+		return -EINVAL;
+	}
+
+	i218_lm_debugfs_init();
+
+	ret = pci_register_driver(&i218_lm_driver);
+	if (ret) {
+		i218_lm_debugfs_exit();
+		return ret;
+	}
+	i218_lm_add_bdf_ids();
+
+	ret = i218_lm_mock_create();
+	if (ret) {
+		pci_unregister_driver(&i218_lm_driver);
+		i218_lm_debugfs_exit();
+		return ret;
+	}
+
+	return 0;
+}
+
+static void __exit i218_lm_exit(void)
+{
+	i218_lm_mock_destroy();
+	pci_unregister_driver(&i218_lm_driver);
+	i218_lm_debugfs_exit();
 }
 
-module_init(I218_LM_driver_init);
-module_exit(I218_LM_driver_exit);
+module_init(i218_lm_init);
+module_exit(i218_lm_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Zoran Stojsavljevic");
@@ -0,0 +1,768 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>	// open
+#include <unistd.h>	// close, pread, pwrite
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>	// the mock's device model
+#include <sched.h>	// sched_yield
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <linux/vfio.h>
+
+#include "i218_vfio.h"
+
+// IOVAs handed out from here, clear of the MSI window at 0xfee00000
+#define IOVA_BASE	0x10000000ULL
+#define HUGE_SZ		(2UL << 20)
+
+// BAR0 of the mock, the size of the real one
+#define MOCK_BAR0_LEN	(128 * 1024)
+#define MOCK_QUEUES	8
+
+struct i218_dev {
+	int mock;
+	int container;			// VFIO, -1 on the mock
+	int group;
+	int fd;
+	uint64_t config_off;		// of the config region in fd
+
+	volatile uint8_t *bar[I218_VFIO_MAX_BARS];
+	size_t bar_len[I218_VFIO_MAX_BARS];
+
+	enum i218_irq_type irq_type;
+	int nirq;
+	int irq_fd[I218_VFIO_MAX_IRQS];
+
+	// What is mapped, the mock's model looks it up on every pass
+	pthread_mutex_t dma_lock;
+	struct i218_dma dma[I218_VFIO_MAX_DMA];
+	int ndma;
+	uint64_t next_iova;
+	int small_pages;		// warned about them
+
+	// Mock only
+	pthread_t model;
+	int model_run;
+	uint64_t model_missed;		// no RX buffer posted
+	uint64_t model_faults;		// descriptor outside every DMA area
+};
+
+static const char * const irq_names[] = {
+	[I218_IRQ_NONE] = "none",
+	[I218_IRQ_MSIX] = "msix",
+	[I218_IRQ_MSI] = "msi",
+	[I218_IRQ_INTX] = "intx",
+	[I218_IRQ_MOCK] = "mock",
+};
+
+const char *i218_irq_name(enum i218_irq_type type)
+{
+	return irq_names[type];
+}
+
+static struct i218_dev *dev_alloc(void)
+{
+	struct i218_dev *dev = calloc(1, sizeof(*dev));
+
+	if (!dev)
+		return NULL;
+	dev->container = dev->group = dev->fd = -1;
+	pthread_mutex_init(&dev->dma_lock, NULL);
+	dev->next_iova = IOVA_BASE;
+	return dev;
+}
+
+// /sys/bus/pci/devices/BDF/iommu_group -> .../iommu_groups/N
+static int iommu_group_of(const char *bdf)
+{
+	char path[256], link[256];
+	ssize_t n;
+	char *p;
+
+	snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/iommu_group",
+		 bdf);
+	n = readlink(path, link, sizeof(link) - 1);
+	if (n < 0) {
+		perror(path);
+		return -1;
+	}
+	link[n] = '\0';
+	p = strrchr(link, '/');
+	return atoi(p ? p + 1 : link);
+}
+
+static int vfio_map_bars(struct i218_dev *dev)
+{
+	struct vfio_region_info reg;
+	void *base;
+	int i;
+
+	for (i = 0; i < I218_VFIO_MAX_BARS; i++) {
+		memset(&reg, 0, sizeof(reg));
+		reg.argsz = sizeof(reg);
+		reg.index = VFIO_PCI_BAR0_REGION_INDEX + i;
+		if (ioctl(dev->fd, VFIO_DEVICE_GET_REGION_INFO, &reg) < 0 ||
+		    !reg.size || !(reg.flags & VFIO_REGION_INFO_FLAG_MMAP))
+			continue;	// unused, I/O or not mappable
+
+		base = mmap(NULL, reg.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    dev->fd, reg.offset);
+		if (base == MAP_FAILED) {
+			fprintf(stderr, "BAR%d: mmap: %s\n", i, strerror(errno));
+			continue;
+		}
+		dev->bar[i] = base;
+		dev->bar_len[i] = reg.size;
+	}
+
+	if (!dev->bar[0]) {
+		fprintf(stderr, "BAR0 is not mappable\n");
+		return -1;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.argsz = sizeof(reg);
+	reg.index = VFIO_PCI_CONFIG_REGION_INDEX;
+	if (ioctl(dev->fd, VFIO_DEVICE_GET_REGION_INFO, &reg) < 0) {
+		perror("config region");
+		return -1;
+	}
+	dev->config_off = reg.offset;
+	return 0;
+}
+
+// Memory decoding and bus mastering, the device does DMA and MSI
+static int vfio_enable_master(struct i218_dev *dev)
+{
+	uint16_t cmd;
+
+	if (pread(dev->fd, &cmd, sizeof(cmd), dev->config_off + 0x04) !=
+	    sizeof(cmd))
+		return -1;
+	cmd |= 0x0006;
+	if (pwrite(dev->fd, &cmd, sizeof(cmd), dev->config_off + 0x04) !=
+	    sizeof(cmd))
+		return -1;
+	return 0;
+}
+
+/*
+ * The device must be bound to vfio-pci, alone in its IOMMU group or
+ * with the rest of the group bound too
+ */
+struct i218_dev *i218_vfio_open(const char *bdf)
+{
+	struct vfio_group_status status = { .argsz = sizeof(status) };
+	struct vfio_device_info info = { .argsz = sizeof(info) };
+	struct i218_dev *dev;
+	char path[64];
+	int group;
+
+	dev = dev_alloc();
+	if (!dev)
+		return NULL;
+
+	dev->container = open("/dev/vfio/vfio", O_RDWR);
+	if (dev->container < 0) {
+		perror("/dev/vfio/vfio");
+		goto err;
+	}
+	if (ioctl(dev->container, VFIO_GET_API_VERSION) != VFIO_API_VERSION ||
+	    !ioctl(dev->container, VFIO_CHECK_EXTENSION, VFIO_TYPE1v2_IOMMU)) {
+		fprintf(stderr, "no VFIO type1v2 IOMMU support\n");
+		goto err;
+	}
+
+	group = iommu_group_of(bdf);
+	if (group < 0)
+		goto err;
+	snprintf(path, sizeof(path), "/dev/vfio/%d", group);
+	dev->group = open(path, O_RDWR);
+	if (dev->group < 0) {
+		perror(path);
+		goto err;
+	}
+	if (ioctl(dev->group, VFIO_GROUP_GET_STATUS, &status) < 0 ||
+	    !(status.flags & VFIO_GROUP_FLAGS_VIABLE)) {
+		fprintf(stderr, "group %d is not viable, bind all its devices to vfio-pci\n",
+			group);
+		goto err;
+	}
+	if (ioctl(dev->group, VFIO_GROUP_SET_CONTAINER, &dev->container) < 0 ||
+	    ioctl(dev->container, VFIO_SET_IOMMU, VFIO_TYPE1v2_IOMMU) < 0) {
+		perror("VFIO container");
+		goto err;
+	}
+
+	dev->fd = ioctl(dev->group, VFIO_GROUP_GET_DEVICE_FD, bdf);
+	if (dev->fd < 0) {
+		perror(bdf);
+		goto err;
+	}
+	if (ioctl(dev->fd, VFIO_DEVICE_GET_INFO, &info) < 0) {
+		perror("VFIO_DEVICE_GET_INFO");
+		goto err;
+	}
+
+	// A clean device, whatever the last owner left behind
+	if (info.flags & VFIO_DEVICE_FLAGS_RESET)
+		ioctl(dev->fd, VFIO_DEVICE_RESET);
+
+	if (vfio_map_bars(dev) || vfio_enable_master(dev))
+		goto err;
+
+	return dev;
+err:
+	i218_close(dev);
+	return NULL;
+}
+
+// Under dma_lock, held for the whole pass that uses the pointer
+static void *mock_xlate(struct i218_dev *dev, uint64_t iova, size_t len)
+{
+	struct i218_dma *m;
+	int i;
+
+	for (i = 0; i < dev->ndma; i++) {
+		m = &dev->dma[i];
+		if (iova >= m->iova && iova + len <= m->iova + m->len)
+			return (uint8_t *)m->vaddr + (iova - m->iova);
+	}
+	__atomic_fetch_add(&dev->model_faults, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/*
+ * One queue of the model: the rings are found through the base and
+ * length registers, every address goes through the IOVA table, like
+ * the device behind an IOMMU. TX frames go to the next posted RX
+ * buffer, one interrupt per pass.
+ */
+static unsigned int mock_queue(struct i218_dev *dev, int q)
+{
+	volatile uint8_t *bar = dev->bar[0];
+	uint32_t tdlen = i218_rd32(bar, I218_TDLEN(q));
+	uint32_t rdlen = i218_rd32(bar, I218_RDLEN(q));
+	volatile struct i218_tx_desc *tx, *txd;
+	volatile struct i218_rx_desc *rx, *rxd;
+	uint32_t tcount, rcount, tdh, tdt, rdh, rdt;
+	unsigned int done = 0;
+	uint64_t one = 1;
+	void *src, *dst;
+	uint16_t len;
+
+	if (!tdlen || !rdlen)
+		return 0;
+	tcount = tdlen / sizeof(*tx);
+	rcount = rdlen / sizeof(*rx);
+
+	tdh = i218_rd32(bar, I218_TDH(q));
+	tdt = i218_rd32(bar, I218_TDT(q)) % tcount;
+	if (tdh == tdt)
+		return 0;
+	rdh = i218_rd32(bar, I218_RDH(q));
+	rdt = i218_rd32(bar, I218_RDT(q)) % rcount;
+
+	tx = mock_xlate(dev, (uint64_t)i218_rd32(bar, I218_TDBAH(q)) << 32 |
+			i218_rd32(bar, I218_TDBAL(q)), tdlen);
+	rx = mock_xlate(dev, (uint64_t)i218_rd32(bar, I218_RDBAH(q)) << 32 |
+			i218_rd32(bar, I218_RDBAL(q)), rdlen);
+	if (!tx || !rx)
+		return 0;
+
+	// The descriptors up to the tail are complete
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	while (tdh != tdt) {
+		txd = &tx[tdh];
+		len = txd->length;
+		src = mock_xlate(dev, txd->addr, len);
+
+		if (rdh != rdt) {
+			rxd = &rx[rdh];
+			dst = mock_xlate(dev, rxd->addr, len);
+			if (src && dst)
+				memcpy(dst, src, len);
+			rxd->length = len;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			rxd->status = I218_RXD_STAT_DD | I218_RXD_STAT_EOP;
+			rdh = (rdh + 1) % rcount;
+		} else {
+			__atomic_fetch_add(&dev->model_missed, 1,
+					   __ATOMIC_RELAXED);
+		}
+
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		txd->status = I218_TXD_STAT_DD;
+		tdh = (tdh + 1) % tcount;
+		done++;
+	}
+
+	i218_wr32(bar, I218_TDH(q), tdh);
+	i218_wr32(bar, I218_RDH(q), rdh);
+	if (dev->nirq && write(dev->irq_fd[q % dev->nirq], &one, sizeof(one)) < 0)
+		perror("mock irq");
+
+	return done;
+}
+
+// Spins like hardware, yields after a while without work
+static void *mock_model(void *arg)
+{
+	struct i218_dev *dev = arg;
+	unsigned int idle = 0, work;
+	int q;
+
+	while (__atomic_load_n(&dev->model_run, __ATOMIC_RELAXED)) {
+		for (work = 0, q = 0; q < MOCK_QUEUES; q++) {
+			// i218_dma_free() does not unmap under a pass
+			pthread_mutex_lock(&dev->dma_lock);
+			work += mock_queue(dev, q);
+			pthread_mutex_unlock(&dev->dma_lock);
+		}
+		if (work)
+			idle = 0;
+		else if (++idle > 1000)
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+// A stand-in for vfio-pci and the NIC, for tests and benchmarks
+struct i218_dev *i218_mock_open(void)
+{
+	struct i218_dev *dev;
+
+	dev = dev_alloc();
+	if (!dev)
+		return NULL;
+	dev->mock = 1;
+
+	dev->bar[0] = aligned_alloc(4096, MOCK_BAR0_LEN);
+	if (!dev->bar[0])
+		goto err;
+	memset((void *)dev->bar[0], 0, MOCK_BAR0_LEN);
+	dev->bar_len[0] = MOCK_BAR0_LEN;
+	// Link up, full duplex, 1000 Mb/s
+	i218_wr32(dev->bar[0], I218_STATUS, 0x00000083);
+
+	dev->model_run = 1;
+	if (pthread_create(&dev->model, NULL, mock_model, dev)) {
+		dev->model_run = 0;
+		goto err;
+	}
+
+	return dev;
+err:
+	i218_close(dev);
+	return NULL;
+}
+
+void i218_close(struct i218_dev *dev)
+{
+	int i;
+
+	if (!dev)
+		return;
+
+	if (dev->model_run) {
+		__atomic_store_n(&dev->model_run, 0, __ATOMIC_RELAXED);
+		pthread_join(dev->model, NULL);
+	}
+
+	while (dev->ndma)
+		i218_dma_free(dev, &dev->dma[dev->ndma - 1]);
+
+	for (i = 0; i < dev->nirq; i++)
+		close(dev->irq_fd[i]);
+
+	for (i = 0; i < I218_VFIO_MAX_BARS; i++) {
+		if (!dev->bar[i])
+			continue;
+		if (dev->mock)
+			free((void *)dev->bar[i]);
+		else
+			munmap((void *)dev->bar[i], dev->bar_len[i]);
+	}
+
+	if (dev->fd >= 0)
+		close(dev->fd);
+	if (dev->group >= 0)
+		close(dev->group);
+	if (dev->container >= 0)
+		close(dev->container);
+	pthread_mutex_destroy(&dev->dma_lock);
+	free(dev);
+}
+
+volatile uint8_t *i218_bar(struct i218_dev *dev, int bar, size_t *len)
+{
+	if (bar < 0 || bar >= I218_VFIO_MAX_BARS)
+		return NULL;
+	if (len)
+		*len = dev->bar_len[bar];
+	return dev->bar[bar];
+}
+
+/*
+ * len bytes, rounded up to 2 MiB hugepages when there are any (else
+ * plain pages, with a warning: more IOTLB misses), mapped for the
+ * device at the next free IOVA. VFIO pins the pages.
+ */
+int i218_dma_alloc(struct i218_dev *dev, size_t len, struct i218_dma *mem)
+{
+	struct vfio_iommu_type1_dma_map map = { .argsz = sizeof(map) };
+	int huge = 1, ret = -1;
+	void *va;
+
+	len = (len + HUGE_SZ - 1) & ~(HUGE_SZ - 1);
+	va = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+		  -1, 0);
+	if (va == MAP_FAILED) {
+		if (!__atomic_exchange_n(&dev->small_pages, 1, __ATOMIC_RELAXED))
+			fprintf(stderr, "no hugepages (vm.nr_hugepages), using 4 KiB pages\n");
+		huge = 0;
+		va = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (va == MAP_FAILED) {
+			perror("mmap");
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&dev->dma_lock);
+	if (dev->ndma == I218_VFIO_MAX_DMA)
+		goto out;
+
+	if (!dev->mock) {
+		map.flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE;
+		map.vaddr = (uintptr_t)va;
+		map.iova = dev->next_iova;
+		map.size = len;
+		if (ioctl(dev->container, VFIO_IOMMU_MAP_DMA, &map) < 0) {
+			perror("VFIO_IOMMU_MAP_DMA");
+			goto out;
+		}
+	}
+
+	mem->vaddr = va;
+	mem->iova = dev->next_iova;
+	mem->len = len;
+	mem->huge = huge;
+	dev->next_iova += len;
+	dev->dma[dev->ndma++] = *mem;
+	ret = 0;
+out:
+	pthread_mutex_unlock(&dev->dma_lock);
+	if (ret)
+		munmap(va, len);
+	return ret;
+}
+
+void i218_dma_free(struct i218_dev *dev, struct i218_dma *mem)
+{
+	struct vfio_iommu_type1_dma_unmap unmap = { .argsz = sizeof(unmap) };
+	struct i218_dma m = *mem;	// mem may be in dev->dma
+	int i;
+
+	/*
+	 * Out of the table under the lock: a model pass in progress is
+	 * done with it, the next ones fault on it rather than touching
+	 * unmapped memory
+	 */
+	pthread_mutex_lock(&dev->dma_lock);
+	for (i = 0; i < dev->ndma; i++)
+		if (dev->dma[i].iova == m.iova)
+			break;
+	if (i == dev->ndma) {
+		pthread_mutex_unlock(&dev->dma_lock);
+		return;
+	}
+	dev->dma[i] = dev->dma[--dev->ndma];
+	pthread_mutex_unlock(&dev->dma_lock);
+
+	if (!dev->mock) {
+		unmap.iova = m.iova;
+		unmap.size = m.len;
+		if (ioctl(dev->container, VFIO_IOMMU_UNMAP_DMA, &unmap) < 0)
+			perror("VFIO_IOMMU_UNMAP_DMA");
+	}
+	munmap(m.vaddr, m.len);
+}
+
+static int vfio_set_irqs(struct i218_dev *dev, int index, int n)
+{
+	size_t sz = sizeof(struct vfio_irq_set) + n * sizeof(int);
+	struct vfio_irq_set *set = calloc(1, sz);
+	int ret;
+
+	if (!set)
+		return -1;
+	set->argsz = sz;
+	set->flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER;
+	set->index = index;
+	set->start = 0;
+	set->count = n;
+	memcpy(set->data, dev->irq_fd, n * sizeof(int));
+	ret = ioctl(dev->fd, VFIO_DEVICE_SET_IRQS, set);
+	free(set);
+	return ret;
+}
+
+int i218_irq_enable(struct i218_dev *dev, int nvec)
+{
+	static const struct {
+		int index;
+		enum i218_irq_type type;
+	} order[] = {
+		{ VFIO_PCI_MSIX_IRQ_INDEX, I218_IRQ_MSIX },
+		{ VFIO_PCI_MSI_IRQ_INDEX, I218_IRQ_MSI },
+		{ VFIO_PCI_INTX_IRQ_INDEX, I218_IRQ_INTX },
+	};
+	struct vfio_irq_info info;
+	unsigned int i;
+	int n, v;
+
+	if (nvec < 1 || nvec > I218_VFIO_MAX_IRQS || dev->nirq)
+		return -1;
+
+	if (dev->mock) {
+		for (v = 0; v < nvec; v++) {
+			dev->irq_fd[v] = eventfd(0, EFD_CLOEXEC);
+			if (dev->irq_fd[v] < 0)
+				return -1;
+			dev->nirq = v + 1;
+		}
+		dev->irq_type = I218_IRQ_MOCK;
+		return nvec;
+	}
+
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+		memset(&info, 0, sizeof(info));
+		info.argsz = sizeof(info);
+		info.index = order[i].index;
+		if (ioctl(dev->fd, VFIO_DEVICE_GET_IRQ_INFO, &info) < 0 ||
+		    !info.count)
+			continue;
+
+		n = nvec < (int)info.count ? nvec : (int)info.count;
+		for (v = 0; v < n; v++) {
+			dev->irq_fd[v] = eventfd(0, EFD_CLOEXEC);
+			if (dev->irq_fd[v] < 0)
+				return -1;
+			dev->nirq = v + 1;
+		}
+		if (!vfio_set_irqs(dev, order[i].index, n)) {
+			dev->irq_type = order[i].type;
+			return n;
+		}
+		for (v = 0; v < n; v++)
+			close(dev->irq_fd[v]);
+		dev->nirq = 0;
+	}
+
+	fprintf(stderr, "no interrupt type could be enabled\n");
+	return -1;
+}
+
+int i218_irq_fd(struct i218_dev *dev, int vec)
+{
+	return vec < dev->nirq ? dev->irq_fd[vec] : -1;
+}
+
+enum i218_irq_type i218_irq_type(struct i218_dev *dev)
+{
+	return dev->irq_type;
+}
+
+int i218_irq_wait(struct i218_dev *dev, int vec, int timeout_ms)
+{
+	struct vfio_irq_set unmask = {
+		.argsz = sizeof(unmask),
+		.flags = VFIO_IRQ_SET_DATA_NONE | VFIO_IRQ_SET_ACTION_UNMASK,
+		.index = VFIO_PCI_INTX_IRQ_INDEX,
+		.count = 1,
+	};
+	struct pollfd pfd = { .fd = i218_irq_fd(dev, vec), .events = POLLIN };
+	uint64_t n;
+
+	if (pfd.fd < 0 || poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+	if (read(pfd.fd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+
+	// vfio-pci masks a level triggered INTx until it is unmasked
+	if (dev->irq_type == I218_IRQ_INTX)
+		ioctl(dev->fd, VFIO_DEVICE_SET_IRQS, &unmask);
+
+	return n;
+}
+
+size_t i218_ring_dma_len(uint32_t count)
+{
+	return count * (sizeof(struct i218_tx_desc) +
+			sizeof(struct i218_rx_desc) + 2 * I218_BUF_LEN);
+}
+
+// count a power of 2; all but one RX buffer posted
+int i218_ring_init(struct i218_ring *ring, struct i218_dev *dev,
+		   struct i218_dma *mem, int idx, uint32_t count,
+		   uint32_t batch)
+{
+	uint64_t tx_iova, rx_iova;
+	volatile uint8_t *bar0 = i218_bar(dev, 0, NULL);
+	uint8_t *va = mem->vaddr;
+	uint32_t i;
+
+	if (!count || (count & (count - 1)) || mem->len < i218_ring_dma_len(count))
+		return -1;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->dev = dev;
+	ring->bar0 = bar0;
+	ring->idx = idx;
+	ring->count = count;
+	ring->batch = batch ? batch : 1;
+
+	ring->tx = (void *)va;
+	tx_iova = mem->iova;
+	ring->rx = (void *)(va + count * sizeof(struct i218_tx_desc));
+	rx_iova = tx_iova + count * sizeof(struct i218_tx_desc);
+	ring->tx_buf = (uint8_t *)ring->rx + count * sizeof(struct i218_rx_desc);
+	ring->tx_buf_iova = rx_iova + count * sizeof(struct i218_rx_desc);
+	ring->rx_buf = ring->tx_buf + count * I218_BUF_LEN;
+	ring->rx_buf_iova = ring->tx_buf_iova + count * I218_BUF_LEN;
+
+	memset(va, 0, i218_ring_dma_len(count));
+	for (i = 0; i < count; i++)
+		ring->rx[i].addr = ring->rx_buf_iova + i * I218_BUF_LEN;
+
+	i218_wr32(bar0, I218_TDBAL(idx), (uint32_t)tx_iova);
+	i218_wr32(bar0, I218_TDBAH(idx), tx_iova >> 32);
+	i218_wr32(bar0, I218_TDH(idx), 0);
+	i218_wr32(bar0, I218_TDT(idx), 0);
+	i218_wr32(bar0, I218_RDBAL(idx), (uint32_t)rx_iova);
+	i218_wr32(bar0, I218_RDBAH(idx), rx_iova >> 32);
+	i218_wr32(bar0, I218_RDH(idx), 0);
+	i218_wr32(bar0, I218_RDT(idx), 0);
+	// The length last: the mock model takes a ring with a length as live
+	i218_wr32(bar0, I218_TDLEN(idx), count * sizeof(struct i218_tx_desc));
+	i218_wr32(bar0, I218_RDLEN(idx), count * sizeof(struct i218_rx_desc));
+
+	ring->rx_ntu = count - 1;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	i218_wr32(bar0, I218_RDT(idx), ring->rx_ntu);
+
+	return 0;
+}
+
+uint8_t *i218_ring_tx_buf(struct i218_ring *ring)
+{
+	if (ring->tx_ntu - ring->tx_ntc == ring->count - 1)
+		return NULL;
+	return ring->tx_buf + (ring->tx_ntu & (ring->count - 1)) * I218_BUF_LEN;
+}
+
+void i218_ring_tx_doorbell(struct i218_ring *ring)
+{
+	if (!ring->tx_pending)
+		return;
+
+	// Descriptors first, then the tail the device acts on
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	i218_wr32(ring->bar0, I218_TDT(ring->idx),
+		  ring->tx_ntu & (ring->count - 1));
+	ring->tx_pending = 0;
+	ring->tx_doorbells++;
+}
+
+// After i218_ring_tx_buf() gave a buffer and it was filled
+void i218_ring_xmit(struct i218_ring *ring, uint16_t len)
+{
+	uint32_t i = ring->tx_ntu & (ring->count - 1);
+	volatile struct i218_tx_desc *desc = &ring->tx[i];
+
+	desc->addr = ring->tx_buf_iova + i * I218_BUF_LEN;
+	desc->length = len;
+	desc->cmd = I218_TXD_CMD_EOP | I218_TXD_CMD_IFCS | I218_TXD_CMD_RS;
+	desc->status = 0;
+	ring->tx_ntu++;
+
+	if (++ring->tx_pending >= ring->batch)
+		i218_ring_tx_doorbell(ring);
+}
+
+unsigned int i218_ring_clean_tx(struct i218_ring *ring)
+{
+	unsigned int done = 0;
+
+	while (ring->tx_ntc != ring->tx_ntu) {
+		if (!(ring->tx[ring->tx_ntc & (ring->count - 1)].status &
+		      I218_TXD_STAT_DD))
+			break;
+		ring->tx_ntc++;
+		done++;
+	}
+	ring->tx_done += done;
+	return done;
+}
+
+static void i218_ring_rx_doorbell(struct i218_ring *ring)
+{
+	if (!ring->rx_pending)
+		return;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	i218_wr32(ring->bar0, I218_RDT(ring->idx),
+		  ring->rx_ntu & (ring->count - 1));
+	ring->rx_pending = 0;
+	ring->rx_doorbells++;
+}
+
+// Every received frame to cb, then its buffer goes back to the ring
+unsigned int i218_ring_rx(struct i218_ring *ring,
+			  void (*cb)(void *arg, uint8_t *data, uint16_t len),
+			  void *arg)
+{
+	volatile struct i218_rx_desc *desc;
+	unsigned int done = 0;
+	uint32_t i;
+
+	for (;;) {
+		i = ring->rx_ntc & (ring->count - 1);
+		desc = &ring->rx[i];
+		if (!(desc->status & I218_RXD_STAT_DD))
+			break;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (cb)
+			cb(arg, ring->rx_buf + i * I218_BUF_LEN, desc->length);
+		ring->rx_bytes += desc->length;
+		desc->status = 0;
+		ring->rx_ntc++;
+		done++;
+
+		ring->rx_ntu++;
+		if (++ring->rx_pending >= ring->batch)
+			i218_ring_rx_doorbell(ring);
+	}
+	i218_ring_rx_doorbell(ring);
+
+	ring->rx_done += done;
+	return done;
+}
+
+uint64_t i218_mock_missed(struct i218_dev *dev)
+{
+	return __atomic_load_n(&dev->model_missed, __ATOMIC_RELAXED);
+}
+
+uint64_t i218_mock_faults(struct i218_dev *dev)
+{
+	return __atomic_load_n(&dev->model_faults, __ATOMIC_RELAXED);
+}
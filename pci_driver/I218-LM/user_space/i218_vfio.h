@@ -0,0 +1,155 @@
+#ifndef I218_VFIO_H
+#define I218_VFIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * User space driver for the I218-LM through VFIO, the DPDK/SPDK way:
+ * the device is bound to vfio-pci, its BARs are mmapped, DMA memory
+ * is hugepages mapped into the IOMMU, and interrupts arrive on
+ * eventfds. The mock backend stands in for vfio-pci and the NIC: the
+ * BAR is plain memory and a device model thread consumes the rings
+ * through their IOVAs.
+ */
+
+#define I218_VFIO_MAX_BARS	6
+#define I218_VFIO_MAX_IRQS	8
+#define I218_VFIO_MAX_DMA	16
+
+// BAR0 registers, the e1000e layout
+#define I218_STATUS	0x0008
+#define I218_ICR	0x00C0
+#define I218_IMS	0x00D0
+#define I218_IMC	0x00D8
+#define I218_RDBAL(n)	(0x02800 + (n) * 0x100)
+#define I218_RDBAH(n)	(0x02804 + (n) * 0x100)
+#define I218_RDLEN(n)	(0x02808 + (n) * 0x100)
+#define I218_RDH(n)	(0x02810 + (n) * 0x100)
+#define I218_RDT(n)	(0x02818 + (n) * 0x100)
+#define I218_TDBAL(n)	(0x03800 + (n) * 0x100)
+#define I218_TDBAH(n)	(0x03804 + (n) * 0x100)
+#define I218_TDLEN(n)	(0x03808 + (n) * 0x100)
+#define I218_TDH(n)	(0x03810 + (n) * 0x100)
+#define I218_TDT(n)	(0x03818 + (n) * 0x100)
+
+// Legacy descriptors, as in the kernel driver
+struct i218_tx_desc {
+	uint64_t addr;
+	uint16_t length;
+	uint8_t cso;
+	uint8_t cmd;
+	uint8_t status;
+	uint8_t css;
+	uint16_t special;
+};
+
+#define I218_TXD_CMD_EOP	0x01
+#define I218_TXD_CMD_IFCS	0x02
+#define I218_TXD_CMD_RS		0x08
+#define I218_TXD_STAT_DD	0x01
+
+struct i218_rx_desc {
+	uint64_t addr;
+	uint16_t length;
+	uint16_t csum;
+	uint8_t status;
+	uint8_t errors;
+	uint16_t special;
+};
+
+#define I218_RXD_STAT_DD	0x01
+#define I218_RXD_STAT_EOP	0x02
+
+#define I218_BUF_LEN		2048
+
+// DMA memory: where the CPU sees it and where the device does
+struct i218_dma {
+	void *vaddr;
+	uint64_t iova;
+	size_t len;
+	int huge;		// backed by 2 MiB pages
+};
+
+enum i218_irq_type {
+	I218_IRQ_NONE,
+	I218_IRQ_MSIX,
+	I218_IRQ_MSI,
+	I218_IRQ_INTX,
+	I218_IRQ_MOCK,
+};
+
+struct i218_dev;
+
+struct i218_dev *i218_vfio_open(const char *bdf);
+struct i218_dev *i218_mock_open(void);
+void i218_close(struct i218_dev *dev);
+
+volatile uint8_t *i218_bar(struct i218_dev *dev, int bar, size_t *len);
+int i218_dma_alloc(struct i218_dev *dev, size_t len, struct i218_dma *mem);
+void i218_dma_free(struct i218_dev *dev, struct i218_dma *mem);
+
+// nvec eventfds, MSI-X first, then MSI, then INTx; returns the count
+int i218_irq_enable(struct i218_dev *dev, int nvec);
+int i218_irq_fd(struct i218_dev *dev, int vec);
+enum i218_irq_type i218_irq_type(struct i218_dev *dev);
+// Wait up to timeout_ms, ack; returns the interrupts seen, 0 on timeout
+int i218_irq_wait(struct i218_dev *dev, int vec, int timeout_ms);
+const char *i218_irq_name(enum i218_irq_type type);
+
+// Mock only: frames the model had no RX buffer for, bad DMA addresses
+uint64_t i218_mock_missed(struct i218_dev *dev);
+uint64_t i218_mock_faults(struct i218_dev *dev);
+
+// bar from i218_bar(), fetched once
+static inline uint32_t i218_rd32(volatile uint8_t *bar, uint32_t reg)
+{
+	return *(volatile uint32_t *)(bar + reg);
+}
+
+static inline void i218_wr32(volatile uint8_t *bar, uint32_t reg, uint32_t v)
+{
+	*(volatile uint32_t *)(bar + reg) = v;
+}
+
+/*
+ * A TX/RX ring pair in one DMA area: both descriptor rings, then
+ * count TX and count RX buffers. The counters run freely, the slot is
+ * counter & (count - 1). Single threaded: post and clean from one
+ * thread, the device (or the model) is the only other party.
+ */
+struct i218_ring {
+	struct i218_dev *dev;
+	volatile uint8_t *bar0;
+	int idx;
+	uint32_t count;
+	uint32_t batch;			// frames per doorbell
+
+	volatile struct i218_tx_desc *tx;
+	volatile struct i218_rx_desc *rx;
+	uint8_t *tx_buf;
+	uint8_t *rx_buf;
+	uint64_t tx_buf_iova;
+	uint64_t rx_buf_iova;
+
+	uint32_t tx_ntu, tx_ntc, tx_pending;
+	uint32_t rx_ntu, rx_ntc, rx_pending;
+
+	uint64_t tx_done, rx_done, rx_bytes;
+	uint64_t tx_doorbells, rx_doorbells;
+};
+
+size_t i218_ring_dma_len(uint32_t count);
+int i218_ring_init(struct i218_ring *ring, struct i218_dev *dev,
+		   struct i218_dma *mem, int idx, uint32_t count,
+		   uint32_t batch);
+// The buffer of the next TX slot, NULL while the ring is full
+uint8_t *i218_ring_tx_buf(struct i218_ring *ring);
+void i218_ring_xmit(struct i218_ring *ring, uint16_t len);
+void i218_ring_tx_doorbell(struct i218_ring *ring);
+unsigned int i218_ring_clean_tx(struct i218_ring *ring);
+unsigned int i218_ring_rx(struct i218_ring *ring,
+			  void (*cb)(void *arg, uint8_t *data, uint16_t len),
+			  void *arg);
+
+#endif
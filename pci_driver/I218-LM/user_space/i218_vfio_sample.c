@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	// getopt
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>	// sched_yield
+
+#include "i218_vfio.h"
+
+/*
+ * Sample for the i218_vfio library. With -s BDF it claims the NIC
+ * through vfio-pci, maps BAR0 and DMA memory, programs ring 0 and
+ * enables the interrupts; the MAC is not brought up, so it sends
+ * nothing. Without -s it runs against the mock: frames loop from the
+ * TX ring to the RX ring through the device model, each one carries
+ * a sequence number that is checked on the way back.
+ */
+
+struct rx_check {
+	uint32_t next;		// sequence number expected
+	uint64_t bad;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void rx_frame(void *arg, uint8_t *data, uint16_t len)
+{
+	struct rx_check *chk = arg;
+	uint32_t seq;
+
+	memcpy(&seq, data + 14, sizeof(seq));	// after the Ethernet header
+	if (seq != chk->next)
+		chk->bad++;
+	// Dropped frames leave gaps, pick up after them
+	chk->next = seq + 1;
+	(void)len;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s BDF] [-n FRAMES] [-b BATCH] [-l LEN] [-r RING] [-p]\n"
+		"  -s BDF    device bound to vfio-pci, else the mock\n"
+		"  -n        frames to send, 1000000\n"
+		"  -b        frames per doorbell, 32\n"
+		"  -l        frame length, 64\n"
+		"  -r        descriptors per ring, power of 2, 256\n"
+		"  -p        busy poll the rings, no interrupts\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t batch = 32, len = 64, ring_size = 256;
+	uint64_t frames = 1000000, sent = 0, irqs = 0, t;
+	struct rx_check chk = { 0 };
+	const char *bdf = NULL;
+	struct i218_ring ring;
+	struct i218_dma mem;
+	struct i218_dev *dev;
+	volatile uint8_t *bar0;
+	size_t bar_len;
+	int opt, poll_mode = 0, nvec = 0, ret = EXIT_FAILURE;
+	uint8_t *buf;
+
+	while ((opt = getopt(argc, argv, "s:n:b:l:r:ph")) != -1) {
+		switch (opt) {
+		case 's':
+			bdf = optarg;
+			break;
+		case 'n':
+			frames = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			len = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			ring_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			poll_mode = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!frames || !batch || len < 60 || len > I218_BUF_LEN) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	dev = bdf ? i218_vfio_open(bdf) : i218_mock_open();
+	if (!dev)
+		return EXIT_FAILURE;
+
+	bar0 = i218_bar(dev, 0, &bar_len);
+	printf("%s: BAR0 %zu bytes, STATUS 0x%08x\n", bdf ? bdf : "mock",
+	       bar_len, i218_rd32(bar0, I218_STATUS));
+
+	if (i218_dma_alloc(dev, i218_ring_dma_len(ring_size), &mem) ||
+	    i218_ring_init(&ring, dev, &mem, 0, ring_size, batch)) {
+		fprintf(stderr, "ring setup failed\n");
+		goto out;
+	}
+	printf("ring 0: %u descriptors at IOVA 0x%llx, %zu bytes of %s pages\n",
+	       ring_size, (unsigned long long)mem.iova, mem.len,
+	       mem.huge ? "2 MiB" : "4 KiB");
+
+	if (!poll_mode) {
+		nvec = i218_irq_enable(dev, 1);
+		if (nvec < 1)
+			goto out;
+		printf("interrupts: %d %s vector(s), eventfd %d\n", nvec,
+		       i218_irq_name(i218_irq_type(dev)), i218_irq_fd(dev, 0));
+	}
+
+	if (bdf) {
+		printf("the MAC is not initialised, no traffic on the hardware\n");
+		ret = EXIT_SUCCESS;
+		goto out;
+	}
+
+	t = now_ns();
+	while (ring.tx_done < frames ||
+	       ring.rx_done + i218_mock_missed(dev) < frames) {
+		while (sent < frames && (buf = i218_ring_tx_buf(&ring))) {
+			memset(buf, 0xff, 14);
+			memcpy(buf + 14, &sent, sizeof(uint32_t));
+			i218_ring_xmit(&ring, len);
+			sent++;
+		}
+		// The rest of a batch, or the ring would wait for it
+		i218_ring_tx_doorbell(&ring);
+
+		if (i218_ring_clean_tx(&ring) + i218_ring_rx(&ring, rx_frame, &chk))
+			continue;
+
+		// Nothing done yet: sleep until the device says so
+		if (!poll_mode) {
+			int n = i218_irq_wait(dev, 0, 1000);
+
+			if (!n) {
+				fprintf(stderr, "no interrupt in 1 s\n");
+				goto out;
+			}
+			irqs += n;
+		} else {
+			// The mock's model may share this CPU
+			sched_yield();
+		}
+	}
+	t = now_ns() - t;
+
+	printf("mode,batch,len,frames,mpps,doorbells_per_pkt,irqs_per_pkt,missed,bad\n");
+	printf("%s,%u,%u,%llu,%.3f,%.3f,%.3f,%llu,%llu\n",
+	       poll_mode ? "poll" : "irq", batch, len,
+	       (unsigned long long)frames, (double)frames * 1000 / t,
+	       (double)(ring.tx_doorbells + ring.rx_doorbells) / frames,
+	       (double)irqs / frames,
+	       (unsigned long long)i218_mock_missed(dev),
+	       (unsigned long long)chk.bad);
+
+	if (!chk.bad && !i218_mock_faults(dev))
+		ret = EXIT_SUCCESS;
+out:
+	i218_close(dev);
+	return ret;
+}
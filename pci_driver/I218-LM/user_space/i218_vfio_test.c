@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>	// sched_yield
+#include <pthread.h>	// the alloc/free churn
+
+#include "i218_vfio.h"
+
+/*
+ * Self-checking test of the i218_vfio ring and DMA code against the
+ * mock: DMA areas and their IOVAs, translation by the model (frames
+ * arrive intact, a bad address counts as a fault), a full TX ring,
+ * the ring counters wrapping many times, and DMA areas allocated and
+ * freed while the model moves frames. A test stops at its first
+ * failed check; the exit status is non-zero if any test failed.
+ */
+
+#define HUGE_SZ		(2UL << 20)
+
+static int failed;
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed = 1;						\
+		goto out;						\
+	}								\
+} while (0)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct rx_check {
+	uint32_t next;		// sequence number expected
+	uint32_t len;
+	uint64_t bad;
+};
+
+static void rx_frame(void *arg, uint8_t *data, uint16_t len)
+{
+	struct rx_check *chk = arg;
+	uint32_t seq;
+
+	memcpy(&seq, data, sizeof(seq));
+	if (seq != chk->next || len != chk->len)
+		chk->bad++;
+	chk->next = seq + 1;
+}
+
+/*
+ * What is posted already, then frames more through the ring, each one
+ * numbered; 0 once all of them came back in order, -1 after 5 s
+ */
+static int loop_frames(struct i218_ring *ring, uint32_t frames,
+		       struct rx_check *chk)
+{
+	uint64_t tx_end = ring->tx_done + (ring->tx_ntu - ring->tx_ntc) + frames;
+	uint64_t rx_end = ring->rx_done + (ring->tx_ntu - ring->rx_ntc) + frames;
+	uint64_t deadline = now_ns() + 5000000000ULL;
+	uint32_t sent = 0, seq;
+	unsigned int n;
+	uint8_t *buf;
+
+	while (ring->tx_done < tx_end || ring->rx_done < rx_end) {
+		while (sent < frames && (buf = i218_ring_tx_buf(ring))) {
+			seq = chk->next + (uint32_t)(ring->tx_ntu - ring->rx_ntc);
+			memcpy(buf, &seq, sizeof(seq));
+			i218_ring_xmit(ring, chk->len);
+			sent++;
+		}
+		i218_ring_tx_doorbell(ring);
+		n = i218_ring_clean_tx(ring);
+		n += i218_ring_rx(ring, rx_frame, chk);
+		if (!n)
+			sched_yield();
+		if (now_ns() > deadline)
+			return -1;
+	}
+	return chk->bad ? -1 : 0;
+}
+
+static int test_dma(void)
+{
+	struct i218_dma mem[I218_VFIO_MAX_DMA], extra;
+	struct i218_dev *dev = i218_mock_open();
+	int i;
+
+	CHECK(dev);
+
+	// Rounded up to 2 MiB, back to back in IOVA space
+	for (i = 0; i < I218_VFIO_MAX_DMA; i++) {
+		CHECK(!i218_dma_alloc(dev, i ? 4096 : HUGE_SZ + 1, &mem[i]));
+		CHECK(mem[i].len == (i ? HUGE_SZ : 2 * HUGE_SZ));
+		CHECK(!(mem[i].iova & (HUGE_SZ - 1)));
+		if (i)
+			CHECK(mem[i].iova == mem[i - 1].iova + mem[i - 1].len);
+	}
+	CHECK(i218_dma_alloc(dev, 4096, &extra) < 0);
+
+	// A freed slot can be used again, at a new IOVA
+	i218_dma_free(dev, &mem[3]);
+	CHECK(!i218_dma_alloc(dev, 4096, &mem[3]));
+	CHECK(mem[3].iova > mem[I218_VFIO_MAX_DMA - 1].iova);
+
+	for (i = 0; i < I218_VFIO_MAX_DMA; i++)
+		i218_dma_free(dev, &mem[i]);
+	// Twice is harmless
+	i218_dma_free(dev, &mem[0]);
+out:
+	i218_close(dev);
+	return failed;
+}
+
+/*
+ * The ring sits in the last DMA area, the one i218_dma_free() moves
+ * into the freed slot: the model must still find it
+ */
+static int test_xlate(void)
+{
+	struct rx_check chk = { .len = 64 };
+	struct i218_dma pad, mem;
+	struct i218_ring ring;
+	struct i218_dev *dev = i218_mock_open();
+	uint8_t *buf;
+	uint32_t i;
+
+	CHECK(dev);
+	CHECK(!i218_dma_alloc(dev, 4096, &pad));
+	CHECK(!i218_dma_alloc(dev, i218_ring_dma_len(64), &mem));
+	i218_dma_free(dev, &pad);
+
+	CHECK(!i218_ring_init(&ring, dev, &mem, 0, 64, 1));
+	CHECK(!loop_frames(&ring, 1000, &chk));
+	CHECK(!i218_mock_faults(dev) && !i218_mock_missed(dev));
+
+	// A TX buffer outside every DMA area: a fault, nothing copied
+	CHECK(buf = i218_ring_tx_buf(&ring));
+	memset(buf, 0, 64);
+	i = ring.tx_ntu & (ring.count - 1);
+	ring.batch = 2;
+	i218_ring_xmit(&ring, 64);
+	ring.tx[i].addr = 0xdead0000;
+	i218_ring_tx_doorbell(&ring);
+	while (!i218_ring_clean_tx(&ring))
+		sched_yield();
+	CHECK(i218_mock_faults(dev) == 1);
+out:
+	i218_close(dev);
+	return failed;
+}
+
+// Full at count - 1 frames, then the counters go round many times
+static int test_ring_wrap(void)
+{
+	struct rx_check chk = { .len = 60 };
+	struct i218_ring ring;
+	struct i218_dma mem;
+	struct i218_dev *dev = i218_mock_open();
+	uint32_t i;
+
+	CHECK(dev);
+	CHECK(!i218_dma_alloc(dev, i218_ring_dma_len(64), &mem));
+	CHECK(i218_ring_init(&ring, dev, &mem, 0, 48, 8) < 0);
+	CHECK(i218_ring_init(&ring, dev, &mem, 1, 64, 1000) == 0);
+
+	// No doorbell yet, the model sees nothing
+	for (i = 0; i < 63; i++) {
+		CHECK(i218_ring_tx_buf(&ring));
+		memcpy(i218_ring_tx_buf(&ring), &i, sizeof(i));
+		i218_ring_xmit(&ring, chk.len);
+	}
+	CHECK(!i218_ring_tx_buf(&ring));
+	CHECK(!ring.tx_doorbells);
+
+	i218_ring_tx_doorbell(&ring);
+	ring.batch = 8;
+	CHECK(!loop_frames(&ring, 0, &chk));
+	CHECK(chk.next == 63 && ring.rx_done == 63);
+
+	CHECK(!loop_frames(&ring, 64 * 100 + 5, &chk));
+	CHECK(ring.tx_ntu == 63 + 64 * 100 + 5 && ring.rx_ntc == ring.tx_ntu);
+	CHECK(!i218_mock_faults(dev) && !i218_mock_missed(dev));
+out:
+	i218_close(dev);
+	return failed;
+}
+
+struct churn {
+	struct i218_dev *dev;
+	int stop;
+	uint64_t rounds;
+};
+
+static void *churn_dma(void *arg)
+{
+	struct churn *c = arg;
+	struct i218_dma mem;
+
+	while (!__atomic_load_n(&c->stop, __ATOMIC_RELAXED)) {
+		if (i218_dma_alloc(c->dev, 4096, &mem))
+			break;
+		i218_dma_free(c->dev, &mem);
+		c->rounds++;
+	}
+	return NULL;
+}
+
+// The model's table lookups against another thread's alloc and free
+static int test_churn(void)
+{
+	struct rx_check chk = { .len = 128 };
+	struct churn c = { 0 };
+	struct i218_ring ring;
+	struct i218_dma mem;
+	pthread_t t;
+	int running = 0;
+
+	c.dev = i218_mock_open();
+	CHECK(c.dev);
+	CHECK(!i218_dma_alloc(c.dev, i218_ring_dma_len(256), &mem));
+	CHECK(!i218_ring_init(&ring, c.dev, &mem, 2, 256, 16));
+	CHECK(!pthread_create(&t, NULL, churn_dma, &c));
+	running = 1;
+
+	CHECK(!loop_frames(&ring, 200000, &chk));
+	CHECK(!i218_mock_faults(c.dev) && !i218_mock_missed(c.dev));
+out:
+	if (running) {
+		__atomic_store_n(&c.stop, 1, __ATOMIC_RELAXED);
+		pthread_join(t, NULL);
+		if (!c.rounds) {
+			fprintf(stderr, "churn: no DMA area allocated\n");
+			failed = 1;
+		}
+	}
+	i218_close(c.dev);
+	return failed;
+}
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		int (*fn)(void);
+	} tests[] = {
+		{ "dma", test_dma },
+		{ "xlate", test_xlate },
+		{ "ring_wrap", test_ring_wrap },
+		{ "churn", test_churn },
+	};
+	unsigned int i;
+	int ret = EXIT_SUCCESS;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		failed = 0;
+		if (tests[i].fn()) {
+			printf("FAIL %s\n", tests[i].name);
+			ret = EXIT_FAILURE;
+		} else {
+			printf("ok   %s\n", tests[i].name);
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>	// open
+#include <unistd.h>	// pread, close
+#include <dirent.h>	// the device list
+#include <pthread.h>
+
+#include "pci_cfg.h"
+
+// Snapshot file: header, then one record per device
+#define SNAP_MAGIC	0x47464350	// "PCFG"
+#define SNAP_VERSION	1
+
+struct snap_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t count;
+};
+
+/*
+ * Only the bytes up to the last non-zero dword are stored: most of
+ * the 4 KiB is zero, a device is some 300 bytes instead of 4 KiB.
+ */
+struct snap_rec {
+	char bdf[PCI_CFG_BDF_LEN];
+	uint16_t len;			// as read
+	uint16_t stored;		// bytes following, the rest is zero
+};
+
+// A whole read: the kernel does the dword accesses, one syscall
+int pci_cfg_read(const char *bdf, struct pci_cfg *cfg)
+{
+	char path[256];
+	ssize_t n;
+	int fd;
+
+	memset(cfg, 0, sizeof(*cfg));
+	snprintf(cfg->bdf, sizeof(cfg->bdf), "%s", bdf);
+	snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/config", bdf);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = pread(fd, cfg->data, sizeof(cfg->data), 0);
+	close(fd);
+	if (n < 64)
+		return -1;
+
+	cfg->len = n;
+	return 0;
+}
+
+static const struct {
+	uint16_t id;
+	uint8_t ext;
+	const char *name;
+} cap_names[] = {
+	{ PCI_CAP_PM, 0, "Power Management" },
+	{ 0x03, 0, "VPD" },
+	{ PCI_CAP_MSI, 0, "MSI" },
+	{ 0x09, 0, "Vendor Specific" },
+	{ 0x0d, 0, "Bridge Subsystem VID" },
+	{ PCI_CAP_EXP, 0, "PCI Express" },
+	{ PCI_CAP_MSIX, 0, "MSI-X" },
+	{ 0x12, 0, "SATA" },
+	{ 0x13, 0, "Advanced Features" },
+	{ 0x14, 0, "Enhanced Allocation" },
+	{ PCI_EXT_CAP_AER, 1, "AER" },
+	{ 0x0002, 1, "Virtual Channel" },
+	{ 0x0003, 1, "Device Serial Number" },
+	{ 0x0004, 1, "Power Budgeting" },
+	{ 0x000b, 1, "Vendor Specific" },
+	{ 0x000d, 1, "ACS" },
+	{ 0x000e, 1, "ARI" },
+	{ 0x000f, 1, "ATS" },
+	{ PCI_EXT_CAP_SRIOV, 1, "SR-IOV" },
+	{ 0x0013, 1, "PRI" },
+	{ 0x0015, 1, "Resizable BAR" },
+	{ 0x0017, 1, "TPH" },
+	{ 0x0018, 1, "LTR" },
+	{ 0x0019, 1, "Secondary PCIe" },
+	{ 0x001b, 1, "PASID" },
+	{ 0x001d, 1, "DPC" },
+	{ 0x001e, 1, "L1 PM Substates" },
+	{ 0x001f, 1, "PTM" },
+	{ 0x0023, 1, "DVSEC" },
+	{ 0x0025, 1, "Data Link Feature" },
+	{ 0x0026, 1, "Physical Layer 16.0 GT/s" },
+	{ 0x0027, 1, "Lane Margining" },
+	{ 0x002a, 1, "Physical Layer 32.0 GT/s" },
+};
+
+const char *pci_cfg_cap_name(uint16_t id, int ext)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(cap_names) / sizeof(cap_names[0]); i++)
+		if (cap_names[i].id == id && cap_names[i].ext == !!ext)
+			return cap_names[i].name;
+	return "?";
+}
+
+/*
+ * The lists come from the device, a broken one may loop: every walk
+ * stops after as many entries as could fit
+ */
+int pci_cfg_caps(const struct pci_cfg *cfg, struct pci_cap *caps, int max)
+{
+	unsigned int off, guard;
+	uint32_t hdr;
+	int n = 0;
+
+	// Status bit 4: there is a capability list
+	if (pci_cfg_r16(cfg, 0x06) & 0x0010) {
+		off = pci_cfg_r8(cfg, 0x34) & ~3;
+		for (guard = 48; off >= 0x40 && off < PCI_CFG_LEN && guard &&
+		     n < max; guard--) {
+			caps[n].id = pci_cfg_r8(cfg, off);
+			caps[n].off = off;
+			caps[n].ext = 0;
+			caps[n].ver = 0;
+			n++;
+			off = pci_cfg_r8(cfg, off + 1) & ~3;
+		}
+	}
+
+	if (cfg->len <= PCI_CFG_LEN)
+		return n;
+
+	off = 0x100;
+	for (guard = (PCI_CFG_EXT_LEN - PCI_CFG_LEN) / 8; guard && n < max;
+	     guard--) {
+		hdr = pci_cfg_r32(cfg, off);
+		if (!hdr || hdr == 0xffffffff)
+			break;
+		caps[n].id = hdr & 0xffff;
+		caps[n].ver = (hdr >> 16) & 0xf;
+		caps[n].off = off;
+		caps[n].ext = 1;
+		n++;
+		off = (hdr >> 20) & ~3;
+		if (off < PCI_CFG_LEN)
+			break;
+	}
+
+	return n;
+}
+
+unsigned int pci_cfg_find(const struct pci_cfg *cfg, uint16_t id, int ext)
+{
+	struct pci_cap caps[PCI_CFG_MAX_CAPS];
+	int i, n = pci_cfg_caps(cfg, caps, PCI_CFG_MAX_CAPS);
+
+	for (i = 0; i < n; i++)
+		if (caps[i].id == id && caps[i].ext == !!ext)
+			return caps[i].off;
+	return 0;
+}
+
+// 2.5, 5, 8, 16, 32, 64 GT/s, in tenths
+static unsigned int link_speed(unsigned int code)
+{
+	static const unsigned int speeds[] = { 0, 25, 50, 80, 160, 320, 640 };
+
+	return code < sizeof(speeds) / sizeof(speeds[0]) ? speeds[code] : 0;
+}
+
+int pci_cfg_link(const struct pci_cfg *cfg, struct pci_link *link)
+{
+	unsigned int off = pci_cfg_find(cfg, PCI_CAP_EXP, 0);
+	uint32_t lnkcap;
+	uint16_t lnksta;
+
+	if (!off)
+		return -1;
+	lnkcap = pci_cfg_r32(cfg, off + 0x0c);
+	lnksta = pci_cfg_r16(cfg, off + 0x12);
+
+	link->max_speed = link_speed(lnkcap & 0xf);
+	link->max_width = (lnkcap >> 4) & 0x3f;
+	link->speed = link_speed(lnksta & 0xf);
+	link->width = (lnksta >> 4) & 0x3f;
+	return 0;
+}
+
+int pci_cfg_msix(const struct pci_cfg *cfg, struct pci_msix *msix)
+{
+	unsigned int off = pci_cfg_find(cfg, PCI_CAP_MSIX, 0);
+	uint16_t ctrl;
+	uint32_t table;
+
+	if (!off)
+		return -1;
+	ctrl = pci_cfg_r16(cfg, off + 2);
+	table = pci_cfg_r32(cfg, off + 4);
+
+	msix->size = (ctrl & 0x7ff) + 1;
+	msix->enabled = !!(ctrl & 0x8000);
+	msix->masked = !!(ctrl & 0x4000);
+	msix->table_bar = table & 7;
+	msix->table_off = table & ~7U;
+	return 0;
+}
+
+int pci_cfg_aer(const struct pci_cfg *cfg, struct pci_aer *aer)
+{
+	unsigned int off = pci_cfg_find(cfg, PCI_EXT_CAP_AER, 1);
+
+	if (!off)
+		return -1;
+	aer->uncor_status = pci_cfg_r32(cfg, off + 0x04);
+	aer->uncor_mask = pci_cfg_r32(cfg, off + 0x08);
+	aer->cor_status = pci_cfg_r32(cfg, off + 0x10);
+	aer->cor_mask = pci_cfg_r32(cfg, off + 0x14);
+	return 0;
+}
+
+int pci_cfg_sriov(const struct pci_cfg *cfg, struct pci_sriov *sriov)
+{
+	unsigned int off = pci_cfg_find(cfg, PCI_EXT_CAP_SRIOV, 1);
+
+	if (!off)
+		return -1;
+	sriov->enabled = pci_cfg_r16(cfg, off + 0x08) & 1;
+	sriov->total_vfs = pci_cfg_r16(cfg, off + 0x0e);
+	sriov->num_vfs = pci_cfg_r16(cfg, off + 0x10);
+	sriov->vf_offset = pci_cfg_r16(cfg, off + 0x14);
+	sriov->vf_stride = pci_cfg_r16(cfg, off + 0x16);
+	sriov->vf_device = pci_cfg_r16(cfg, off + 0x1a);
+	return 0;
+}
+
+static int cmp_bdf(const void *a, const void *b)
+{
+	return strcmp(((const struct pci_cfg *)a)->bdf,
+		      ((const struct pci_cfg *)b)->bdf);
+}
+
+struct scan_ctx {
+	struct pci_cfg *cfgs;
+	char (*names)[PCI_CFG_BDF_LEN];
+	int n;
+	int next;			// next device to read, shared
+};
+
+/*
+ * A read blocks while the kernel resumes a runtime suspended device,
+ * and each config access is a round trip; with several readers the
+ * waits overlap
+ */
+static void *scan_worker(void *arg)
+{
+	struct scan_ctx *ctx = arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED)) <
+	       ctx->n)
+		if (pci_cfg_read(ctx->names[i], &ctx->cfgs[i]))
+			ctx->cfgs[i].len = 0;	// gone meanwhile
+
+	return NULL;
+}
+
+int pci_cfg_scan(int nthreads, struct pci_cfg **cfgs)
+{
+	struct scan_ctx ctx = { 0 };
+	pthread_t tids[64];
+	struct dirent *de;
+	int i, n, cap = 0;
+	DIR *dir;
+
+	dir = opendir("/sys/bus/pci/devices");
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.' ||
+		    strlen(de->d_name) >= PCI_CFG_BDF_LEN)
+			continue;
+		if (ctx.n == cap) {
+			cap = cap ? cap * 2 : 64;
+			ctx.names = realloc(ctx.names, cap * sizeof(*ctx.names));
+			if (!ctx.names) {
+				closedir(dir);
+				return -1;
+			}
+		}
+		strcpy(ctx.names[ctx.n++], de->d_name);
+	}
+	closedir(dir);
+
+	ctx.cfgs = calloc(ctx.n ? ctx.n : 1, sizeof(*ctx.cfgs));
+	if (!ctx.cfgs) {
+		free(ctx.names);
+		return -1;
+	}
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > 64)
+		nthreads = 64;
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&tids[i], NULL, scan_worker, &ctx))
+			break;
+	n = i;
+	if (!n)
+		scan_worker(&ctx);
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+	free(ctx.names);
+
+	// Drop the ones that vanished, then by BDF for the diff
+	for (i = n = 0; i < ctx.n; i++)
+		if (ctx.cfgs[i].len)
+			ctx.cfgs[n++] = ctx.cfgs[i];
+	qsort(ctx.cfgs, n, sizeof(*ctx.cfgs), cmp_bdf);
+
+	*cfgs = ctx.cfgs;
+	return n;
+}
+
+static uint16_t stored_len(const struct pci_cfg *cfg)
+{
+	int len = cfg->len & ~3;
+
+	while (len > 64 && !pci_cfg_r32(cfg, len - 4))
+		len -= 4;
+	return len;
+}
+
+int pci_snap_write(const char *path, const struct pci_cfg *cfgs, int n)
+{
+	struct snap_hdr hdr = {
+		.magic = SNAP_MAGIC,
+		.version = SNAP_VERSION,
+		.count = n,
+	};
+	struct snap_rec rec;
+	FILE *f;
+	int i, err;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return -1;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	for (i = 0; i < n; i++) {
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.bdf, cfgs[i].bdf, sizeof(rec.bdf));
+		rec.len = cfgs[i].len;
+		rec.stored = stored_len(&cfgs[i]);
+		fwrite(&rec, sizeof(rec), 1, f);
+		fwrite(cfgs[i].data, rec.stored, 1, f);
+	}
+	err = ferror(f);
+	return fclose(f) || err ? -1 : 0;
+}
+
+int pci_snap_read(const char *path, struct pci_cfg **cfgs)
+{
+	struct snap_hdr hdr;
+	struct snap_rec rec;
+	struct pci_cfg *c;
+	uint32_t i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -1;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != SNAP_MAGIC ||
+	    hdr.version != SNAP_VERSION) {
+		fprintf(stderr, "%s: not a snapshot\n", path);
+		goto err;
+	}
+
+	c = calloc(hdr.count ? hdr.count : 1, sizeof(*c));
+	if (!c)
+		goto err;
+	for (i = 0; i < hdr.count; i++) {
+		if (fread(&rec, sizeof(rec), 1, f) != 1 ||
+		    rec.stored > PCI_CFG_EXT_LEN || rec.len > PCI_CFG_EXT_LEN ||
+		    fread(c[i].data, rec.stored, 1, f) != (rec.stored ? 1U : 0U)) {
+			fprintf(stderr, "%s: truncated\n", path);
+			free(c);
+			goto err;
+		}
+		memcpy(c[i].bdf, rec.bdf, sizeof(rec.bdf));
+		c[i].bdf[PCI_CFG_BDF_LEN - 1] = '\0';
+		c[i].len = rec.len;
+	}
+	fclose(f);
+
+	qsort(c, hdr.count, sizeof(*c), cmp_bdf);
+	*cfgs = c;
+	return hdr.count;
+err:
+	fclose(f);
+	return -1;
+}
+
+// Which capability a changed register belongs to
+static const char *where(const struct pci_cfg *cfg, unsigned int off)
+{
+	struct pci_cap caps[PCI_CFG_MAX_CAPS];
+	int i, n = pci_cfg_caps(cfg, caps, PCI_CFG_MAX_CAPS);
+	const char *name = off < 0x40 ? "header" : "";
+	unsigned int best = 0;
+
+	// The capability starting closest below off, in its own list
+	for (i = 0; i < n; i++) {
+		if (caps[i].ext != (off >= PCI_CFG_LEN) || caps[i].off > off ||
+		    caps[i].off < best)
+			continue;
+		best = caps[i].off;
+		name = pci_cfg_cap_name(caps[i].id, caps[i].ext);
+	}
+	return name;
+}
+
+static int diff_one(const struct pci_cfg *a, const struct pci_cfg *b,
+		    FILE *out)
+{
+	unsigned int off, len = a->len > b->len ? a->len : b->len;
+	int changed = 0;
+	uint32_t va, vb;
+
+	if (a->len == b->len && !memcmp(a->data, b->data, a->len))
+		return 0;
+
+	for (off = 0; off < len; off += 4) {
+		va = off < a->len ? pci_cfg_r32(a, off) : 0;
+		vb = off < b->len ? pci_cfg_r32(b, off) : 0;
+		if (va == vb)
+			continue;
+		if (!changed++)
+			fprintf(out, "%s:\n", a->bdf);
+		fprintf(out, "\t%03x: %08x -> %08x  %s\n", off, va, vb,
+			where(a, off));
+	}
+	if (a->len != b->len) {
+		if (!changed++)
+			fprintf(out, "%s:\n", a->bdf);
+		fprintf(out, "\tread %u -> %u bytes\n", a->len, b->len);
+	}
+	return !!changed;
+}
+
+// Both sorted by BDF: one merge pass, memcmp for the equal ones
+int pci_cfg_diff(const struct pci_cfg *a, int na, const struct pci_cfg *b,
+		 int nb, FILE *out)
+{
+	int i = 0, j = 0, c, ndiff = 0;
+
+	while (i < na || j < nb) {
+		c = i == na ? 1 : j == nb ? -1 : strcmp(a[i].bdf, b[j].bdf);
+		if (c < 0) {
+			fprintf(out, "%s: only in the first\n", a[i++].bdf);
+			ndiff++;
+		} else if (c > 0) {
+			fprintf(out, "%s: only in the second\n", b[j++].bdf);
+			ndiff++;
+		} else {
+			ndiff += diff_one(&a[i++], &b[j++], out);
+		}
+	}
+
+	return ndiff;
+}
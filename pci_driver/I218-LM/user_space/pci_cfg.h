@@ -0,0 +1,114 @@
+#ifndef PCI_CFG_H
+#define PCI_CFG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Config space of PCI devices read in one pass from sysfs: 4 KiB of
+ * extended config space as root, 256 bytes on a conventional PCI
+ * device, 64 bytes (the header) for anybody else. Capabilities are
+ * parsed from the copy, snapshots of many devices go to a compact
+ * binary file.
+ */
+
+#define PCI_CFG_LEN		256
+#define PCI_CFG_EXT_LEN		4096
+#define PCI_CFG_BDF_LEN		16	// "0000:00:19.0"
+
+struct pci_cfg {
+	char bdf[PCI_CFG_BDF_LEN];
+	uint16_t len;			// bytes read
+	uint8_t data[PCI_CFG_EXT_LEN];
+};
+
+// Standard capability IDs (offset 0x34 list)
+#define PCI_CAP_PM		0x01
+#define PCI_CAP_MSI		0x05
+#define PCI_CAP_EXP		0x10	// PCI Express
+#define PCI_CAP_MSIX		0x11
+
+// Extended capability IDs (list at 0x100)
+#define PCI_EXT_CAP_AER		0x0001
+#define PCI_EXT_CAP_SRIOV	0x0010
+
+struct pci_cap {
+	uint16_t id;
+	uint16_t off;
+	uint8_t ext;			// in the extended list
+	uint8_t ver;			// extended only
+};
+
+#define PCI_CFG_MAX_CAPS	64
+
+struct pci_link {
+	unsigned int speed;		// GT/s x 10: 25, 50, 80, 160, 320, 640
+	unsigned int width;
+	unsigned int max_speed;
+	unsigned int max_width;
+};
+
+struct pci_msix {
+	unsigned int size;		// table entries
+	int enabled;
+	int masked;
+	unsigned int table_bar;
+	uint32_t table_off;
+};
+
+struct pci_aer {
+	uint32_t uncor_status;
+	uint32_t uncor_mask;
+	uint32_t cor_status;
+	uint32_t cor_mask;
+};
+
+struct pci_sriov {
+	unsigned int total_vfs;
+	unsigned int num_vfs;
+	int enabled;
+	unsigned int vf_offset;
+	unsigned int vf_stride;
+	uint16_t vf_device;
+};
+
+int pci_cfg_read(const char *bdf, struct pci_cfg *cfg);
+
+static inline uint8_t pci_cfg_r8(const struct pci_cfg *cfg, unsigned int off)
+{
+	return off < cfg->len ? cfg->data[off] : 0xff;
+}
+
+static inline uint16_t pci_cfg_r16(const struct pci_cfg *cfg, unsigned int off)
+{
+	return pci_cfg_r8(cfg, off) | pci_cfg_r8(cfg, off + 1) << 8;
+}
+
+static inline uint32_t pci_cfg_r32(const struct pci_cfg *cfg, unsigned int off)
+{
+	return pci_cfg_r16(cfg, off) | (uint32_t)pci_cfg_r16(cfg, off + 2) << 16;
+}
+
+// Both lists in order, the standard one first; returns the count
+int pci_cfg_caps(const struct pci_cfg *cfg, struct pci_cap *caps, int max);
+// Offset of the capability, 0 when the device has none
+unsigned int pci_cfg_find(const struct pci_cfg *cfg, uint16_t id, int ext);
+const char *pci_cfg_cap_name(uint16_t id, int ext);
+
+// 0 when decoded, -1 when the capability is missing or was not read
+int pci_cfg_link(const struct pci_cfg *cfg, struct pci_link *link);
+int pci_cfg_msix(const struct pci_cfg *cfg, struct pci_msix *msix);
+int pci_cfg_aer(const struct pci_cfg *cfg, struct pci_aer *aer);
+int pci_cfg_sriov(const struct pci_cfg *cfg, struct pci_sriov *sriov);
+
+// Every device under /sys/bus/pci/devices with nthreads readers, by BDF
+int pci_cfg_scan(int nthreads, struct pci_cfg **cfgs);
+
+int pci_snap_write(const char *path, const struct pci_cfg *cfgs, int n);
+int pci_snap_read(const char *path, struct pci_cfg **cfgs);
+
+// Differences of two sorted sets to out; returns the devices that differ
+int pci_cfg_diff(const struct pci_cfg *a, int na, const struct pci_cfg *b,
+		 int nb, FILE *out);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	// getopt, sysconf
+#include <time.h>
+
+#include "pci_cfg.h"
+
+/*
+ * Config space audit: scan every device in parallel, save snapshots,
+ * show one device, diff two snapshots (or a snapshot and this host).
+ */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// One line per device
+static void summary(const struct pci_cfg *cfg)
+{
+	struct pci_sriov sriov;
+	struct pci_link link;
+	struct pci_msix msix;
+	struct pci_aer aer;
+
+	printf("%s %04x:%04x %4u", cfg->bdf, pci_cfg_r16(cfg, 0x00),
+	       pci_cfg_r16(cfg, 0x02), cfg->len);
+	if (!pci_cfg_link(cfg, &link))
+		printf("  link %u.%u GT/s x%u (max %u.%u x%u)",
+		       link.speed / 10, link.speed % 10, link.width,
+		       link.max_speed / 10, link.max_speed % 10,
+		       link.max_width);
+	if (!pci_cfg_msix(cfg, &msix))
+		printf("  msix %u%s", msix.size, msix.enabled ? "+" : "");
+	if (!pci_cfg_aer(cfg, &aer))
+		printf("  aer uncor %08x cor %08x", aer.uncor_status,
+		       aer.cor_status);
+	if (!pci_cfg_sriov(cfg, &sriov))
+		printf("  sriov %u/%u", sriov.num_vfs, sriov.total_vfs);
+	printf("\n");
+}
+
+static void show(const struct pci_cfg *cfg)
+{
+	struct pci_cap caps[PCI_CFG_MAX_CAPS];
+	struct pci_sriov sriov;
+	struct pci_msix msix;
+	struct pci_aer aer;
+	int i, n;
+
+	summary(cfg);
+
+	n = pci_cfg_caps(cfg, caps, PCI_CFG_MAX_CAPS);
+	for (i = 0; i < n; i++)
+		printf("  [%03x] %s%s (0x%02x)\n", caps[i].off,
+		       caps[i].ext ? "ext " : "",
+		       pci_cfg_cap_name(caps[i].id, caps[i].ext), caps[i].id);
+
+	if (!pci_cfg_msix(cfg, &msix))
+		printf("  MSI-X: %u vectors, table BAR%u+0x%x%s%s\n", msix.size,
+		       msix.table_bar, msix.table_off,
+		       msix.enabled ? ", enabled" : "",
+		       msix.masked ? ", masked" : "");
+	if (!pci_cfg_aer(cfg, &aer))
+		printf("  AER: uncorrectable %08x (mask %08x), correctable %08x (mask %08x)\n",
+		       aer.uncor_status, aer.uncor_mask, aer.cor_status,
+		       aer.cor_mask);
+	if (!pci_cfg_sriov(cfg, &sriov))
+		printf("  SR-IOV: %u of %u VFs%s, offset %u stride %u, VF device %04x\n",
+		       sriov.num_vfs, sriov.total_vfs,
+		       sriov.enabled ? " enabled" : "", sriov.vf_offset,
+		       sriov.vf_stride, sriov.vf_device);
+
+	for (i = 0; i < cfg->len; i++) {
+		if (i % 16 == 0)
+			printf("%s%03x: ", i ? "\n" : "", i);
+		printf("%02x ", cfg->data[i]);
+	}
+	printf("\n");
+}
+
+// A snapshot file, or "-" for a scan of this host
+static int load(const char *src, int jobs, struct pci_cfg **cfgs)
+{
+	int n = strcmp(src, "-") ? pci_snap_read(src, cfgs) :
+				   pci_cfg_scan(jobs, cfgs);
+
+	if (n < 0)
+		perror(src);
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-j JOBS] scan [-o SNAPSHOT]\n"
+		"       %s [-f SNAPSHOT] show BDF\n"
+		"       %s [-j JOBS] diff SNAPSHOT|- SNAPSHOT|-\n"
+		"  -j   parallel readers, one per CPU by default\n"
+		"  -    this host, scanned now\n",
+		prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	struct pci_cfg *a = NULL, *b = NULL, one;
+	const char *snap = NULL, *out = NULL;
+	int opt, i, n, nb, ret = EXIT_FAILURE;
+	const char *prog = argv[0];
+	const char *cmd;
+	uint64_t t;
+
+	while ((opt = getopt(argc, argv, "j:f:o:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'f':
+			snap = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(prog);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind == argc) {
+		usage(prog);
+		return EXIT_FAILURE;
+	}
+	cmd = argv[optind++];
+
+	// "scan -o FILE" as well as "-o FILE scan"
+	if (!strcmp(cmd, "scan") && optind + 2 == argc &&
+	    !strcmp(argv[optind], "-o"))
+		out = argv[optind + 1];
+	else if (!strcmp(cmd, "scan") && optind != argc)
+		cmd = "";
+
+	if (!strcmp(cmd, "scan")) {
+		t = now_ns();
+		n = pci_cfg_scan(jobs, &a);
+		t = now_ns() - t;
+		if (n < 0) {
+			perror("/sys/bus/pci/devices");
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < n; i++)
+			summary(&a[i]);
+		fprintf(stderr, "%d devices in %.2f ms, %d readers\n", n,
+			t / 1e6, jobs);
+		if (out && pci_snap_write(out, a, n)) {
+			perror(out);
+			goto done;
+		}
+		ret = EXIT_SUCCESS;
+	} else if (!strcmp(cmd, "show") && optind + 1 == argc) {
+		if (!snap) {
+			if (pci_cfg_read(argv[optind], &one)) {
+				perror(argv[optind]);
+				return EXIT_FAILURE;
+			}
+			show(&one);
+			return EXIT_SUCCESS;
+		}
+		n = load(snap, jobs, &a);
+		for (i = 0; i < n; i++) {
+			if (!strcmp(a[i].bdf, argv[optind])) {
+				show(&a[i]);
+				ret = EXIT_SUCCESS;
+			}
+		}
+		if (n >= 0 && ret)
+			fprintf(stderr, "%s: not in %s\n", argv[optind], snap);
+	} else if (!strcmp(cmd, "diff") && optind + 2 == argc) {
+		n = load(argv[optind], jobs, &a);
+		nb = n < 0 ? -1 : load(argv[optind + 1], jobs, &b);
+		if (nb >= 0) {
+			t = now_ns();
+			i = pci_cfg_diff(a, n, b, nb, stdout);
+			fprintf(stderr, "%d of %d/%d devices differ, %.2f ms\n",
+				i, n, nb, (now_ns() - t) / 1e6);
+			// diff(1) style: 1 when there are differences
+			ret = i ? 1 : EXIT_SUCCESS;
+		}
+	} else {
+		usage(prog);
+	}
+done:
+	free(a);
+	free(b);
+	return ret;
+}
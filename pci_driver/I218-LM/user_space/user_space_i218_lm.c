@@ -4,8 +4,10 @@
 #include <fcntl.h>	// open
 #include <unistd.h>	// close
 #include <sys/mman.h>	// mmap, munmap
+#include <sys/stat.h>	// fstat, the size of a resource file
 #include <errno.h>	// perror, errno
 #include <stdint.h>	// uint32_t, etc.
+#include <time.h>	// clock_gettime
 
 // Target PCI device's BDF (Bus:Device.Function)
 #define TARGET_BDF "0000:00:19.0"
@@ -13,9 +15,6 @@
 // PCI Configuration Space is 64 bytes for PCI devices
 #define CONFIG_SPACE_SIZE 64
 
-#define MAP_SIZE	8		// Map 4KB (one page)
-#define MAP_MASK	(MAP_SIZE - 1)	// Mask for alignment
-
 // BAR offsets in PCI configuration space
 #define BAR0_OFFSET 0x10
 #define BAR1_OFFSET 0x14
@@ -25,21 +24,222 @@
 #define BAR5_OFFSET 0x24
 #define NUM_BARS 6
 
-int main(void)
+// Register read by the latency benchmark: STATUS, harmless to read
+#define BENCH_READ_OFFSET 0x08
+
+static const char *bdf = TARGET_BDF;
+
+/*
+ * A BAR mapped through sysfs: /sys/bus/pci/devices/BDF/resourceN, or
+ * resourceN_wc (write combining), which exists for prefetchable BARs
+ * only. After the mmap every access is a plain load or store, no
+ * system call.
+ */
+struct bar_map {
+	volatile uint8_t *base;
+	size_t len;
+	int wc;
+};
+
+static int map_bar(int bar, int wc, struct bar_map *map)
+{
+	char path[256];
+	struct stat st;
+	void *base;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/resource%d%s",
+		 bdf, bar, wc ? "_wc" : "");
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		if (!wc || errno != ENOENT)
+			perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		fprintf(stderr, "%s: not a memory BAR\n", path);
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	close(fd);	// the mapping stays
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	map->base = base;
+	map->len = st.st_size;
+	map->wc = wc;
+	return 0;
+}
+
+static void unmap_bar(struct bar_map *map)
+{
+	munmap((void *)map->base, map->len);
+}
+
+static int check_range(struct bar_map *map, unsigned long off, size_t len,
+		       int width)
+{
+	if (off % width || off + len > map->len || off + len < off) {
+		fprintf(stderr, "0x%lx+%zu: outside the %zu byte BAR or unaligned\n",
+			off, len, map->len);
+		return -1;
+	}
+	return 0;
+}
+
+static uint32_t reg_read(struct bar_map *map, unsigned long off, int width)
+{
+	switch (width) {
+	case 1:
+		return *(volatile uint8_t *)(map->base + off);
+	case 2:
+		return *(volatile uint16_t *)(map->base + off);
+	default:
+		return *(volatile uint32_t *)(map->base + off);
+	}
+}
+
+static void reg_write(struct bar_map *map, unsigned long off, uint32_t val,
+		      int width)
+{
+	switch (width) {
+	case 1:
+		*(volatile uint8_t *)(map->base + off) = val;
+		break;
+	case 2:
+		*(volatile uint16_t *)(map->base + off) = val;
+		break;
+	default:
+		*(volatile uint32_t *)(map->base + off) = val;
+	}
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 32-bit reads, the way the kernel's ioread32 loop reads them
+static void dump(struct bar_map *map, unsigned long off, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += 4) {
+		if (i % 16 == 0)
+			printf("%s%08lx: ", i ? "\n" : "", off + i);
+		printf("%08x ", reg_read(map, off + i, 4));
+	}
+	printf("\n");
+}
+
+// Until (reg & mask) == val or timeout_ms is up
+static int poll_reg(struct bar_map *map, unsigned long off, uint32_t mask,
+		    uint32_t val, unsigned int timeout_ms)
+{
+	uint64_t t0 = now_ns(), t;
+	unsigned long reads = 0;
+	uint32_t r;
+
+	do {
+		r = reg_read(map, off, 4);
+		reads++;
+		t = now_ns() - t0;
+		if ((r & mask) == val) {
+			printf("0x%lx = 0x%08x after %llu ns, %lu reads\n",
+			       off, r, (unsigned long long)t, reads);
+			return 0;
+		}
+	} while (t < timeout_ms * 1000000ULL);
+
+	printf("0x%lx = 0x%08x, no match after %u ms\n", off, r, timeout_ms);
+	return 1;
+}
+
+/*
+ * MMIO read latency: every read is a non-posted round trip to the
+ * device, the CPU stalls until the completion is back. The per-read
+ * minimum has the cost of clock_gettime() taken out.
+ */
+static void bench_read(struct bar_map *map, unsigned long off,
+		       unsigned int iters)
+{
+	uint64_t t0, t, best = UINT64_MAX, empty = UINT64_MAX, total;
+	volatile uint32_t sink;
+	unsigned int i;
+
+	for (i = 0; i < 1000; i++) {
+		t0 = now_ns();
+		t = now_ns() - t0;
+		if (t < empty)
+			empty = t;
+	}
+
+	for (i = 0; i < iters; i++) {
+		t0 = now_ns();
+		sink = reg_read(map, off, 4);
+		t = now_ns() - t0;
+		if (t < best)
+			best = t;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < iters; i++)
+		sink = reg_read(map, off, 4);
+	total = now_ns() - t0;
+	(void)sink;
+
+	printf("read 0x%lx: %u reads, avg %.1f ns, min %llu ns\n", off, iters,
+	       (double)total / iters,
+	       (unsigned long long)(best > empty ? best - empty : 0));
+}
+
+/*
+ * Write bandwidth over len bytes at off with 64-bit stores. Posted
+ * writes do not wait for the device; with write combining the CPU
+ * also merges them into full cache line bursts. A read at the end
+ * of every pass flushes the buffers, so the time covers delivery.
+ */
+static void bench_write(struct bar_map *map, unsigned long off, size_t len,
+			unsigned int iters)
+{
+	volatile uint64_t *p = (volatile uint64_t *)(map->base + off);
+	size_t i, n = len / 8;
+	unsigned int it;
+	uint64_t t0, t;
+
+	t0 = now_ns();
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < n; i++)
+			p[i] = i;
+		__sync_synchronize();
+		(void)reg_read(map, off, 4);
+	}
+	t = now_ns() - t0;
+
+	printf("write %s 0x%lx+%zu: %u passes, %.1f MB/s\n",
+	       map->wc ? "wc" : "uc", off, len, iters,
+	       (double)len * iters * 1000 / t);
+}
+
+static int show_config(void)
 {
 	char config_path[256];
 	uint8_t config_space[CONFIG_SPACE_SIZE];
 	int fd, i, config_space_real;
 	uint32_t bar_array[NUM_BARS];
 
-	void *mapped_base;
-	// void *mapped_dev_base;
-	uint32_t read_result;
-	uint32_t write_val;
-
 	// Build the path to the configuration space
 	snprintf(config_path, sizeof(config_path), "/sys/bus/pci/devices/%s/config",
-		TARGET_BDF);
+		bdf);
 
 	printf("config_path is: %s\n", config_path);
 
@@ -64,7 +264,7 @@ int main(void)
 	close(fd);
 
 	// Print the configuration space (hex dump)
-	printf("PCI Configuration Space for %s:\n", TARGET_BDF);
+	printf("PCI Configuration Space for %s:\n", bdf);
 	for (i = 0; i < CONFIG_SPACE_SIZE; i++) {
 		if (i % 16 == 0)
 			printf("\n%02x: ", i);
@@ -94,3 +294,129 @@ int main(void)
 	printf("\n");
 	return EXIT_SUCCESS;
 }
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s BDF] [-b BAR] [-W 1|2|4] [-n ITERS] [command]\n"
+		"  config                       config space and BARs (default)\n"
+		"  read OFF                     one register\n"
+		"  write OFF VAL                one register\n"
+		"  dump OFF LEN                 LEN bytes as 32-bit words\n"
+		"  poll OFF MASK VAL [MS]       until (reg & MASK) == VAL, 1000 ms\n"
+		"  bench [OFF [WOFF WLEN]]      read latency of OFF (0x%x); write\n"
+		"                               bandwidth over WLEN bytes at WOFF,\n"
+		"                               uc and, if there is one, wc mapping\n"
+		"  -s BDF  device, %s    -b BAR  0\n"
+		"  -W      access width in bytes, 4    -n  bench rounds, 100000\n",
+		prog, BENCH_READ_OFFSET, TARGET_BDF);
+}
+
+int main(int argc, char **argv)
+{
+	const char *prog = argv[0];
+	unsigned int iters = 100000;
+	struct bar_map map, wc_map;
+	int bar = 0, width = 4;
+	const char *cmd;
+	unsigned long off;
+	size_t len;
+	int opt, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "s:b:W:n:h")) != -1) {
+		switch (opt) {
+		case 's':
+			bdf = optarg;
+			break;
+		case 'b':
+			bar = atoi(optarg);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(prog);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bar < 0 || bar >= NUM_BARS || (width != 1 && width != 2 &&
+					   width != 4) || !iters) {
+		usage(prog);
+		return EXIT_FAILURE;
+	}
+
+	cmd = optind < argc ? argv[optind++] : "config";
+	argc -= optind;
+	argv += optind;
+
+	if (!strcmp(cmd, "config"))
+		return show_config();
+
+	if (map_bar(bar, 0, &map))
+		return EXIT_FAILURE;
+
+	if (!strcmp(cmd, "read") && argc == 1) {
+		off = strtoul(argv[0], NULL, 0);
+		if (check_range(&map, off, width, width))
+			ret = EXIT_FAILURE;
+		else
+			printf("0x%lx = 0x%0*x\n", off, width * 2,
+			       reg_read(&map, off, width));
+	} else if (!strcmp(cmd, "write") && argc == 2) {
+		off = strtoul(argv[0], NULL, 0);
+		if (check_range(&map, off, width, width))
+			ret = EXIT_FAILURE;
+		else
+			reg_write(&map, off, strtoul(argv[1], NULL, 0), width);
+	} else if (!strcmp(cmd, "dump") && argc == 2) {
+		off = strtoul(argv[0], NULL, 0);
+		len = strtoul(argv[1], NULL, 0);
+		if (check_range(&map, off, len, 4))
+			ret = EXIT_FAILURE;
+		else
+			dump(&map, off, len);
+	} else if (!strcmp(cmd, "poll") && (argc == 3 || argc == 4)) {
+		off = strtoul(argv[0], NULL, 0);
+		if (check_range(&map, off, 4, 4))
+			ret = EXIT_FAILURE;
+		else
+			ret = poll_reg(&map, off, strtoul(argv[1], NULL, 0),
+				       strtoul(argv[2], NULL, 0),
+				       argc == 4 ? atoi(argv[3]) : 1000);
+	} else if (!strcmp(cmd, "bench") && (argc == 0 || argc == 1 ||
+					     argc == 3)) {
+		off = argc ? strtoul(argv[0], NULL, 0) : BENCH_READ_OFFSET;
+		if (check_range(&map, off, 4, 4))
+			ret = EXIT_FAILURE;
+		else
+			bench_read(&map, off, iters);
+
+		// Writes change the device, only where the user says so
+		if (ret == EXIT_SUCCESS && argc == 3) {
+			off = strtoul(argv[1], NULL, 0);
+			len = strtoul(argv[2], NULL, 0) & ~7UL;
+			if (!len || check_range(&map, off, len, 8)) {
+				ret = EXIT_FAILURE;
+			} else {
+				bench_write(&map, off, len, iters / 100 ?: 1);
+				if (!map_bar(bar, 1, &wc_map)) {
+					bench_write(&wc_map, off, len,
+						    iters / 100 ?: 1);
+					unmap_bar(&wc_map);
+				} else {
+					printf("no resource%d_wc, BAR%d is not prefetchable\n",
+					       bar, bar);
+				}
+			}
+		}
+	} else {
+		usage(prog);
+		ret = EXIT_FAILURE;
+	}
+
+	unmap_bar(&map);
+	return ret;
+}